@@ -16,6 +16,10 @@ Logic is:  if UART TX (from host Arduino) gets pulled low for more than 800 ms,
 the target MCU will be reset by an external watchdog circuit.
 
 Programming is initialzed by typing a "0" into the serial monitor
+Typing a "1" times loading firmware.hex (with and without record checksum
+checks) against its compressed twin firmware.hxz
+A "2" starts a framed upload streamed from the PC by tools/stk_upload
+A "3" times raw SD block reads and writes against the SPI clock
 
 *
 */
@@ -34,7 +38,10 @@ Programming is initialzed by typing a "0" into the serial monitor
 
 //List of command codes you can enter from your PC serial monitor to control things.
 enum serial_test_cmd_codes_t{
-   CMD_PROGRAM_TARGET
+   CMD_PROGRAM_TARGET,
+   CMD_BENCHMARK_IMAGES,
+   CMD_SERIAL_UPLOAD,
+   CMD_BENCHMARK_SPI
 };
 
 
@@ -65,7 +72,12 @@ void setup(){
    //Start UART peripheral communicating with attached target MCU Optiboot bootloader
    Serial1.begin(OPTIBOOT_BAUD_RATE);
    //Begin SPI communication with the SD card
-   Serial.println("Done initializing SD card");
+   if(stk500.begin()){
+      Serial.println("Done initializing SD card");
+   }
+   else{
+      Serial.println("SD card init failed!");
+   }
 }
 /*= End of SETUP function =*/
 /*=============================================<<<<<*/
@@ -101,6 +113,42 @@ void loop(){
             break;
          }
 
+         case CMD_BENCHMARK_IMAGES:
+         {
+            //Compare plain and compressed copies of the same image (no target needed)
+            Serial.println("benchmarking image formats");
+            stk500.benchmarkImage("firmware.hex", false);
+            stk500.benchmarkImage("firmware.hex");
+            stk500.benchmarkImage("firmware.hxz");
+            break;
+         }
+
+         case CMD_SERIAL_UPLOAD:
+         {
+            //Framed upload from tools/stk_upload on the PC, no SD card swap needed
+            unsigned int timeStart = millis();
+            if(stk500.programFromSerial(Serial)){
+               Serial.println("flash success!");
+            }
+            else{
+               Serial.println("Flash failed!");
+            }
+            Serial.print("Process took ");
+            Serial.print((millis() - timeStart), DEC);
+            Serial.println(" ms");
+            break;
+         }
+
+         case CMD_BENCHMARK_SPI:
+         {
+            //Raw block transfers through the SPI driver (no target needed)
+            Serial.println("benchmarking SPI");
+            if(!stk500.benchmarkSpi()){
+               Serial.println("SPI benchmark failed!");
+            }
+            break;
+         }
+
          default:
          {
             Serial.println("Invalid PC command");
@@ -3,12 +3,16 @@
 ===============================================>>>>>*/
 #include "Arduino.h"
 #include "STK_500_Programmer.h"
+#include "STK_Engine.h"
 #include "stk500.h"
+#include "serial_upload.h"
 
 
 
+//Fastest SD card SPI clock to try, sd.begin() steps up toward it from 400 kHz
+//while CRC checked reads pass (fixed rate if ENABLE_SPI_CLOCK_TUNING is 0)
 #define SPI_SPEED_MHZ 10
-#define MHZ 1000000
+#define MHZ 1000000UL
 
 /*=============================================>>>>>
 = Defines =
@@ -23,6 +27,13 @@ HexFileClass hexFile; //Declare a hexFile object for working with entire hexfile
 SdFat sd;            //The instance of the SDFat utility
 //Buffer for storing retrieved bytes from SD card
 char sdBuf[MAX_CHARS_PER_HEX_RECORD];       //Longest hex file record to be read is 45... so go 50 just to be safe
+//Default home for the resident decoded image cache
+#if STK_IMAGE_CACHE_PAGES
+RamImageCacheStorage ramImageCacheStorage;
+ImageCacheStorage* const defaultImageCacheStorage = &ramImageCacheStorage;
+#else
+ImageCacheStorage* const defaultImageCacheStorage = NULL;
+#endif
 
 
 /*=============================================>>>>>
@@ -108,51 +119,27 @@ can communicate with =
 ===============================================>>>>>*/
 
 bool getSync(){
-   Serial1.write(STK_GET_SYNC);
-   Serial1.write(CRC_EOP);
+   byte msg[STK_MAX_MSG_BYTES];
+   Serial1.write(msg, STK_build_sync_msg(msg));
    return STK_wait_receive(STK_OK, 2, 500, "STK_GET_SYNC");
 }
 
 
 void STK_send_address_msg(uint16_t target_addr){
-   Serial1.write(STK_LOAD_ADDRESS);
-   Serial1.write(target_addr&0xFF);       //Send addr_low
-   Serial1.write((target_addr>>8)&0xFF);  //Send addr_high
-   Serial1.write(CRC_EOP);
+   byte msg[STK_MAX_MSG_BYTES];
+   Serial1.write(msg, STK_build_address_msg(msg, target_addr));
 }
 
 /*=============================================>>>>>
 = Function that sends out a page of flash data to the target MCU using
-STK_PROG_PAGE 0x64
+STK_PROG_PAGE 0x64.  The whole message goes out in one write so the UART
+driver can stream it instead of taking one call per byte
 =
 ===============================================>>>>>*/
 
 void STK_send_prog_page_msg( flash_page_block_t &targBlock){
-   /*=============================================>>>>>
-   = Message header =
-   ===============================================>>>>>*/
-   Serial1.write(STK_PROG_PAGE); //Send program page command
-   Serial1.write((byte)((BYTES_PER_FLASH_BLOCK >> 8) & 0xFF));   //Send bytes_high
-   Serial1.write((byte)(BYTES_PER_FLASH_BLOCK & 0xFF));  //Send bytes low
-   Serial1.write((byte)STK_MEMTYPE_FLASH);   //Send memtype
-   /*=============================================>>>>>
-   = Data payload =
-   ===============================================>>>>>*/
-   for(uint16_t count = 0; count < BYTES_PER_FLASH_BLOCK; count++){
-      if(count < targBlock.block_size_bytes){
-         Serial1.write(targBlock.dataBytes[count]);
-      }
-      else{
-         //Pad the rest of the flash block with 0xFF's
-         Serial1.write(0xFF);
-      }
-   }
-   //Pad rest of page with 0xFF if only partial page is being written
-
-   /*=============================================>>>>>
-   = Terminating byte =
-   ===============================================>>>>>*/
-   Serial1.write(CRC_EOP);
+   byte msg[STK_MAX_MSG_BYTES];
+   Serial1.write(msg, STK_build_prog_page_msg(msg, targBlock));
 }
 
 
@@ -166,14 +153,8 @@ bool STK_get_flash_block(flash_page_block_t &targetFlashBlock){
    // myLog.info("Reading flash block at word address %#04X ", targetFlashBlock.addressStart);
    // Serial.flush();
 
-   /*=============================================>>>>>
-   = Message header =
-   ===============================================>>>>>*/
-   Serial1.write(STK_READ_PAGE); //Send read page command
-   Serial1.write( (byte) ((BYTES_PER_FLASH_BLOCK >> 8) & 0xFF) );//Write bytes_high
-   Serial1.write( (byte) (BYTES_PER_FLASH_BLOCK & 0xFF));   //Write bytes_low
-   Serial1.write((byte) STK_MEMTYPE_FLASH);
-   Serial1.write(CRC_EOP);
+   byte msg[STK_MAX_MSG_BYTES];
+   Serial1.write(msg, STK_build_read_page_msg(msg));
    //Wait for firt byte to come back
    if(!STK_wait_receive(STK_INSYNC, 1, 500, "STK_READ_PAGE - start")){
       return false;
@@ -201,6 +182,91 @@ bool STK_get_flash_block(flash_page_block_t &targetFlashBlock){
    return STK_wait_receive(STK_OK, 1, 500, "STK_READ_PAGE - end");
 
 }
+/*=============================================>>>>>
+= Function that sets the target address and programs one flash page =
+===============================================>>>>>*/
+
+bool STK_write_flash_page(flash_page_block_t &sourceBlock){
+   //Compose a STK message that sets Optiboot target address to equivalent in hex record
+   STK_send_address_msg(sourceBlock.addressStart);
+   //Wait for appropriate response
+   if(!STK_wait_receive(STK_OK, 2, 100, "STK_LOAD_ADDRESS")){
+      //Didn't get appropriate response
+      char myBuf[256];
+      snprintf(myBuf, 256, "Failed to set address 0X%0X", sourceBlock.addressStart);
+      Serial.println(myBuf);
+
+      return false;
+   }
+   //Got appropriate response!
+   STK_send_prog_page_msg(sourceBlock);
+   //Wait for appropriate response
+   if(!STK_wait_receive(STK_OK, 2, 1000, "STK_PROG_PAGE")){
+      char myBuf[256];
+      snprintf(myBuf, 256, "Failed to program page at address 0x%0x", sourceBlock.addressStart);
+      Serial.println(myBuf);
+
+      return false;
+   }
+   return true;
+}
+
+/*=============================================>>>>>
+= Function that reads one flash page back from the target and compares it with
+the page that should have been programmed =
+===============================================>>>>>*/
+
+bool STK_verify_flash_page(flash_page_block_t &sourceBlock){
+   //Compose a STK message that sets Optiboot target address to equivalent in hex record
+   STK_send_address_msg(sourceBlock.addressStart);
+   //Wait for appropriate response
+   if(!STK_wait_receive(STK_OK, 2, 100, "STK_LOAD_ADDRESS")){
+      //Didn't get appropriate response
+      char myBuf[256];
+      snprintf(myBuf, 256, "Failed to set address 0X%0X", sourceBlock.addressStart);
+      Serial.println(myBuf);
+
+      return false;
+   }
+   //Got appropriate response!
+
+   // myLog.info("Address successfully set");
+   //Set target flash block address and size equal to the one in the sd hex file
+   flash_page_block_t targetFlashBlock;
+   targetFlashBlock.addressStart = sourceBlock.addressStart;
+   targetFlashBlock.block_size_bytes = sourceBlock.block_size_bytes;
+   if(!STK_get_flash_block(targetFlashBlock)){
+      //Failed to pull flash block from target MCU
+      return false;
+   }
+   /*=============================================>>>>>
+   = Compare received flash block with one from hex file =
+   ===============================================>>>>>*/
+   // Serial.println("BYTE # | TARGET | SD HEX");
+   for(uint16_t count = 0; count < sourceBlock.block_size_bytes; count++){
+      // Serial.printlnf("%#6u |  %#02.2X  |   %#02.2X", count, targetFlashBlock.dataBytes[count], sourceBlock.dataBytes[count]);
+      // Serial.flush();
+      if(targetFlashBlock.dataBytes[count] != sourceBlock.dataBytes[count]){
+         //Found elements of flash blocks that do not match
+         char myBuf[256];
+         snprintf(myBuf, 256, "Programmed image does not match hex image at base address %#0X, offset %u", sourceBlock.addressStart, count);
+         Serial.println(myBuf);
+
+         return false;
+      }
+   }//End for
+   return true;
+}
+
+/*=============================================>>>>>
+= Function to end the programming session so the target starts its application =
+===============================================>>>>>*/
+
+bool STK_leave_progmode(){
+   byte msg[STK_MAX_MSG_BYTES];
+   Serial1.write(msg, STK_build_leave_progmode_msg(msg));
+   return STK_wait_receive(STK_OK, 2, 100, "STK_LEAVE_PROGMODE");
+}
 /*= End of STK500 MESSAGE HELPER FUNCTIONS =*/
 /*=============================================<<<<<*/
 
@@ -215,14 +281,43 @@ bool STK_get_flash_block(flash_page_block_t &targetFlashBlock){
 = Function called by external code to initialize STK_500_Programmer resources =
 ===============================================>>>>>*/
 bool STK_Programmer::begin(){
-   //Initialize the SD card object
-   if (!sd.begin(chipSelectPin)) {
+   //A different card may have been put in
+   imageCache.invalidate();
+#if ENABLE_SPI_CLOCK_TUNING
+   //Initialize the SD card object, stepping the SPI clock up to SPI_SPEED_MHZ
+   //and keeping the fastest rate that gives CRC checked reads
+   if (!sd.begin(chipSelectPin, SPI_SPEED_MHZ*MHZ)) {
+#else
+   //Initialize the SD card object at a fixed SPI_SPEED_MHZ
+   if (!sd.begin(chipSelectPin, SD_SCK_MHZ(SPI_SPEED_MHZ))) {
+#endif
       //Initialization error
       SD_error_handler(__LINE__);
       //Done
       return false;
    }
-   return false;
+#if ENABLE_SPI_CLOCK_TUNING
+   Serial.print("SD SPI clock ");
+   Serial.print(sd.card()->spiClock()/1000, DEC);
+   Serial.println(" kHz");
+#endif
+#if ENABLE_SD_INIT_TIMING
+   //Where the card startup time went, in microseconds
+   const SdInitTiming &timing = sd.card()->initTiming();
+   Serial.print("SD init us: CMD0 ");
+   Serial.print(timing.cmd0Us, DEC);
+   Serial.print(" CMD8 ");
+   Serial.print(timing.cmd8Us, DEC);
+   Serial.print(" ACMD41 ");
+   Serial.print(timing.acmd41Us, DEC);
+   Serial.print(" (");
+   Serial.print(timing.acmd41Count, DEC);
+   Serial.print(" polls) OCR ");
+   Serial.print(timing.ocrUs, DEC);
+   Serial.print(" tune ");
+   Serial.println(timing.tuneUs, DEC);
+#endif
+   return true;
 }
 
 /*=============================================>>>>>
@@ -230,23 +325,13 @@ bool STK_Programmer::begin(){
 ===============================================>>>>>*/
 
 bool STK_Programmer::programTarget(const char* targFile){
-   //Now we will open the hex file on the SD card and find out what address
-   //to start programming at
-   hexFile.begin(targFile);  //Reset bytes consumed count to 0
-   //First reset the target MCU
-   resetTarget();
-   //Now ask target MCU if it is there 3 times before continuing
-   byte numSyncs = 0;
-   while(getSync()){
-      if((numSyncs++)>2){
-         break;
-      }
-   };
-   if(numSyncs < 3){
-      char myBuf[256];
-      snprintf(myBuf, 256, "sync failure");
-      Serial.println(myBuf);
-
+   //Now we will open the hex file on the SD card (or find it in the resident
+   //image cache) and find out what address to start programming at
+   if(!openImage(targFile)){
+      return false;
+   }
+   //First reset the target MCU and make sure Optiboot is answering
+   if(!resetAndSync()){
       return false;
    }
    //Loop through hex file records, assembling multiple records into single flash page blocks
@@ -254,7 +339,7 @@ bool STK_Programmer::programTarget(const char* targFile){
 
    unsigned int flashTimer = millis();
 
-   while(hexFile.moreBytesToConsume() ){
+   while(moreImagePages()){
       if((millis() - flashTimer) > STK_500_FLASH_PROCESS_TIMEOUT){
          char myBuf[256];
          snprintf(myBuf, 256, "Flash process timeout!");
@@ -263,30 +348,17 @@ bool STK_Programmer::programTarget(const char* targFile){
          return false;
       }
       //Assemble a bunch of records into a single flash block
-      sdFlashBlock.block_size_bytes = hexFile.load_hex_records_flash_data_block(sdFlashBlock);
-      //Compose a STK message that sets Optiboot target address to equivalent in hex record
-      STK_send_address_msg(sdFlashBlock.addressStart);
-      //Wait for appropriate response
-      if(!STK_wait_receive(STK_OK, 2, 100, "STK_LOAD_ADDRESS")){
-         //Didn't get appropriate response
-         char myBuf[256];
-         snprintf(myBuf, 256, "Failed to set address 0X%0X", sdFlashBlock.addressStart);
-         Serial.println(myBuf);
-
+      sdFlashBlock.block_size_bytes = loadImagePage(sdFlashBlock);
+      if(image_load_failed){
+         Serial.println("Hex file corrupt, aborting flash");
          return false;
       }
-      //Got appropriate response!
-
-      /*=============================================>>>>>
-      = Send the page data to the target MCU =
-      ===============================================>>>>>*/
-      STK_send_prog_page_msg(sdFlashBlock);
-      //Wait for appropriate response
-      if(!STK_wait_receive(STK_OK, 2, 1000, "STK_PROG_PAGE")){
-         char myBuf[256];
-         snprintf(myBuf, 256, "Failed to program page at address 0x%0x", sdFlashBlock.addressStart);
-         Serial.println(myBuf);
-
+      if(!sdFlashBlock.block_size_bytes){
+         //Trailing records with no data (e.g. end of file record)
+         continue;
+      }
+      //Send the page data to the target MCU
+      if(!STK_write_flash_page(sdFlashBlock)){
          return false;
       }
    }  //End while hexFile.getRecord()
@@ -299,14 +371,15 @@ bool STK_Programmer::programTarget(const char* targFile){
    /*=============================================>>>>>
    = Now read back the bytes from the target to verify it was programmed correctly =
    ===============================================>>>>>*/
-   hexFile.begin(targFile); //Resets bytes consumed to 0
-   flash_page_block_t targetFlashBlock;
+   if(!rewindImage(targFile)){ //Resets bytes consumed to 0
+      return false;
+   }
    flashTimer = millis();  //Reset timeout timer
 
    // myLog.info("Reading back progmem to verify success");
    Serial.flush();
 
-   while(hexFile.moreBytesToConsume()){
+   while(moreImagePages()){
       if((millis() - flashTimer) > STK_500_FLASH_PROCESS_TIMEOUT){
          char myBuf[256];
          snprintf(myBuf, 256, "Flash process timeout!");
@@ -315,50 +388,21 @@ bool STK_Programmer::programTarget(const char* targFile){
          return false;
       }
       //Assemble a bunch of records into a single flash block
-      sdFlashBlock.block_size_bytes = hexFile.load_hex_records_flash_data_block(sdFlashBlock);
+      sdFlashBlock.block_size_bytes = loadImagePage(sdFlashBlock);
       // myLog.info("Done loading sd flash block");
       Serial.flush();
-
-      /*=============================================>>>>>
-      = Request the page data from the target MCU =
-      ===============================================>>>>>*/
-      //Compose a STK message that sets Optiboot target address to equivalent in hex record
-      STK_send_address_msg(sdFlashBlock.addressStart);
-      //Wait for appropriate response
-      if(!STK_wait_receive(STK_OK, 2, 100, "STK_LOAD_ADDRESS")){
-         //Didn't get appropriate response
-         char myBuf[256];
-         snprintf(myBuf, 256, "Failed to set address 0X%0X", sdFlashBlock.addressStart);
-         Serial.println(myBuf);
-
+      if(image_load_failed){
+         Serial.println("Hex file corrupt, aborting verify");
          return false;
       }
-      //Got appropriate response!
+      if(!sdFlashBlock.block_size_bytes){
+         continue;
+      }
 
-      // myLog.info("Address successfully set");
-      //Set target flash block address and size equal to the one in the sd hex file
-      targetFlashBlock.addressStart = sdFlashBlock.addressStart;
-      targetFlashBlock.block_size_bytes = sdFlashBlock.block_size_bytes;
-      if(!STK_get_flash_block(targetFlashBlock)){
-         //Failed to pull flash block from target MCU
+      //Read the page back from the target MCU and compare
+      if(!STK_verify_flash_page(sdFlashBlock)){
          return false;
       }
-      /*=============================================>>>>>
-      = Compare received flash block with one from hex file =
-      ===============================================>>>>>*/
-      // Serial.println("BYTE # | TARGET | SD HEX");
-      for(uint16_t count = 0; count < sdFlashBlock.block_size_bytes; count++){
-         // Serial.printlnf("%#6u |  %#02.2X  |   %#02.2X", count, targetFlashBlock.dataBytes[count], sdFlashBlock.dataBytes[count]);
-         // Serial.flush();
-         if(targetFlashBlock.dataBytes[count] != sdFlashBlock.dataBytes[count]){
-            //Found elements of flash blocks that do not match
-            char myBuf[256];
-            snprintf(myBuf, 256, "Programmed image does not match hex image at base address %#0X, offset %u", sdFlashBlock.addressStart, count);
-            Serial.println(myBuf);
-
-            return false;
-         }
-      }//End for
    }
 
    // myLog.info("firmware image match success!");
@@ -367,9 +411,7 @@ bool STK_Programmer::programTarget(const char* targFile){
    /*=============================================>>>>>
    = End programming session gracefully =
    ===============================================>>>>>*/
-   Serial1.write(STK_LEAVE_PROGMODE);
-   Serial1.write(CRC_EOP);
-   if(!STK_wait_receive(STK_OK, 2, 100, "STK_LEAVE_PROGMODE")){
+   if(!STK_leave_progmode()){
       return false;
    }
 
@@ -381,6 +423,28 @@ bool STK_Programmer::programTarget(const char* targFile){
 
 }
 
+/*=============================================>>>>>
+= Function to reset the target and then ask it if it is there 3 times before continuing =
+===============================================>>>>>*/
+
+bool STK_Programmer::resetAndSync(){
+   resetTarget();
+   byte numSyncs = 0;
+   while(getSync()){
+      if((numSyncs++)>2){
+         break;
+      }
+   };
+   if(numSyncs < 3){
+      char myBuf[256];
+      snprintf(myBuf, 256, "sync failure");
+      Serial.println(myBuf);
+
+      return false;
+   }
+   return true;
+}
+
 /*=============================================>>>>>
 = Function to reset the attached target MCU =
 use MANUAL_DEDICATED_RESET_PIN define (above) to toggle between using a discrete
@@ -411,6 +475,489 @@ void STK_Programmer::resetTarget(){
 
 
 
+/*=============================================>>>>>
+= Serial upload functions =
+
+Programs the target from pages streamed over a serial port by a PC instead of
+from the SD card.  See serial_upload.h for the framing and flow control.
+===============================================>>>>>*/
+
+/*=============================================>>>>>
+= CRC-CCITT (poly 0x1021) of a single byte, as used by upload frames =
+===============================================>>>>>*/
+static uint16_t upload_crc16(uint16_t crc, byte data){
+   crc ^= (uint16_t)data << 8;
+   for(byte bit = 0; bit < 8; bit++){
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+   }
+   return crc;
+}
+
+/*=============================================>>>>>
+= Function to wait for a byte from the PC.  Returns -1 once the frame timeout
+(counted from timeStart) runs out =
+===============================================>>>>>*/
+static int upload_read_byte(Stream &pcPort, unsigned long timeStart){
+   while(!pcPort.available()){
+      if((millis() - timeStart) > UPLOAD_FRAME_TIMEOUT_MS){
+         return -1;
+      }
+   }
+   return pcPort.read();
+}
+
+/*=============================================>>>>>
+= Function to read one upload frame.
+Returns 1 for a good frame, 0 on timeout and -1 for a damaged frame =
+===============================================>>>>>*/
+static int read_upload_frame(Stream &pcPort, byte &frameType, byte* payload, byte &frameLen){
+   unsigned long timeStart = millis();
+   int inByte;
+   //Skip anything up to the start of frame byte
+   do{
+      inByte = upload_read_byte(pcPort, timeStart);
+      if(inByte < 0){
+         return 0;
+      }
+   }while(inByte != UPLOAD_SOF);
+
+   int typeByte = upload_read_byte(pcPort, timeStart);
+   int lenByte = upload_read_byte(pcPort, timeStart);
+   if(typeByte < 0 || lenByte < 0){
+      return 0;
+   }
+   if(lenByte > UPLOAD_MAX_PAYLOAD){
+      return -1;
+   }
+   frameType = typeByte;
+   frameLen = lenByte;
+   uint16_t crc = upload_crc16(0xFFFF, frameType);
+   crc = upload_crc16(crc, frameLen);
+   for(byte count = 0; count < frameLen; count++){
+      inByte = upload_read_byte(pcPort, timeStart);
+      if(inByte < 0){
+         return 0;
+      }
+      payload[count] = inByte;
+      crc = upload_crc16(crc, inByte);
+   }
+   int crcLow = upload_read_byte(pcPort, timeStart);
+   int crcHigh = upload_read_byte(pcPort, timeStart);
+   if(crcLow < 0 || crcHigh < 0){
+      return 0;
+   }
+   if(crc != (uint16_t)(crcLow | (crcHigh << 8))){
+      return -1;
+   }
+   return 1;
+}
+
+static void send_upload_reply(Stream &pcPort, byte replyCode){
+   pcPort.write(UPLOAD_SOF);
+   pcPort.write(replyCode);
+   pcPort.write((byte)~replyCode);
+}
+
+/*=============================================>>>>>
+= Function to append a flash page to an SD file as 16 byte Intel hex records,
+with the "\r\n" terminators HexFileClass expects =
+===============================================>>>>>*/
+static bool write_hex_page(SdFile &hexOut, flash_page_block_t &block){
+   const char hexDigits[] = "0123456789ABCDEF";
+   char line[MAX_CHARS_PER_HEX_RECORD];
+   uint16_t byteAddress = block.addressStart * 2;   //Records use byte addresses
+   for(uint16_t offset = 0; offset < block.block_size_bytes; offset += 16){
+      byte recordBytes[4 + 16];
+      byte count = block.block_size_bytes - offset < 16 ? block.block_size_bytes - offset : 16;
+      uint16_t recordAddress = byteAddress + offset;
+      recordBytes[0] = count;
+      recordBytes[1] = recordAddress >> 8;
+      recordBytes[2] = recordAddress & 0xFF;
+      recordBytes[3] = 0x00;     //Data record
+      memcpy(recordBytes + 4, block.dataBytes + offset, count);
+      byte sum = 0;
+      byte pos = 0;
+      line[pos++] = ':';
+      for(byte index = 0; index < 4 + count; index++){
+         sum += recordBytes[index];
+         line[pos++] = hexDigits[recordBytes[index] >> 4];
+         line[pos++] = hexDigits[recordBytes[index] & 0x0F];
+      }
+      sum = -sum;
+      line[pos++] = hexDigits[sum >> 4];
+      line[pos++] = hexDigits[sum & 0x0F];
+      line[pos++] = '\r';
+      line[pos++] = '\n';
+      if(hexOut.write(line, pos) != pos){
+         return false;
+      }
+   }
+   return true;
+}
+
+/*=============================================>>>>>
+= Function called by external code to program the target from a PC over
+pcPort (usually Serial).  Returns once the upload is finished or abandoned =
+===============================================>>>>>*/
+bool STK_Programmer::programFromSerial(Stream &pcPort){
+   byte payload[UPLOAD_MAX_PAYLOAD];
+   byte frameType = 0;
+   byte frameLen = 0;
+   bool sessionStarted = false;
+   SdFile saveFile;
+   bool saving = false;
+   flash_page_block_t pageBlock;
+   uint32_t imageEnd = 0;        //Byte address just past the announced image
+   uint32_t nextAddress = 0;     //Byte address the next page has to start at
+
+   while(1){
+      int frameResult = read_upload_frame(pcPort, frameType, payload, frameLen);
+      if(frameResult == 0){
+         Serial.println("Upload timeout!");
+         break;
+      }
+      if(frameResult < 0){
+         send_upload_reply(pcPort, UPLOAD_REPLY_RESEND);
+         continue;
+      }
+
+      switch(frameType){
+
+         case UPLOAD_FRAME_BEGIN:
+         {
+            if(sessionStarted || frameLen < 7 || frameLen > 7 + UPLOAD_MAX_FILE_NAME){
+               send_upload_reply(pcPort, UPLOAD_REPLY_BAD_FRAME);
+               break;
+            }
+            uint32_t imageLength = payload[0] | ((uint32_t)payload[1] << 8) |
+                                   ((uint32_t)payload[2] << 16) | ((uint32_t)payload[3] << 24);
+            nextAddress = payload[4] | ((uint16_t)payload[5] << 8);
+            if(imageLength == 0 || imageLength > 0x10000UL - nextAddress){
+               send_upload_reply(pcPort, UPLOAD_REPLY_BAD_FRAME);
+               break;
+            }
+            imageEnd = nextAddress + imageLength;
+            if(payload[6] & UPLOAD_FLAG_SAVE_TO_SD){
+               char fileName[UPLOAD_MAX_FILE_NAME + 1];
+               memcpy(fileName, payload + 7, frameLen - 7);
+               fileName[frameLen - 7] = 0;
+               //A rewritten file may keep its old size and timestamp, so don't trust the cache
+               imageCache.invalidate();
+               if(!saveFile.open(fileName, O_WRITE | O_CREAT | O_TRUNC)){
+                  SD_error_handler(__LINE__);
+                  send_upload_reply(pcPort, UPLOAD_REPLY_SD_ERROR);
+                  return false;
+               }
+               saving = true;
+            }
+            if(!resetAndSync()){
+               send_upload_reply(pcPort, UPLOAD_REPLY_TARGET_ERROR);
+               break;
+            }
+            sessionStarted = true;
+            send_upload_reply(pcPort, UPLOAD_REPLY_ACK);
+            continue;
+         }
+
+         case UPLOAD_FRAME_PAGE:
+         {
+            if(!sessionStarted || frameLen < 3){
+               send_upload_reply(pcPort, UPLOAD_REPLY_BAD_FRAME);
+               break;
+            }
+            pageBlock.addressStart = payload[0] | ((uint16_t)payload[1] << 8);
+            pageBlock.block_size_bytes = frameLen - 2;
+            //Pages have to arrive in order and stay inside the announced image
+            if((uint32_t)pageBlock.addressStart * 2 != nextAddress ||
+               pageBlock.block_size_bytes > imageEnd - nextAddress){
+               send_upload_reply(pcPort, UPLOAD_REPLY_BAD_FRAME);
+               break;
+            }
+            memcpy(pageBlock.dataBytes, payload + 2, pageBlock.block_size_bytes);
+            //Only ack once the page is programmed, a UART host port can't
+            //buffer the next frame while the target is busy
+            if(!STK_write_flash_page(pageBlock) || !STK_verify_flash_page(pageBlock)){
+               send_upload_reply(pcPort, UPLOAD_REPLY_TARGET_ERROR);
+               break;
+            }
+            if(saving && !write_hex_page(saveFile, pageBlock)){
+               SD_error_handler(__LINE__);
+               send_upload_reply(pcPort, UPLOAD_REPLY_SD_ERROR);
+               break;
+            }
+            nextAddress += pageBlock.block_size_bytes;
+            send_upload_reply(pcPort, UPLOAD_REPLY_ACK);
+            continue;
+         }
+
+         case UPLOAD_FRAME_END:
+         {
+            //A short image is abandoned, not saved as if it were complete
+            if(!sessionStarted || nextAddress != imageEnd){
+               send_upload_reply(pcPort, UPLOAD_REPLY_BAD_FRAME);
+               break;
+            }
+            if(saving){
+               saving = false;
+               if(saveFile.write(":00000001FF\r\n", 13) != 13 || !saveFile.close()){
+                  SD_error_handler(__LINE__);
+                  send_upload_reply(pcPort, UPLOAD_REPLY_SD_ERROR);
+                  break;
+               }
+            }
+            sessionStarted = false;
+            if(!STK_leave_progmode()){
+               send_upload_reply(pcPort, UPLOAD_REPLY_TARGET_ERROR);
+               break;
+            }
+            send_upload_reply(pcPort, UPLOAD_REPLY_DONE);
+            return true;
+         }
+
+         case UPLOAD_FRAME_ABORT:
+         {
+            send_upload_reply(pcPort, UPLOAD_REPLY_ACK);
+            break;
+         }
+
+         default:
+         {
+            send_upload_reply(pcPort, UPLOAD_REPLY_BAD_FRAME);
+         }
+      }//End switch
+      //Frames that keep the session going continue above, anything else ends it
+      break;
+   }
+
+   //Upload abandoned - don't leave the target in programming mode or a half
+   //written image on the card
+   if(sessionStarted){
+      STK_leave_progmode();
+   }
+   if(saving){
+      saveFile.remove();
+   }
+   return false;
+}
+
+/*=============================================>>>>>
+= Image page source functions =
+
+programTarget pulls pages through these rather than straight from hexFile so
+that a valid resident image cache can stand in for the SD card.  A cache miss
+decodes from the card as usual and stores each page on the way through, and
+once the write pass has stored every page the verify pass reads them back from
+the cache instead of decoding the file a second time.
+===============================================>>>>>*/
+
+bool STK_Programmer::openImage(const char* targFile){
+   image_from_cache = false;
+   image_load_failed = false;
+   cache_page_index = 0;
+   if(imageCache.enabled()){
+      //Only the directory entry is read to decide if the cached image is still good
+      image_cache_key_t key;
+      if(!hexFile.stat(targFile, key)){
+         return false;
+      }
+      if(imageCache.lookup(key)){
+         char myBuf[256];
+         snprintf(myBuf, 256, "Using resident image (%u pages, hash 0x%08lX)",
+                  imageCache.pageCount(), (unsigned long)imageCache.contentHash());
+         Serial.println(myBuf);
+         image_from_cache = true;
+         return true;
+      }
+      imageCache.beginStore(key);
+   }
+   if(!hexFile.begin(targFile)){
+      return false;
+   }
+   #if STK_500_PREFLIGHT_IMAGE_CHECK
+   //Make sure the whole image is sound before the target gets touched
+   if(!hexFile.preflight_check()){
+      imageCache.invalidate();
+      return false;
+   }
+   #endif
+   return true;
+}
+
+bool STK_Programmer::rewindImage(const char* targFile){
+   cache_page_index = 0;
+   image_load_failed = false;
+   //The first pass has been through every page, so a stored image is complete
+   if(imageCache.isStoring()){
+      image_from_cache = imageCache.endStore();
+   }
+   if(image_from_cache){
+      return true;
+   }
+   return hexFile.begin(targFile);
+}
+
+bool STK_Programmer::moreImagePages(){
+   if(image_from_cache){
+      return cache_page_index < imageCache.pageCount();
+   }
+   return hexFile.moreBytesToConsume();
+}
+
+unsigned int STK_Programmer::loadImagePage(flash_page_block_t &targBlock){
+   if(image_from_cache){
+      if(!imageCache.readPage(cache_page_index++, targBlock)){
+         Serial.println("Image cache read failed");
+         imageCache.invalidate();
+         image_load_failed = true;
+         return 0;
+      }
+      return targBlock.block_size_bytes;
+   }
+   targBlock.block_size_bytes = hexFile.load_hex_records_flash_data_block(targBlock);
+   if(hexFile.failed()){
+      imageCache.invalidate();
+      image_load_failed = true;
+      return 0;
+   }
+   if(targBlock.block_size_bytes){
+      imageCache.storePage(targBlock);
+   }
+   return targBlock.block_size_bytes;
+}
+
+/*=============================================>>>>>
+= Function to time the image loading pass on its own, without a target attached.
+Used to compare image formats (e.g. firmware.hex vs firmware.hxz) =
+===============================================>>>>>*/
+bool STK_Programmer::benchmarkImage(const char* targFile, bool verifyChecksums){
+   unsigned long timeStart = micros();
+   if(!hexFile.begin(targFile)){
+      return false;
+   }
+   hexFile.setChecksumValidation(verifyChecksums);
+   flash_page_block_t sdFlashBlock;
+   unsigned int numPages = 0;
+   unsigned long imageBytes = 0;
+   while(hexFile.moreBytesToConsume()){
+      sdFlashBlock.block_size_bytes = hexFile.load_hex_records_flash_data_block(sdFlashBlock);
+      if(hexFile.failed()){
+         hexFile.setChecksumValidation(true);
+         return false;
+      }
+      imageBytes += sdFlashBlock.block_size_bytes;
+      numPages++;
+   }
+   unsigned long elapsed = micros() - timeStart;
+   hexFile.setChecksumValidation(true);
+
+   char myBuf[256];
+   snprintf(myBuf, 256, "%s (checksums %s): %u pages, %lu image bytes, %lu SD bytes read, %lu us",
+            targFile, verifyChecksums ? "on" : "off", numPages, imageBytes, hexFile.sdBytesRead(), elapsed);
+   Serial.println(myBuf);
+
+   //Time the stand-alone pre-flight scan as well
+   timeStart = micros();
+   if(!hexFile.begin(targFile) || !hexFile.preflight_check()){
+      return false;
+   }
+   elapsed = micros() - timeStart;
+   snprintf(myBuf, 256, "%s pre-flight scan: %lu SD bytes read, %lu us",
+            targFile, hexFile.sdBytesRead(), elapsed);
+   Serial.println(myBuf);
+   return true;
+}
+
+/*=============================================>>>>>
+= Function to time raw SD block transfers through the SPI driver.  Data goes to a
+contiguous scratch file so nothing else on the card is touched, and the rates are
+printed next to the SPI clock so a slower driver path shows up as a lower percentage =
+===============================================>>>>>*/
+bool STK_Programmer::benchmarkSpi(){
+#if defined(ARDUINO) || defined(PLATFORM_ID)
+   static uint8_t blockBuf[512];
+   FatFile benchFile;
+   RawStreamWriter<SdSpiCard> benchWriter;
+   uint32_t firstBlock, lastBlock;
+   sd.remove(SPI_BENCH_FILE);
+   if(!benchFile.createContiguous(SPI_BENCH_FILE, SPI_BENCH_BLOCKS*512UL) ||
+      !benchFile.contiguousRange(&firstBlock, &lastBlock)){
+      SD_error_handler(__LINE__);
+      benchFile.close();
+      return false;
+   }
+   SdSpiCard* card = sd.card();
+   memset(blockBuf, 0X55, sizeof(blockBuf));
+
+   //Multi-block write through RawStreamWriter, block payloads go through the
+   //driver's send(buf, n)
+   unsigned long timeStart = micros();
+   if(!benchWriter.begin(card, &benchFile)){
+      SD_error_handler(__LINE__);
+      benchFile.close();
+      return false;
+   }
+   for(uint16_t i = 0; i < SPI_BENCH_BLOCKS; i++){
+      if(!benchWriter.writeBlock(blockBuf)){
+         SD_error_handler(__LINE__);
+         benchWriter.close(false);
+         benchFile.close();
+         return false;
+      }
+   }
+   if(!benchWriter.close(false) || !benchFile.close()){
+      SD_error_handler(__LINE__);
+      return false;
+   }
+   unsigned long writeUs = micros() - timeStart;
+
+   //Multi-block read, block payloads go through the driver's receive(buf, n)
+   timeStart = micros();
+   if(!card->readStart(firstBlock)){
+      SD_error_handler(__LINE__);
+      return false;
+   }
+   for(uint16_t i = 0; i < SPI_BENCH_BLOCKS; i++){
+      if(!card->readData(blockBuf)){
+         SD_error_handler(__LINE__);
+         return false;
+      }
+   }
+   if(!card->readStop()){
+      SD_error_handler(__LINE__);
+      return false;
+   }
+   unsigned long readUs = micros() - timeStart;
+
+   //Rates in KB/s (1000 bytes), the bus moves one bit per SCK
+   uint32_t benchBytes = SPI_BENCH_BLOCKS*512UL;
+   uint32_t writeKBs = 1000.0*benchBytes/writeUs;
+   uint32_t readKBs = 1000.0*benchBytes/readUs;
+#if ENABLE_SPI_CLOCK_TUNING
+   uint32_t busKBs = card->spiClock()/8000;
+#else
+   uint32_t busKBs = 0;
+#endif
+   char myBuf[128];
+   snprintf(myBuf, 128, "SPI read %lu.%03lu MB/s, write %lu.%03lu MB/s",
+            (unsigned long)readKBs/1000, (unsigned long)readKBs%1000,
+            (unsigned long)writeKBs/1000, (unsigned long)writeKBs%1000);
+   Serial.println(myBuf);
+   if(busKBs){
+      snprintf(myBuf, 128, "SPI clock %lu.%03lu MB/s: read %lu%%, write %lu%%",
+               (unsigned long)busKBs/1000, (unsigned long)busKBs%1000,
+               (unsigned long)(100*readKBs/busKBs), (unsigned long)(100*writeKBs/busKBs));
+   }
+   else{
+      snprintf(myBuf, 128, "SPI clock unknown (not tuned)");
+   }
+   Serial.println(myBuf);
+   return true;
+#else
+   //No SD card or SPI bus on a PC
+   return false;
+#endif
+}
+
 /*= End of STK500 Programmer Class Functions =*/
 /*=============================================<<<<<*/
 
@@ -419,35 +966,82 @@ void STK_Programmer::resetTarget(){
 = HexFileRecord class functions =
 ===============================================>>>>>*/
 
+/*=============================================>>>>>
+= Function to decode a pair of ascii hex digits into a byte.  Much quicker than
+sscanf, which matters because every character of the image goes through here.
+Returns -1 if either character is not a hex digit =
+===============================================>>>>>*/
+
+static int decode_hex_byte(const char* digits){
+   int value = 0;
+   for(byte count = 0; count < 2; count++){
+      char c = digits[count];
+      value <<= 4;
+      if(c >= '0' && c <= '9'){
+         value |= c - '0';
+      }
+      else if(c >= 'A' && c <= 'F'){
+         value |= c - 'A' + 10;
+      }
+      else if(c >= 'a' && c <= 'f'){
+         value |= c - 'a' + 10;
+      }
+      else{
+         return -1;
+      }
+   }
+   return value;
+}
+
 /*=============================================>>>>>
 = Function to decode an ascii hex file string into its constituent elements =
+
+Every byte of the record (count, address, type, data and checksum) is summed as
+it is decoded, so checking the checksum costs a single compare.
 ===============================================>>>>>*/
 
-bool HexFileRecord::decode(){
+bool HexFileRecord::decode(bool verifyChecksum){
    //myLog.info("Decoding hex record: ");
    // printEscapedStr(ascii_line);
    //Serial.println();
    //Check for leading colon
    if((char)ascii_line[0] == ':'){
-      //Decode byte count
-      if(1 == sscanf(ascii_line + 1, "%2x", &byteCount)) {
-         //myLog.trace("byteCount = %#02X", byteCount);
-         //Decode address
-         if(1 == sscanf(ascii_line + 3, "%4x", &address)) {
-            //myLog.trace("address = %#02X", address);
-            //Decode record type
-            if(1 == sscanf(ascii_line + 7, "%2x", &recordType)) {
-               //myLog.trace("recordType = %#02X", recordType);
-               //Calculate location of data
-               data = ascii_line + 9;
-               //myLog.trace("data = %.*s", byteCount*2, data);
-               //Decode checksum
-               if(1 == sscanf(data + (byteCount*2) , "%2x", &checkSum)) {
-                  //TODO: see if checksum makes sense
-                  //myLog.trace("checkSum = %#02X", checkSum);
-                  return true;
-               }
+      //Decode byte count, address and record type
+      int countByte = decode_hex_byte(ascii_line + 1);
+      int addrHigh = decode_hex_byte(ascii_line + 3);
+      int addrLow = decode_hex_byte(ascii_line + 5);
+      int typeByte = decode_hex_byte(ascii_line + 7);
+      //Records longer than the SD read buffer can't be decoded
+      if(countByte >= 0 && countByte <= MAX_DATA_BYTES_PER_HEX_RECORD &&
+         addrHigh >= 0 && addrLow >= 0 && typeByte >= 0){
+         byteCount = countByte;
+         address = (addrHigh << 8) | addrLow;
+         recordType = typeByte;
+         byte sum = byteCount + addrHigh + addrLow + recordType;
+         //Calculate location of data
+         data = ascii_line + 9;
+         //Decode data bytes
+         byte count = 0;
+         for(; count < byteCount; count++){
+            int dataByte = decode_hex_byte(data + (count * 2));
+            if(dataByte < 0){
+               break;
+            }
+            dataBytes[count] = dataByte;
+            sum += dataByte;
+         }
+         //Decode checksum
+         int checkByte = decode_hex_byte(data + (byteCount * 2));
+         if(count == byteCount && checkByte >= 0){
+            checkSum = checkByte;
+            //All bytes of a record including its checksum add up to zero
+            if(!verifyChecksum || (byte)(sum + checkSum) == 0){
+               return true;
             }
+            Serial.print("Hex record checksum mismatch: ");
+            Serial.write((const uint8_t*)ascii_line, 11 + (byteCount * 2));
+            Serial.println();
+            return false;
          }
       }
    }
@@ -472,6 +1066,9 @@ bool HexFileRecord::decode(){
 bool HexFileClass::begin(const char* targFilePath){
    //Reset bytes consumed
    hexfile_chars_consumed = 0;
+   sd_bytes_read = 0;
+   hexfile_error = false;
+   format = HEXFILE_FORMAT_INTEL_HEX;
    //Check if sd file is allready open
    if(sdHexFile.isOpen()){
       //Close the file
@@ -492,6 +1089,11 @@ bool HexFileClass::begin(const char* targFilePath){
    }
    //Save files size so we don't have to query it from SDFat (not sure if this results in SD card read operations to determine size, so err on side of quickity)
    hexfile_total_bytes = sdHexFile.fileSize();
+   //Intel hex records always start with ':', so anything else may be a compressed image
+   if(sdHexFile.peek() == HXZ_MAGIC_0){
+      return hxz_begin();
+   }
+   return true;
 }
 
 /*=============================================>>>>>
@@ -509,21 +1111,26 @@ bool HexFileClass::consume_hex_record(HexFileRecord &targRecord){
    //Set sd file access pointer to end of consumed bytes
    if(!sdHexFile.seekSet(hexfile_chars_consumed)){
       SD_error_handler(__LINE__);
+      hexfile_error = true;
       return false;
    }
    int readResult = sdHexFile.read(sdBuf, bytesToRead);
    targRecord.ascii_line = sdBuf;
    if(readResult < 0) {
       SD_error_handler(__LINE__);
+      hexfile_error = true;
       return false;
    }
+   sd_bytes_read += readResult;
    if(readResult < 11){ //No valid hex record can be shorter than 11 characters
       Serial.print("Incomplete hex record @ byte ");
       Serial.println(hexfile_chars_consumed, DEC);
+      hexfile_error = true;
       return false;
    }
-   if(!targRecord.decode()){
+   if(!targRecord.decode(verify_record_checksums)){
       //Seppuku
+      hexfile_error = true;
       return false;
    }
    //Record length is always 11 + num data bytes
@@ -542,6 +1149,9 @@ returns the number of bytes loaded  into the flash data block
 ===============================================>>>>>*/
 unsigned int HexFileClass::load_hex_records_flash_data_block(flash_page_block_t &targBlock){
 
+   if(format == HEXFILE_FORMAT_HXZ){
+      return hxz_load_flash_data_block(targBlock);
+   }
    //Load a hexFile record using some TODO: SD card load hexFile record function
    HexFileRecord targRecord;
    uint16_t bytesEncoded = 0;
@@ -556,17 +1166,9 @@ unsigned int HexFileClass::load_hex_records_flash_data_block(flash_page_block_t
          targBlock.addressStart = targRecord.address / 2;  //Remember to convert to word-oriented address!
          //myLog.info("Block addres = %#02X", targBlock.addressStart);
       }
-      //Encode data bytes of flash record
+      //Copy data bytes of flash record (already decoded and checked by HexFileRecord::decode)
       while(bytesProcessed < targRecord.byteCount){
-         int result = sscanf(targRecord.data + (bytesProcessed * 2), "%2x", &targBlock.dataBytes[bytesEncoded]);
-         //Check that decoding worked
-         if(result != 1){
-            char myBuf[256];
-            snprintf(myBuf, 256, "Invalid record data digits in record: %2s --> hex file corrupt!",targRecord.data + bytesProcessed);
-            Serial.println(myBuf);
-
-            return 0;
-         }
+         targBlock.dataBytes[bytesEncoded] = targRecord.dataBytes[bytesProcessed];
          bytesProcessed ++;
          bytesEncoded ++;
          //Check that we haven't filled the block
@@ -586,5 +1188,405 @@ unsigned int HexFileClass::load_hex_records_flash_data_block(flash_page_block_t
 }
 
 
+/*=============================================>>>>>
+= Compressed (.hxz) image functions =
+
+See hxz.h for the file layout.  The image is decompressed a byte at a time
+straight into the flash page block, so the only RAM needed is the 256 byte
+LZSS window plus the shared SD read buffer.
+===============================================>>>>>*/
+
+/*=============================================>>>>>
+= Function to check the .hxz header and reset the decoder =
+===============================================>>>>>*/
+bool HexFileClass::hxz_begin(){
+   byte header[HXZ_HEADER_SIZE];
+   if(sdHexFile.read(header, HXZ_HEADER_SIZE) != HXZ_HEADER_SIZE){
+      SD_error_handler(__LINE__);
+      return false;
+   }
+   sd_bytes_read += HXZ_HEADER_SIZE;
+   if(header[0] != HXZ_MAGIC_0 || header[1] != HXZ_MAGIC_1 ||
+      header[2] != HXZ_MAGIC_2 || header[3] != HXZ_MAGIC_3){
+      Serial.println("Unknown image file format");
+      return false;
+   }
+   format = HEXFILE_FORMAT_HXZ;
+   hxz_base_address = header[4] | ((uint16_t)header[5] << 8);
+   hxz_image_bytes = header[6] | ((uint32_t)header[7] << 8) |
+                     ((uint32_t)header[8] << 16) | ((uint32_t)header[9] << 24);
+   hxz_image_sum = header[10] | ((uint16_t)header[11] << 8);
+   hxz_bytes_out = 0;
+   memset(hxz_window, 0xFF, sizeof(hxz_window));
+   hxz_window_pos = 0;
+   hxz_flags = 0;
+   hxz_flag_bits = 0;
+   hxz_match_dist = 0;
+   hxz_match_left = 0;
+   hxz_in_pos = 0;
+   hxz_in_len = 0;
+   return true;
+}
+
+/*=============================================>>>>>
+= Function to pull the next compressed byte off the SD card, refilling the
+shared SD buffer as needed.  Returns -1 at end of file or on error =
+===============================================>>>>>*/
+int HexFileClass::hxz_read_byte(){
+   if(hxz_in_pos >= hxz_in_len){
+      int readResult = sdHexFile.read(sdBuf, sizeof(sdBuf));
+      if(readResult <= 0){
+         if(readResult < 0){
+            SD_error_handler(__LINE__);
+         }
+         return -1;
+      }
+      sd_bytes_read += readResult;
+      hxz_in_len = readResult;
+      hxz_in_pos = 0;
+   }
+   return (byte)sdBuf[hxz_in_pos++];
+}
+
+/*=============================================>>>>>
+= Function to produce the next decompressed image byte.  Returns -1 if the
+compressed stream ends early or is corrupt =
+===============================================>>>>>*/
+int HexFileClass::hxz_next_byte(){
+   if(!hxz_match_left){
+      //Need a new token - grab a new flag byte if the last one is used up
+      if(!hxz_flag_bits){
+         int flags = hxz_read_byte();
+         if(flags < 0){
+            return -1;
+         }
+         hxz_flags = flags;
+         hxz_flag_bits = 8;
+      }
+      bool literal = hxz_flags & 1;
+      hxz_flags >>= 1;
+      hxz_flag_bits--;
+      if(literal){
+         int inByte = hxz_read_byte();
+         if(inByte < 0){
+            return -1;
+         }
+         hxz_window[hxz_window_pos++] = inByte;
+         return inByte;
+      }
+      int dist = hxz_read_byte();
+      int len = hxz_read_byte();
+      if(dist < 0 || len < 0){
+         return -1;
+      }
+      hxz_match_dist = dist + 1;
+      hxz_match_left = len + HXZ_MIN_MATCH;
+   }
+   //Copy one byte of the current match.  Byte math keeps us inside the window.
+   byte outByte = hxz_window[(byte)(hxz_window_pos - hxz_match_dist)];
+   hxz_window[hxz_window_pos++] = outByte;
+   hxz_match_left--;
+   return outByte;
+}
+
+/*=============================================>>>>>
+= Function to decompress the next flash page worth of image into targBlock
+
+returns the number of bytes loaded into the flash data block
+===============================================>>>>>*/
+unsigned int HexFileClass::hxz_load_flash_data_block(flash_page_block_t &targBlock){
+   //Remember to convert to word-oriented address!
+   targBlock.addressStart = (hxz_base_address + hxz_bytes_out) / 2;
+   uint16_t bytesEncoded = 0;
+   while(bytesEncoded < sizeof(targBlock.dataBytes) && hxz_bytes_out < hxz_image_bytes){
+      int outByte = hxz_next_byte();
+      if(outByte < 0){
+         Serial.println("Compressed image truncated --> hex file corrupt!");
+         //Stop the caller from asking for more
+         hxz_image_bytes = hxz_bytes_out;
+         hexfile_error = true;
+         return 0;
+      }
+      targBlock.dataBytes[bytesEncoded++] = outByte;
+      hxz_bytes_out++;
+   }
+   return bytesEncoded;
+}
+
+/*=============================================>>>>>
+= Function to read the cache key fields of an image file from its directory
+entry, without reading any of the file contents =
+===============================================>>>>>*/
+bool HexFileClass::stat(const char* targFilePath, image_cache_key_t &key){
+   SdFile statFile;
+   dir_t dirEntry;
+   if(!statFile.open(targFilePath, O_READ)){
+      SD_error_handler(__LINE__);
+      return false;
+   }
+   if(!statFile.dirEntry(&dirEntry)){
+      SD_error_handler(__LINE__);
+      statFile.close();
+      return false;
+   }
+   statFile.close();
+   key.pathHash = ImageCache::hash(targFilePath, strlen(targFilePath));
+   key.fileSize = dirEntry.fileSize;
+   key.modifyDate = dirEntry.lastWriteDate;
+   key.modifyTime = dirEntry.lastWriteTime;
+   key.contentHash = 0;
+   return true;
+}
+
+/*=============================================>>>>>
+= Pre-flight image check =
+
+One streaming pass over the whole file, checking every hex record checksum (or
+the decompressed sum of a .hxz image) so that a corrupt card image is caught
+before the target is reset and erased.  The file is read front to back with
+no seeking, so this runs at SD read speed.
+===============================================>>>>>*/
+bool HexFileClass::preflight_check(){
+   bool result;
+   if(format == HEXFILE_FORMAT_HXZ){
+      result = preflight_check_hxz();
+   }
+   else{
+      result = preflight_check_hex();
+   }
+   if(!result){
+      hexfile_error = true;
+      return false;
+   }
+   return rewind();
+}
+
+/*=============================================>>>>>
+= Function to seek back to the start of the image and reset the decoder so the
+image can be loaded again without re-opening it =
+===============================================>>>>>*/
+bool HexFileClass::rewind(){
+   hexfile_chars_consumed = 0;
+   if(!sdHexFile.seekSet(0)){
+      SD_error_handler(__LINE__);
+      return false;
+   }
+   if(format == HEXFILE_FORMAT_HXZ){
+      return hxz_begin();
+   }
+   return true;
+}
+
+bool HexFileClass::preflight_check_hex(){
+   if(!sdHexFile.seekSet(0)){
+      SD_error_handler(__LINE__);
+      return false;
+   }
+   unsigned int lineNum = 1;
+   uint16_t lineChars = 0;    //Characters seen in the current record, including ':'
+   byte sum = 0;
+   int highNibble = -1;       //First digit of a byte still waiting for its partner
+   byte byteCount = 0;
+   bool sawCR = false;
+   bool sawEOFRecord = false;
+   bool badRecord = false;
+   while(!badRecord){
+      int readResult = sdHexFile.read(sdBuf, sizeof(sdBuf));
+      if(readResult < 0){
+         SD_error_handler(__LINE__);
+         return false;
+      }
+      if(readResult == 0){
+         //A last record without line terminators is still consumable
+         if(lineChars && (highNibble >= 0 || lineChars != 11 + (byteCount * 2) || sum != 0)){
+            badRecord = true;
+         }
+         break;
+      }
+      sd_bytes_read += readResult;
+      for(int pos = 0; pos < readResult && !badRecord; pos++){
+         char c = sdBuf[pos];
+         if(c == '\r' && lineChars && !sawCR){
+            sawCR = true;
+         }
+         else if(c == '\n' && sawCR){
+            //Records are consumed assuming an exact length and "\r\n" terminators
+            if(highNibble >= 0 || lineChars != 11 + (byteCount * 2) || sum != 0){
+               badRecord = true;
+               break;
+            }
+            if(sawEOFRecord){
+               return true;
+            }
+            lineNum++;
+            lineChars = 0;
+            sum = 0;
+            sawCR = false;
+         }
+         else if(!lineChars){
+            if(c != ':'){
+               badRecord = true;
+               break;
+            }
+            lineChars = 1;
+         }
+         else{
+            if(sawCR){
+               badRecord = true;
+               break;
+            }
+            int nibble;
+            if(c >= '0' && c <= '9'){
+               nibble = c - '0';
+            }
+            else if(c >= 'A' && c <= 'F'){
+               nibble = c - 'A' + 10;
+            }
+            else if(c >= 'a' && c <= 'f'){
+               nibble = c - 'a' + 10;
+            }
+            else{
+               badRecord = true;
+               break;
+            }
+            lineChars++;
+            if(highNibble < 0){
+               highNibble = nibble;
+               continue;
+            }
+            byte value = (highNibble << 4) | nibble;
+            highNibble = -1;
+            sum += value;
+            if(lineChars == 3){
+               byteCount = value;
+               //Records longer than the SD read buffer can't be consumed
+               if(byteCount > MAX_DATA_BYTES_PER_HEX_RECORD){
+                  badRecord = true;
+                  break;
+               }
+            }
+            else if(lineChars == 9 && value == 0x01){
+               sawEOFRecord = true;
+            }
+         }
+      }
+   }
+   if(badRecord){
+      char myBuf[256];
+      snprintf(myBuf, 256, "Pre-flight check failed: corrupt hex record on line %u", lineNum);
+      Serial.println(myBuf);
+      return false;
+   }
+   return true;
+}
+
+bool HexFileClass::preflight_check_hxz(){
+   uint16_t sum = 0;
+   while(hxz_bytes_out < hxz_image_bytes){
+      int outByte = hxz_next_byte();
+      if(outByte < 0){
+         Serial.println("Pre-flight check failed: compressed image truncated");
+         return false;
+      }
+      sum += outByte;
+      hxz_bytes_out++;
+   }
+   if(sum != hxz_image_sum){
+      Serial.println("Pre-flight check failed: compressed image sum mismatch");
+      return false;
+   }
+   return true;
+}
+
 /*= End of HexFileClass class functions =*/
 /*=============================================<<<<<*/
+
+
+
+/*=============================================>>>>>
+= ImageCache class functions =
+===============================================>>>>>*/
+
+/*=============================================>>>>>
+= 32-bit FNV-1a hash.  Pass the previous result as seed to hash in pieces =
+===============================================>>>>>*/
+uint32_t ImageCache::hash(const void* data, size_t len, uint32_t seed){
+   const byte* bytes = (const byte*)data;
+   uint32_t result = seed;
+   while(len--){
+      result ^= *bytes++;
+      result *= 16777619UL;
+   }
+   return result;
+}
+
+static uint32_t hash_flash_page(const flash_page_block_t &block, uint32_t seed){
+   seed = ImageCache::hash(&block.addressStart, sizeof(block.addressStart), seed);
+   seed = ImageCache::hash(&block.block_size_bytes, sizeof(block.block_size_bytes), seed);
+   return ImageCache::hash(block.dataBytes, block.block_size_bytes, seed);
+}
+
+bool ImageCache::lookup(const image_cache_key_t &key){
+   if(!storage || !valid){
+      return false;
+   }
+   if(key.pathHash != cacheKey.pathHash || key.fileSize != cacheKey.fileSize ||
+      key.modifyDate != cacheKey.modifyDate || key.modifyTime != cacheKey.modifyTime){
+      //File on the card has changed (or it's a different file)
+      invalidate();
+      return false;
+   }
+   //Make sure the resident copy hasn't been disturbed since it was stored
+   flash_page_block_t block;
+   uint32_t checkHash = hash(NULL, 0);
+   for(uint16_t index = 0; index < numPages; index++){
+      if(!storage->readPage(index, block)){
+         invalidate();
+         return false;
+      }
+      checkHash = hash_flash_page(block, checkHash);
+   }
+   if(checkHash != cacheKey.contentHash){
+      Serial.println("Resident image corrupt, reloading from SD");
+      invalidate();
+      return false;
+   }
+   return true;
+}
+
+void ImageCache::beginStore(const image_cache_key_t &key){
+   if(!storage){
+      return;
+   }
+   cacheKey = key;
+   valid = false;
+   storing = true;
+   numPages = 0;
+   storeHash = hash(NULL, 0);
+}
+
+void ImageCache::storePage(const flash_page_block_t &block){
+   if(!storing){
+      return;
+   }
+   if(numPages >= storage->capacityPages() || !storage->writePage(numPages, block)){
+      //Image too big for the cache (or storage failed) - carry on without it
+      invalidate();
+      return;
+   }
+   storeHash = hash_flash_page(block, storeHash);
+   numPages++;
+}
+
+bool ImageCache::endStore(){
+   if(!storing){
+      return false;
+   }
+   storing = false;
+   cacheKey.contentHash = storeHash;
+   valid = true;
+   return true;
+}
+
+/*= End of ImageCache class functions =*/
+/*=============================================<<<<<*/
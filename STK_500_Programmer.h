@@ -5,6 +5,7 @@
 = Dependencies =
 ===============================================>>>>>*/
 #include "Arduino.h"
+#if defined(ARDUINO) || defined(PLATFORM_ID)
 #include "SdFat/BlockDriver.h"
 #include "SdFat/FreeStack.h"
 #include "SdFat/MinimumSerial.h"
@@ -12,6 +13,11 @@
 #include "SdFat/SdFatConfig.h"
 #include "SdFat/sdios.h"
 #include "SdFat/SysCall.h"
+#else
+//Linux host build (tools/linux on the include path): POSIX stand-ins for SdFat
+#include "HostSdFat.h"
+#endif
+#include "hxz.h"
 // #include "SPI.h"
 
 
@@ -24,9 +30,24 @@
 #define BYTES_PER_FLASH_BLOCK (PAGE_SIZE_WORDS * BYTES_PER_WORD)
 //Hex file properties
 #define MAX_CHARS_PER_HEX_RECORD 45
+#define MAX_DATA_BYTES_PER_HEX_RECORD ((MAX_CHARS_PER_HEX_RECORD - 13) / 2)  //':' + 10 header/checksum digits + "\r\n"
 //Protocol behaviour settings
+#define STK_500_PREFLIGHT_IMAGE_CHECK 1    //Scan the whole image for corruption before resetting the target
+//Resident image cache size in flash pages (0 disables it).  256 pages covers a
+//whole 32K ATmega328PB image, so only enable it by default on hosts with RAM to spare.
+#ifndef STK_IMAGE_CACHE_PAGES
+#if defined(PLATFORM_ID) || defined(__SAM3X8E__) || defined(ESP8266) || defined(ESP32) \
+   || defined(__MK64FX512__) || defined(__MK66FX1M0__)
+#define STK_IMAGE_CACHE_PAGES 256
+#else
+#define STK_IMAGE_CACHE_PAGES 0
+#endif
+#endif
 
 #define STK_500_FLASH_PROCESS_TIMEOUT 80000 //80 seconds
+//SPI benchmark scratch file, overwritten by benchmarkSpi()
+#define SPI_BENCH_FILE "SPIBENCH.BIN"
+#define SPI_BENCH_BLOCKS 1024              //512 KB each way
 
 
 
@@ -37,7 +58,7 @@ class HexFileRecord{
 
 public:
 
-   bool decode(); //Decodes ascii hex file record into constituent parts
+   bool decode(bool verifyChecksum = true); //Decodes ascii hex file record into constituent parts
 
    const char* ascii_line;
 
@@ -45,6 +66,7 @@ public:
    uint16_t address = 0;   //beginning memmory address offset of the data block (2-byte word-oriented)
    byte recordType = 0; //0x46 = flash
    const char* data = 0; //pointer to where the data bytes start
+   byte dataBytes[MAX_DATA_BYTES_PER_HEX_RECORD]; //data bytes decoded from ascii
    byte checkSum = 0;
 
 };
@@ -61,6 +83,19 @@ struct flash_page_block_t{
 };
 
 
+/*=============================================>>>>>
+= Data structure identifying a decoded image held in the resident image cache =
+===============================================>>>>>*/
+
+struct image_cache_key_t{
+   uint32_t pathHash = 0;     //FNV-1a hash of the file path
+   uint32_t fileSize = 0;
+   uint16_t modifyDate = 0;   //FAT directory entry write date
+   uint16_t modifyTime = 0;   //FAT directory entry write time
+   uint32_t contentHash = 0;  //FNV-1a hash of the decoded pages
+};
+
+
 /*=============================================>>>>>
 =
 Interface object used by STK500 code to retrieve blocks of flash data
@@ -69,6 +104,12 @@ STK500 protocol messages
  =
 ===============================================>>>>>*/
 
+//Image file formats understood by HexFileClass
+enum hexfile_format_t{
+   HEXFILE_FORMAT_INTEL_HEX,  //Plain ascii Intel hex records
+   HEXFILE_FORMAT_HXZ         //LZSS compressed binary image (see hxz.h)
+};
+
 class HexFileClass{
 
 public:
@@ -78,8 +119,37 @@ public:
    unsigned int load_hex_records_flash_data_block(flash_page_block_t &targBlock );
 
    bool moreBytesToConsume(){
+      if(format == HEXFILE_FORMAT_HXZ){
+         return (hxz_bytes_out < hxz_image_bytes);
+      }
       return (hexfile_chars_consumed < hexfile_total_bytes);
    }
+
+   //Fill in the cache key fields that can be had from the directory entry alone
+   bool stat(const char* targFilePath, image_cache_key_t &key);
+
+   hexfile_format_t getFormat(){
+      return format;
+   }
+
+   //True once a corrupt record or SD error has been hit since begin()
+   bool failed(){
+      return hexfile_error;
+   }
+
+   //Scan the whole image once, checking every record checksum (or the
+   //compressed image sum), then rewind ready for loading
+   bool preflight_check();
+
+   //Record checksums are checked while decoding unless this is turned off
+   void setChecksumValidation(bool enable){
+      verify_record_checksums = enable;
+   }
+
+   //Number of bytes pulled off the SD card since begin() (for benchmarking)
+   unsigned long sdBytesRead(){
+      return sd_bytes_read;
+   }
    // unsigned int last_hexRecord_accessed = 0;
 
 
@@ -87,11 +157,150 @@ private:
    //Function to read/decode a line from hex file on SD card
    bool consume_hex_record(HexFileRecord &targRecord);
 
+   //Seek back to the start of the image and reset decoder state
+   bool rewind();
+   bool preflight_check_hex();
+   bool preflight_check_hxz();
+
+   //Compressed image helpers
+   bool hxz_begin();
+   unsigned int hxz_load_flash_data_block(flash_page_block_t &targBlock);
+   int hxz_read_byte();
+   int hxz_next_byte();
+
+   hexfile_format_t format = HEXFILE_FORMAT_INTEL_HEX;
    unsigned int hexfile_chars_consumed = 0;
    unsigned int hexfile_total_bytes = 0;
+   unsigned long sd_bytes_read = 0;
+   bool hexfile_error = false;
+   bool verify_record_checksums = true;
    SdFile sdHexFile;
+
+   //Compressed image decoder state
+   uint16_t hxz_base_address = 0;   //Byte address of first image byte
+   uint32_t hxz_image_bytes = 0;    //Decompressed image length
+   uint32_t hxz_bytes_out = 0;      //Decompressed bytes handed out so far
+   uint16_t hxz_image_sum = 0;      //16-bit sum of the image bytes from the header
+   byte hxz_window[HXZ_WINDOW_SIZE];
+   byte hxz_window_pos = 0;         //Wraps at 256 on its own
+   byte hxz_flags = 0;
+   byte hxz_flag_bits = 0;          //Flag bits left in hxz_flags
+   uint16_t hxz_match_dist = 0;
+   uint16_t hxz_match_left = 0;
+   byte hxz_in_pos = 0;             //Read position in the SD input buffer
+   byte hxz_in_len = 0;             //Valid bytes in the SD input buffer
+};
+
+
+
+/*=============================================>>>>>
+=
+Resident decoded image cache
+
+On a production line the same image gets flashed into board after board, so
+the decoded pages of the last image are kept in RAM (or any other storage a
+ImageCacheStorage is written for, e.g. external PSRAM or SPI flash).  A cached
+image is only used while the file on the card still has the same name, size
+and modification time; anything else re-decodes it from the card.  The content
+hash is taken while the pages are stored and checked again before every reuse,
+which catches a resident copy that has been corrupted in the meantime.
+ =
+===============================================>>>>>*/
+
+//Where cached pages live.  Subclass this to put the cache in external memory.
+class ImageCacheStorage{
+
+public:
+   virtual uint16_t capacityPages() = 0;
+   virtual bool writePage(uint16_t index, const flash_page_block_t &block) = 0;
+   virtual bool readPage(uint16_t index, flash_page_block_t &block) = 0;
 };
 
+#if STK_IMAGE_CACHE_PAGES
+//Default storage: a plain array in RAM
+class RamImageCacheStorage : public ImageCacheStorage{
+
+public:
+   uint16_t capacityPages(){
+      return STK_IMAGE_CACHE_PAGES;
+   }
+   bool writePage(uint16_t index, const flash_page_block_t &block){
+      if(index >= STK_IMAGE_CACHE_PAGES){
+         return false;
+      }
+      pages[index] = block;
+      return true;
+   }
+   bool readPage(uint16_t index, flash_page_block_t &block){
+      if(index >= STK_IMAGE_CACHE_PAGES){
+         return false;
+      }
+      block = pages[index];
+      return true;
+   }
+
+private:
+   flash_page_block_t pages[STK_IMAGE_CACHE_PAGES];
+};
+#endif
+
+//Storage used by ImageCache unless told otherwise (NULL when STK_IMAGE_CACHE_PAGES is 0)
+extern ImageCacheStorage* const defaultImageCacheStorage;
+
+class ImageCache{
+
+public:
+   void setStorage(ImageCacheStorage* newStorage){
+      storage = newStorage;
+      invalidate();
+   }
+
+   bool enabled(){
+      return storage != NULL;
+   }
+
+   void invalidate(){
+      valid = false;
+      storing = false;
+      numPages = 0;
+   }
+
+   //True if the resident image matches key and is still intact
+   bool lookup(const image_cache_key_t &key);
+
+   //Start storing a freshly decoded image under key
+   void beginStore(const image_cache_key_t &key);
+   //Store the next decoded page.  Storing stops quietly if the image doesn't fit.
+   void storePage(const flash_page_block_t &block);
+   //Mark the stored image usable once every page has been stored
+   bool endStore();
+
+   bool isStoring(){
+      return storing;
+   }
+
+   uint16_t pageCount(){
+      return numPages;
+   }
+
+   bool readPage(uint16_t index, flash_page_block_t &block){
+      return storage->readPage(index, block);
+   }
+
+   uint32_t contentHash(){
+      return cacheKey.contentHash;
+   }
+
+   static uint32_t hash(const void* data, size_t len, uint32_t seed = 2166136261UL);
+
+private:
+   ImageCacheStorage* storage = defaultImageCacheStorage;
+   image_cache_key_t cacheKey;
+   uint16_t numPages = 0;
+   bool valid = false;
+   bool storing = false;
+   uint32_t storeHash = 0;
+};
 
 
 /*=============================================>>>>>
@@ -153,10 +362,33 @@ public:
 
    bool begin();
    bool programTarget(const char* targFile = "firmmware.hex");
+   //Program the target from pages streamed by a PC (see serial_upload.h), optionally saving them to SD
+   bool programFromSerial(Stream &pcPort);
+   //Run the image loading pass only (no target) and report SD bytes read and time taken
+   bool benchmarkImage(const char* targFile, bool verifyChecksums = true);
+   //Time raw multi-block SD reads and writes through the SPI driver and compare with the SPI clock
+   bool benchmarkSpi();
+
+   //Put the resident image cache somewhere other than the default RAM array (NULL disables it)
+   void setImageCacheStorage(ImageCacheStorage* storage){
+      imageCache.setStorage(storage);
+   }
 
 
 private:
    void resetTarget();
+   bool resetAndSync();
+
+   //Image page source: the resident cache when it is valid, otherwise the SD card
+   bool openImage(const char* targFile);
+   bool rewindImage(const char* targFile);
+   bool moreImagePages();
+   unsigned int loadImagePage(flash_page_block_t &targBlock);
+
+   ImageCache imageCache;
+   bool image_from_cache = false;
+   bool image_load_failed = false;
+   uint16_t cache_page_index = 0;
 
    byte chipSelectPin;
    bool use_watchdog_reset_method;
@@ -0,0 +1,260 @@
+/*=============================================>>>>>
+= Dependencies =
+===============================================>>>>>*/
+#include "Arduino.h"
+#include "STK_Engine.h"
+#include "stk500.h"
+
+
+/*=============================================>>>>>
+= STK500 message builders =
+===============================================>>>>>*/
+
+byte STK_build_sync_msg(byte* buf){
+   buf[0] = STK_GET_SYNC;
+   buf[1] = CRC_EOP;
+   return 2;
+}
+
+byte STK_build_address_msg(byte* buf, uint16_t target_addr){
+   buf[0] = STK_LOAD_ADDRESS;
+   buf[1] = target_addr & 0xFF;         //addr_low
+   buf[2] = (target_addr >> 8) & 0xFF;  //addr_high
+   buf[3] = CRC_EOP;
+   return 4;
+}
+
+/*=============================================>>>>>
+= STK_PROG_PAGE 0x64.  Always a whole page - a partial block is padded with 0xFF =
+===============================================>>>>>*/
+byte STK_build_prog_page_msg(byte* buf, const flash_page_block_t &targBlock){
+   byte len = 0;
+   buf[len++] = STK_PROG_PAGE;
+   buf[len++] = (BYTES_PER_FLASH_BLOCK >> 8) & 0xFF;   //bytes_high
+   buf[len++] = BYTES_PER_FLASH_BLOCK & 0xFF;          //bytes_low
+   buf[len++] = STK_MEMTYPE_FLASH;
+   for(uint16_t count = 0; count < BYTES_PER_FLASH_BLOCK; count++){
+      buf[len++] = (count < targBlock.block_size_bytes) ? targBlock.dataBytes[count] : 0xFF;
+   }
+   buf[len++] = CRC_EOP;
+   return len;
+}
+
+byte STK_build_read_page_msg(byte* buf){
+   buf[0] = STK_READ_PAGE;
+   buf[1] = (BYTES_PER_FLASH_BLOCK >> 8) & 0xFF;   //bytes_high
+   buf[2] = BYTES_PER_FLASH_BLOCK & 0xFF;          //bytes_low
+   buf[3] = STK_MEMTYPE_FLASH;
+   buf[4] = CRC_EOP;
+   return 5;
+}
+
+byte STK_build_leave_progmode_msg(byte* buf){
+   buf[0] = STK_LEAVE_PROGMODE;
+   buf[1] = CRC_EOP;
+   return 2;
+}
+
+/*= End of STK500 message builders =*/
+/*=============================================<<<<<*/
+
+
+
+/*=============================================>>>>>
+= STK_Session class functions =
+
+Every step is one message and one reply: STK_INSYNC, any data bytes, STK_OK.
+The write pass sends every page, then the verify pass reads every page back
+and compares it byte by byte as the reply arrives, so no read-back buffer is
+needed.
+===============================================>>>>>*/
+
+void STK_Session::begin(const flash_page_block_t* pages, uint16_t numPages, unsigned long now){
+   image = pages;
+   image_pages = numPages;
+   page_index = 0;
+   sync_count = 0;
+   sync_attempts = 0;
+   error_msg[0] = 0;
+   state = STK_SESSION_SYNC;
+   startStep(now);
+}
+
+/*=============================================>>>>>
+= Function to skip pages with nothing in them.  Returns false once past the last page =
+===============================================>>>>>*/
+bool STK_Session::skipEmptyPages(){
+   while(page_index < image_pages && !image[page_index].block_size_bytes){
+      page_index++;
+   }
+   return page_index < image_pages;
+}
+
+/*=============================================>>>>>
+= Function to queue the message for the current state =
+===============================================>>>>>*/
+void STK_Session::startStep(unsigned long now){
+   switch(state){
+
+      case STK_SESSION_SYNC:
+         queueMessage(STK_build_sync_msg(tx_buf), 0, STK_SESSION_SYNC_TIMEOUT, now);
+         break;
+
+      case STK_SESSION_WRITE_ADDRESS:
+      case STK_SESSION_VERIFY_ADDRESS:
+         queueMessage(STK_build_address_msg(tx_buf, image[page_index].addressStart), 0,
+                      STK_SESSION_REPLY_TIMEOUT, now);
+         break;
+
+      case STK_SESSION_WRITE_PAGE:
+         queueMessage(STK_build_prog_page_msg(tx_buf, image[page_index]), 0,
+                      STK_SESSION_REPLY_TIMEOUT, now);
+         break;
+
+      case STK_SESSION_VERIFY_PAGE:
+         queueMessage(STK_build_read_page_msg(tx_buf), BYTES_PER_FLASH_BLOCK,
+                      STK_SESSION_REPLY_TIMEOUT, now);
+         break;
+
+      case STK_SESSION_LEAVE_PROGMODE:
+         queueMessage(STK_build_leave_progmode_msg(tx_buf), 0, STK_SESSION_REPLY_TIMEOUT, now);
+         break;
+
+      default:
+         break;
+   }
+}
+
+void STK_Session::queueMessage(byte len, uint16_t replyDataBytes, unsigned long timeout, unsigned long now){
+   tx_len = len;
+   tx_pos = 0;
+   rx_count = 0;
+   rx_data_bytes = replyDataBytes;
+   reply_deadline = now + timeout;
+}
+
+void STK_Session::fail(const char* msg){
+   snprintf(error_msg, sizeof(error_msg), "%s", msg);
+   state = STK_SESSION_ERROR;
+   tx_len = 0;
+   tx_pos = 0;
+}
+
+void STK_Session::receive(byte inByte, unsigned long now){
+   if(!busy() || txPending()){
+      //Nothing asked for yet - line noise or leftovers from a reset
+      return;
+   }
+   uint16_t index = rx_count++;
+   if(index == 0){
+      if(inByte != STK_INSYNC){
+         if(state == STK_SESSION_SYNC){
+            //Optiboot can take a moment to settle after reset; just try again later
+            rx_count = 0;
+            return;
+         }
+         fail("lost sync with target");
+      }
+      return;
+   }
+   if(index <= rx_data_bytes){
+      //Only STK_READ_PAGE replies carry data, compare it against the image as it arrives
+      const flash_page_block_t &page = image[page_index];
+      uint16_t offset = index - 1;
+      if(offset < page.block_size_bytes && inByte != page.dataBytes[offset]){
+         char myBuf[64];
+         snprintf(myBuf, sizeof(myBuf), "verify mismatch at word address 0x%04X, offset %u",
+                  page.addressStart, offset);
+         fail(myBuf);
+      }
+      return;
+   }
+   if(inByte != STK_OK){
+      fail("unexpected response from target");
+      return;
+   }
+   replyComplete(now);
+}
+
+/*=============================================>>>>>
+= Function to move on to the next step after a good reply =
+===============================================>>>>>*/
+void STK_Session::replyComplete(unsigned long now){
+   switch(state){
+
+      case STK_SESSION_SYNC:
+         if(++sync_count < STK_SESSION_SYNCS_NEEDED){
+            break;
+         }
+         page_index = 0;
+         state = skipEmptyPages() ? STK_SESSION_WRITE_ADDRESS : STK_SESSION_LEAVE_PROGMODE;
+         break;
+
+      case STK_SESSION_WRITE_ADDRESS:
+         state = STK_SESSION_WRITE_PAGE;
+         break;
+
+      case STK_SESSION_WRITE_PAGE:
+         page_index++;
+         if(skipEmptyPages()){
+            state = STK_SESSION_WRITE_ADDRESS;
+         }
+         else{
+            //Whole image written, read it all back
+            page_index = 0;
+            skipEmptyPages();
+            state = STK_SESSION_VERIFY_ADDRESS;
+         }
+         break;
+
+      case STK_SESSION_VERIFY_ADDRESS:
+         state = STK_SESSION_VERIFY_PAGE;
+         break;
+
+      case STK_SESSION_VERIFY_PAGE:
+         page_index++;
+         state = skipEmptyPages() ? STK_SESSION_VERIFY_ADDRESS : STK_SESSION_LEAVE_PROGMODE;
+         break;
+
+      case STK_SESSION_LEAVE_PROGMODE:
+         state = STK_SESSION_SUCCESS;
+         return;
+
+      default:
+         return;
+   }
+   startStep(now);
+}
+
+void STK_Session::poll(unsigned long now){
+   if(!busy() || (long)(now - reply_deadline) < 0){
+      return;
+   }
+   if(state == STK_SESSION_SYNC){
+      sync_count = 0;
+      if(++sync_attempts < STK_SESSION_SYNC_ATTEMPTS){
+         startStep(now);
+         return;
+      }
+      fail("sync failure");
+      return;
+   }
+   switch(state){
+      case STK_SESSION_WRITE_ADDRESS:
+      case STK_SESSION_VERIFY_ADDRESS:
+         fail("STK_LOAD_ADDRESS receive timeout");
+         break;
+      case STK_SESSION_WRITE_PAGE:
+         fail("STK_PROG_PAGE receive timeout");
+         break;
+      case STK_SESSION_VERIFY_PAGE:
+         fail("STK_READ_PAGE receive timeout");
+         break;
+      default:
+         fail("STK_LEAVE_PROGMODE receive timeout");
+         break;
+   }
+}
+
+/*= End of STK_Session class functions =*/
+/*=============================================<<<<<*/
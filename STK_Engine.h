@@ -0,0 +1,123 @@
+#ifndef STK_ENGINE_H
+#define STK_ENGINE_H
+
+/*=============================================>>>>>
+= Dependencies =
+===============================================>>>>>*/
+#include "Arduino.h"
+#include "STK_500_Programmer.h"
+
+
+/*=============================================>>>>>
+= Definitions =
+===============================================>>>>>*/
+//Longest STK500 message we send: STK_PROG_PAGE header + one flash page + CRC_EOP
+#define STK_MAX_MSG_BYTES (4 + BYTES_PER_FLASH_BLOCK + 1)
+//Session behaviour settings
+#define STK_SESSION_SYNC_TIMEOUT 200      //ms to wait for each STK_GET_SYNC answer
+#define STK_SESSION_SYNC_ATTEMPTS 10      //STK_GET_SYNC tries before giving up
+#define STK_SESSION_SYNCS_NEEDED 3        //Good syncs in a row before programming
+#define STK_SESSION_REPLY_TIMEOUT 1000    //ms to wait for any other answer
+
+
+/*=============================================>>>>>
+= STK500 message builders =
+
+Each fills buf (at least STK_MAX_MSG_BYTES long) with one complete message and
+returns its length.  Shared by the blocking helpers in STK_500_Programmer.cpp
+and by STK_Session, so the wire format lives in one place.
+===============================================>>>>>*/
+byte STK_build_sync_msg(byte* buf);
+byte STK_build_address_msg(byte* buf, uint16_t target_addr);
+byte STK_build_prog_page_msg(byte* buf, const flash_page_block_t &targBlock);
+byte STK_build_read_page_msg(byte* buf);
+byte STK_build_leave_progmode_msg(byte* buf);
+
+
+/*=============================================>>>>>
+=
+Non-blocking STK500 programming session
+
+Programs and verifies one target from an already decoded image (an array of
+flash pages that any number of sessions can share).  The session never touches
+a port itself: the owner feeds it received bytes, sends whatever it has queued
+and calls poll() now and then so timeouts fire.  That lets one loop drive many
+targets at once, e.g. the epoll loop in tools/stk_flash.cpp.
+
+The target must already have been reset into Optiboot when begin() is called.
+ =
+===============================================>>>>>*/
+enum stk_session_state_t{
+   STK_SESSION_IDLE,
+   STK_SESSION_SYNC,
+   STK_SESSION_WRITE_ADDRESS,
+   STK_SESSION_WRITE_PAGE,
+   STK_SESSION_VERIFY_ADDRESS,
+   STK_SESSION_VERIFY_PAGE,
+   STK_SESSION_LEAVE_PROGMODE,
+   STK_SESSION_SUCCESS,
+   STK_SESSION_ERROR
+};
+
+class STK_Session{
+
+public:
+   //Start programming.  pages must stay valid until the session finishes.
+   void begin(const flash_page_block_t* pages, uint16_t numPages, unsigned long now);
+
+   //Hand the session a byte received from the target
+   void receive(byte inByte, unsigned long now);
+   //Check for timeouts
+   void poll(unsigned long now);
+
+   bool busy(){
+      return state != STK_SESSION_IDLE && state != STK_SESSION_SUCCESS && state != STK_SESSION_ERROR;
+   }
+   stk_session_state_t getState(){
+      return state;
+   }
+   //Why the session failed (empty unless state is STK_SESSION_ERROR)
+   const char* errorMessage(){
+      return error_msg;
+   }
+   //Pages written so far plus pages verified so far, out of twice the page count
+   uint32_t progress(){
+      return (state >= STK_SESSION_VERIFY_ADDRESS ? image_pages : 0) + page_index;
+   }
+
+   //Bytes waiting to go to the target
+   const byte* txData(){
+      return tx_buf + tx_pos;
+   }
+   uint16_t txPending(){
+      return tx_len - tx_pos;
+   }
+   void txConsumed(uint16_t count){
+      tx_pos += count;
+   }
+
+private:
+   void startStep(unsigned long now);
+   void queueMessage(byte len, uint16_t replyDataBytes, unsigned long timeout, unsigned long now);
+   void replyComplete(unsigned long now);
+   void fail(const char* msg);
+   bool skipEmptyPages();
+
+   stk_session_state_t state = STK_SESSION_IDLE;
+   const flash_page_block_t* image = NULL;
+   uint16_t image_pages = 0;
+   uint16_t page_index = 0;
+   byte sync_count = 0;
+   byte sync_attempts = 0;
+
+   byte tx_buf[STK_MAX_MSG_BYTES];
+   uint16_t tx_len = 0;
+   uint16_t tx_pos = 0;
+
+   uint16_t rx_count = 0;           //Reply bytes received for the current message
+   uint16_t rx_data_bytes = 0;      //Data bytes expected between STK_INSYNC and STK_OK
+   unsigned long reply_deadline = 0;
+   char error_msg[64];
+};
+
+#endif
@@ -377,6 +377,12 @@ bool FatFile::open(FatFileSystem* fs, const char* path, uint8_t oflag) {
 bool FatFile::open(FatFile* dirFile, const char* path, uint8_t oflag) {
   FatFile tmpDir;
   fname_t fname;
+#if FAT_PATH_CACHE_ENTRIES
+  FatPathCache_t* pc;
+  const char* cachePath;
+  uint32_t start;
+  uint32_t hash;
+#endif  // FAT_PATH_CACHE_ENTRIES
 
   // error if already open
   if (isOpen() || !dirFile->isDir()) {
@@ -396,6 +402,20 @@ bool FatFile::open(FatFile* dirFile, const char* path, uint8_t oflag) {
     }
     dirFile = &tmpDir;
   }
+#if FAT_PATH_CACHE_ENTRIES
+  // FNV-1a hash of the path.
+  hash = 2166136261UL;
+  for (const char* p = path; *p; p++) {
+    hash = (hash ^ (uint8_t)*p)*16777619UL;
+  }
+  cachePath = path;
+  start = dirFile->m_firstCluster;
+  pc = dirFile->m_vol->pathCacheFind(start, hash, path);
+  if (pc && !(oflag & O_EXCL) &&
+      openCachedPath(dirFile->m_vol, pc, oflag)) {
+    return true;
+  }
+#endif  // FAT_PATH_CACHE_ENTRIES
   while (1) {
     if (!parsePathName(path, &fname, &path)) {
       DBG_FAIL_MACRO;
@@ -412,12 +432,63 @@ bool FatFile::open(FatFile* dirFile, const char* path, uint8_t oflag) {
     dirFile = &tmpDir;
     close();
   }
-  return open(dirFile, &fname, oflag);
+  if (!open(dirFile, &fname, oflag)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+#if FAT_PATH_CACHE_ENTRIES
+  if (strlen(cachePath) >= FAT_PATH_CACHE_LENGTH) {
+    return true;
+  }
+  if (!pc) {
+    pc = m_vol->pathCacheSlot();
+  }
+  strcpy(pc->path, cachePath);
+  pc->dirBlock = m_dirBlock;
+  pc->start = start;
+  pc->hash = hash;
+  pc->dirCluster = m_dirCluster;
+  pc->firstCluster = m_firstCluster;
+  pc->dirIndex = m_dirIndex;
+  pc->lfnOrd = m_lfnOrd;
+#endif  // FAT_PATH_CACHE_ENTRIES
+  return true;
 
 fail:
   return false;
 }
 //------------------------------------------------------------------------------
+#if FAT_PATH_CACHE_ENTRIES
+bool FatFile::openCachedPath(FatVolume* vol, FatPathCache_t* pc,
+                             uint8_t oflag) {
+  FatFile dirFile;
+  dir_t* dir;
+  cache_t* pb = vol->cacheFetchData(pc->dirBlock, FatCache::CACHE_FOR_READ);
+  if (!pb) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  dir = &pb->dir[0XF & pc->dirIndex];
+  // Check the entry still holds the same file.
+  if (dir->name[0] == DIR_NAME_DELETED || !DIR_IS_FILE_OR_SUBDIR(dir) ||
+      pc->firstCluster != (((uint32_t)dir->firstClusterHigh << 16)
+                           | dir->firstClusterLow)) {
+    pc->dirBlock = 0;
+    goto fail;
+  }
+  m_vol = vol;
+  m_dirCluster = pc->dirCluster;
+  if (!dirFile.openCluster(this)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  return openCachedEntry(&dirFile, pc->dirIndex, oflag, pc->lfnOrd);
+
+fail:
+  return false;
+}
+#endif  // FAT_PATH_CACHE_ENTRIES
+//------------------------------------------------------------------------------
 bool FatFile::open(FatFile* dirFile, uint16_t index, uint8_t oflag) {
   uint8_t chksum = 0;
   uint8_t lfnOrd = 0;
@@ -687,6 +758,164 @@ bool FatFile::openRoot(FatVolume* vol) {
 fail:
   return false;
 }
+#if FAT_FILE_CHECKPOINT_COUNT
+//------------------------------------------------------------------------------
+void FatFile::checkpointClear() {
+  m_checkpointShift = 0;
+  memset(m_checkpoint, 0, sizeof(m_checkpoint));
+}
+//------------------------------------------------------------------------------
+// Find the nearest checkpoint at or before file cluster fileCluster.  Returns
+// its file cluster number and sets cluster, or returns zero if there is none.
+uint32_t FatFile::checkpointFind(uint32_t fileCluster, uint32_t* cluster) {
+  uint32_t k = fileCluster >> m_checkpointShift;
+  if (k > FAT_FILE_CHECKPOINT_COUNT) {
+    k = FAT_FILE_CHECKPOINT_COUNT;
+  }
+  for (; k; k--) {
+    if (m_checkpoint[k - 1]) {
+      *cluster = m_checkpoint[k - 1];
+      return k << m_checkpointShift;
+    }
+  }
+  return 0;
+}
+//------------------------------------------------------------------------------
+// Record the cluster for file cluster fileCluster if it falls on a
+// checkpoint.  Doubles the spacing when the file outgrows the table.
+void FatFile::checkpointSet(uint32_t fileCluster, uint32_t cluster) {
+  while ((fileCluster >> m_checkpointShift) > FAT_FILE_CHECKPOINT_COUNT) {
+    // keep every other checkpoint
+    for (uint8_t i = 0; i < FAT_FILE_CHECKPOINT_COUNT; i++) {
+      uint8_t j = 2*i + 1;
+      m_checkpoint[i] = j < FAT_FILE_CHECKPOINT_COUNT ? m_checkpoint[j] : 0;
+    }
+    m_checkpointShift++;
+  }
+  if (fileCluster & ((1UL << m_checkpointShift) - 1)) {
+    return;
+  }
+  uint32_t k = fileCluster >> m_checkpointShift;
+  if (k) {
+    m_checkpoint[k - 1] = cluster;
+  }
+}
+#endif  // FAT_FILE_CHECKPOINT_COUNT
+#if FAT_FILE_EXTENT_COUNT
+//------------------------------------------------------------------------------
+// Walk the FAT from cluster, at least to the end of its FAT block and at
+// most want clusters past it if that is further, and remember the
+// contiguous clusters found as a run starting at file cluster fileCluster.
+// A run that ends just before cluster is extended instead, so long runs are
+// learned a piece at a time as the file is read.  When the list is full the
+// last entry is replaced, so it tracks the current run.
+bool FatFile::extentAdd(uint32_t fileCluster, uint32_t cluster,
+                        uint32_t want, uint32_t* left) {
+  uint32_t count = 1;
+  uint32_t next;
+  uint8_t i;
+  // The rest of the FAT block holding cluster costs no extra reads.
+  uint16_t perBlock = m_vol->fatType() == 32 ? 128
+                    : m_vol->fatType() == 16 ? 256 : 1;
+  if (want < (perBlock - 1 - (cluster & (perBlock - 1)))) {
+    want = perBlock - 1 - (cluster & (perBlock - 1));
+  }
+  while (count <= want) {
+    int8_t fg = m_vol->fatGet(cluster + count - 1, &next);
+    if (fg < 0) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    if (fg == 0 || next != (cluster + count)) {
+      break;
+    }
+    count++;
+  }
+  *left = count - 1;
+  for (i = 0; i < m_extentCount; i++) {
+    if ((m_extent[i].fileCluster + m_extent[i].clusterCount) == fileCluster &&
+        (m_extent[i].firstCluster + m_extent[i].clusterCount) == cluster) {
+      m_extent[i].clusterCount += count;
+      return true;
+    }
+  }
+  i = m_extentCount < FAT_FILE_EXTENT_COUNT ? m_extentCount++
+                                            : FAT_FILE_EXTENT_COUNT - 1;
+  m_extent[i].fileCluster = fileCluster;
+  m_extent[i].firstCluster = cluster;
+  m_extent[i].clusterCount = count;
+  return true;
+
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+// Look up the cluster holding file cluster fileCluster.  Also returns
+// the number of contiguous clusters that follow it.
+bool FatFile::extentFind(uint32_t fileCluster, uint32_t* cluster,
+                         uint32_t* left) {
+  for (uint8_t i = 0; i < m_extentCount; i++) {
+    uint32_t offset = fileCluster - m_extent[i].fileCluster;
+    if (offset < m_extent[i].clusterCount) {
+      *cluster = m_extent[i].firstCluster + offset;
+      *left = m_extent[i].clusterCount - offset - 1;
+      return true;
+    }
+  }
+  return false;
+}
+//------------------------------------------------------------------------------
+// Advance m_curCluster to the cluster for m_curPosition, which is at the
+// start of a cluster.  Return -1 error, 0 end of chain, else 1.
+int8_t FatFile::extentNextCluster() {
+  uint32_t fileCluster = m_curPosition >> (9 + m_vol->clusterSizeShift());
+  uint32_t left;
+  if (extentFind(fileCluster, &m_curCluster, &left)) {
+    return 1;
+  }
+  // start of a new fragment - the FAT is only read here
+  int8_t fg = m_vol->fatGet(m_curCluster, &m_curCluster);
+  if (fg <= 0) {
+    return fg;
+  }
+  return extentAdd(fileCluster, m_curCluster, 0, &left) ? 1 : -1;
+}
+//------------------------------------------------------------------------------
+// Find how many contiguous clusters follow m_curCluster, looking no further
+// than want clusters past the known run.
+bool FatFile::extentRunLeft(uint32_t want, uint32_t* left) {
+  uint32_t fileCluster = m_curPosition >> (9 + m_vol->clusterSizeShift());
+  uint32_t cluster;
+  uint32_t next;
+  uint32_t more;
+  int8_t fg;
+  if (!extentFind(fileCluster, &cluster, left) || cluster != m_curCluster) {
+    return extentAdd(fileCluster, m_curCluster, want, left);
+  }
+  if (*left >= want) {
+    return true;
+  }
+  // the run may continue past the clusters walked so far
+  cluster += *left;
+  fg = m_vol->fatGet(cluster, &next);
+  if (fg < 0) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (fg == 0 || next != (cluster + 1)) {
+    return true;
+  }
+  if (!extentAdd(fileCluster + *left + 1, next, want - *left - 1, &more)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  *left += more + 1;
+  return true;
+
+fail:
+  return false;
+}
+#endif  // FAT_FILE_EXTENT_COUNT
 //------------------------------------------------------------------------------
 int FatFile::peek() {
   FatPos_t pos;
@@ -738,8 +967,13 @@ int FatFile::read(void* buf, size_t nbyte) {
           // use first cluster in file
           m_curCluster = isRoot32() ? m_vol->rootDirStart() : m_firstCluster;
         } else {
+#if FAT_FILE_EXTENT_COUNT
+          // get next cluster from extent list or FAT
+          fg = extentNextCluster();
+#else  // FAT_FILE_EXTENT_COUNT
           // get next cluster from FAT
           fg = m_vol->fatGet(m_curCluster, &m_curCluster);
+#endif  // FAT_FILE_EXTENT_COUNT
           if (fg < 0) {
             DBG_FAIL_MACRO;
             goto fail;
@@ -751,11 +985,15 @@ int FatFile::read(void* buf, size_t nbyte) {
             DBG_FAIL_MACRO;
             goto fail;
           }
+#if FAT_FILE_CHECKPOINT_COUNT
+          checkpointSet(m_curPosition >> (9 + m_vol->clusterSizeShift()),
+                        m_curCluster);
+#endif  // FAT_FILE_CHECKPOINT_COUNT
         }
       }
       block = m_vol->clusterFirstBlock(m_curCluster) + blockOfCluster;
     }
-    if (offset != 0 || toRead < 512 || block == m_vol->cacheBlockNumber()) {
+    if (offset != 0 || toRead < 512 || m_vol->cacheIsCached(block)) {
       // amount to be read from current block
       n = 512 - offset;
       if (n > toRead) {
@@ -773,24 +1011,39 @@ int FatFile::read(void* buf, size_t nbyte) {
     } else if (toRead >= 1024) {
       size_t nb = toRead >> 9;
       if (!isRootFixed()) {
-        uint8_t mb = m_vol->blocksPerCluster() - blockOfCluster;
+        size_t mb = m_vol->blocksPerCluster() - blockOfCluster;
+#if FAT_FILE_EXTENT_COUNT
+        // continue into the contiguous clusters that follow
+        uint32_t left;
+        if (!extentRunLeft(nb >> m_vol->clusterSizeShift(), &left)) {
+          DBG_FAIL_MACRO;
+          goto fail;
+        }
+        if (left > (nb >> m_vol->clusterSizeShift())) {
+          left = nb >> m_vol->clusterSizeShift();
+        }
+        mb += left << m_vol->clusterSizeShift();
+#endif  // FAT_FILE_EXTENT_COUNT
         if (mb < nb) {
           nb = mb;
         }
       }
       n = 512*nb;
-      if (m_vol->cacheBlockNumber() <= block
-          && block < (m_vol->cacheBlockNumber() + nb)) {
-        // flush cache if a block is in the cache
-        if (!m_vol->cacheSyncData()) {
-          DBG_FAIL_MACRO;
-          goto fail;
-        }
+      // flush any of the blocks that are in the cache
+      if (!m_vol->cacheSyncData(block, nb)) {
+        DBG_FAIL_MACRO;
+        goto fail;
       }
       if (!m_vol->readBlocks(block, dst, nb)) {
         DBG_FAIL_MACRO;
         goto fail;
       }
+#if FAT_FILE_EXTENT_COUNT
+      if (!isRootFixed()) {
+        // move to the cluster holding the last block read
+        m_curCluster += (blockOfCluster + nb - 1) >> m_vol->clusterSizeShift();
+      }
+#endif  // FAT_FILE_EXTENT_COUNT
 #endif  // USE_MULTI_BLOCK_IO
     } else {
       // read single block
@@ -1133,18 +1386,34 @@ bool FatFile::seekSet(uint32_t pos) {
   nCur = (m_curPosition - 1) >> (m_vol->clusterSizeShift() + 9);
   nNew = (pos - 1) >> (m_vol->clusterSizeShift() + 9);
 
+#if FAT_FILE_EXTENT_COUNT
+  {
+    // no FAT access if the new position is in a known run
+    uint32_t left;
+    if (extentFind(nNew, &m_curCluster, &left)) {
+      goto done;
+    }
+  }
+#endif  // FAT_FILE_EXTENT_COUNT
   if (nNew < nCur || m_curPosition == 0) {
     // must follow chain from first cluster
     m_curCluster = isRoot32() ? m_vol->rootDirStart() : m_firstCluster;
-  } else {
-    // advance from curPosition
-    nNew -= nCur;
-  }
-  while (nNew--) {
+    nCur = 0;
+#if FAT_FILE_CHECKPOINT_COUNT
+    // or from the nearest checkpoint before the new position
+    nCur = checkpointFind(nNew, &m_curCluster);
+#endif  // FAT_FILE_CHECKPOINT_COUNT
+  }
+  // advance to new position
+  while (nCur < nNew) {
     if (m_vol->fatGet(m_curCluster, &m_curCluster) <= 0) {
       DBG_FAIL_MACRO;
       goto fail;
     }
+    nCur++;
+#if FAT_FILE_CHECKPOINT_COUNT
+    checkpointSet(nCur, m_curCluster);
+#endif  // FAT_FILE_CHECKPOINT_COUNT
   }
 
 done:
@@ -1199,6 +1468,26 @@ fail:
   return false;
 }
 //------------------------------------------------------------------------------
+bool FatFile::syncContiguous(uint32_t length) {
+  if (!isFile() || !(m_flags & O_WRITE) || m_firstCluster == 0) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  // blocks were written around the cache
+  m_vol->cacheInvalidate(m_vol->clusterFirstBlock(m_firstCluster),
+                         ((uint64_t)length + 511) >> 9);
+  if (m_curPosition > length && !seekSet(0)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  m_fileSize = length;
+  m_flags |= F_FILE_DIR_DIRTY;
+  return sync();
+
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
 bool FatFile::timestamp(FatFile* file) {
   dir_t* dir;
   dir_t srcDir;
@@ -1295,13 +1584,20 @@ bool FatFile::truncate(uint32_t length) {
     DBG_FAIL_MACRO;
     goto fail;
   }
-  // fileSize and length are zero - nothing to do
-  if (m_fileSize == 0) {
+  // no clusters - nothing to do
+  if (m_firstCluster == 0) {
     return true;
   }
 
   // remember position for seek after truncation
   newPos = m_curPosition > length ? length : m_curPosition;
+#if FAT_FILE_EXTENT_COUNT
+  // clusters past length are about to be freed
+  m_extentCount = 0;
+#endif  // FAT_FILE_EXTENT_COUNT
+#if FAT_FILE_CHECKPOINT_COUNT
+  checkpointClear();
+#endif  // FAT_FILE_CHECKPOINT_COUNT
 
   // position to last cluster in truncated file
   if (!seekSet(length)) {
@@ -1435,7 +1731,7 @@ int FatFile::write(const void* buf, size_t nbyte) {
       memcpy(dst, src, n);
       if (512 == (n + blockOffset)) {
         // Force write if block is full - improves large writes.
-        if (!m_vol->cacheSyncData()) {
+        if (!m_vol->cacheSyncData(block, 1)) {
           DBG_FAIL_MACRO;
           goto fail;
         }
@@ -1443,17 +1739,40 @@ int FatFile::write(const void* buf, size_t nbyte) {
 #if USE_MULTI_BLOCK_IO
     } else if (nToWrite >= 1024) {
       // use multiple block write command
-      uint8_t maxBlocks = m_vol->blocksPerCluster() - blockOfCluster;
+      size_t maxBlocks = m_vol->blocksPerCluster() - blockOfCluster;
       size_t nb = nToWrite >> 9;
+      // continue into following clusters while they are contiguous,
+      // allocating them at the end of the chain
+      while (nb > maxBlocks) {
+        uint32_t next;
+        int8_t fg = m_vol->fatGet(m_curCluster, &next);
+        if (fg < 0) {
+          DBG_FAIL_MACRO;
+          goto fail;
+        }
+        if (fg == 0) {
+          uint32_t last = m_curCluster;
+          if (!addCluster()) {
+            // write what fits, the next pass reports the error
+            m_curCluster = last;
+            break;
+          }
+          next = m_curCluster;
+          m_curCluster = last;
+        }
+        if (next != (m_curCluster + 1)) {
+          // next pass starts the new fragment
+          break;
+        }
+        m_curCluster = next;
+        maxBlocks += m_vol->blocksPerCluster();
+      }
       if (nb > maxBlocks) {
         nb = maxBlocks;
       }
       n = 512*nb;
-      if (m_vol->cacheBlockNumber() <= block
-          && block < (m_vol->cacheBlockNumber() + nb)) {
-        // invalidate cache if block is in cache
-        m_vol->cacheInvalidate();
-      }
+      // invalidate any of the blocks that are in the cache
+      m_vol->cacheInvalidate(block, nb);
       if (!m_vol->writeBlocks(block, src, nb)) {
         DBG_FAIL_MACRO;
         goto fail;
@@ -1462,9 +1781,7 @@ int FatFile::write(const void* buf, size_t nbyte) {
     } else {
       // use single block write command
       n = 512;
-      if (m_vol->cacheBlockNumber() == block) {
-        m_vol->cacheInvalidate();
-      }
+      m_vol->cacheInvalidate(block, 1);
       if (!m_vol->writeBlock(block, src)) {
         DBG_FAIL_MACRO;
         goto fail;
@@ -831,6 +831,20 @@ class FatFile {
    * the value false is returned for failure.
    */
   bool sync();
+  /** Record the size of a contiguous file whose data has been written
+   * directly to the device, for example with SdSpiCard::writeData().
+   *
+   * Cached copies of the first \a length bytes are dropped and the
+   * directory entry is written.  The cluster chain is not changed so
+   * \a length must not be larger than the space allocated by
+   * createContiguous().  Use truncate() to free unused clusters.
+   *
+   * \param[in] length The new size of the file.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool syncContiguous(uint32_t length);
   /** Copy a file's timestamps
    *
    * \param[in] file File to copy timestamps from.
@@ -973,7 +987,22 @@ class FatFile {
   bool open(FatFile* dirFile, fname_t* fname, uint8_t oflag);
   bool openCachedEntry(FatFile* dirFile, uint16_t cacheIndex, uint8_t oflag,
                        uint8_t lfnOrd);
+#if FAT_PATH_CACHE_ENTRIES
+  bool openCachedPath(FatVolume* vol, FatPathCache_t* pc, uint8_t oflag);
+#endif  // FAT_PATH_CACHE_ENTRIES
   bool readLBN(uint32_t* lbn);
+#if FAT_FILE_CHECKPOINT_COUNT
+  void checkpointClear();
+  uint32_t checkpointFind(uint32_t fileCluster, uint32_t* cluster);
+  void checkpointSet(uint32_t fileCluster, uint32_t cluster);
+#endif  // FAT_FILE_CHECKPOINT_COUNT
+#if FAT_FILE_EXTENT_COUNT
+  bool extentAdd(uint32_t fileCluster, uint32_t cluster, uint32_t want,
+                 uint32_t* left);
+  bool extentFind(uint32_t fileCluster, uint32_t* cluster, uint32_t* left);
+  int8_t extentNextCluster();
+  bool extentRunLeft(uint32_t want, uint32_t* left);
+#endif  // FAT_FILE_EXTENT_COUNT
   dir_t* readDirCache(bool skipReadOk = false);
   bool setDirSize();
 
@@ -1002,5 +1031,22 @@ class FatFile {
   uint32_t   m_dirBlock;         // block for this files directory entry
   uint32_t   m_fileSize;         // file size in bytes
   uint32_t   m_firstCluster;     // first cluster of file
+#if FAT_FILE_EXTENT_COUNT
+  // Run of contiguous clusters starting at cluster number fileCluster
+  // of the file.
+  struct extent_t {
+    uint32_t fileCluster;
+    uint32_t firstCluster;
+    uint32_t clusterCount;
+  };
+  uint8_t    m_extentCount;      // valid entries in m_extent
+  extent_t   m_extent[FAT_FILE_EXTENT_COUNT];
+#endif  // FAT_FILE_EXTENT_COUNT
+#if FAT_FILE_CHECKPOINT_COUNT
+  // m_checkpoint[i] is the cluster for file cluster (i + 1) << shift,
+  // zero if not known yet.
+  uint8_t    m_checkpointShift;
+  uint32_t   m_checkpoint[FAT_FILE_CHECKPOINT_COUNT];
+#endif  // FAT_FILE_CHECKPOINT_COUNT
 };
 #endif  // FatFile_h
@@ -302,6 +302,19 @@ bool FatFile::open(FatFile* dirFile, fname_t* fname, uint8_t oflag) {
   dir_t* dir;
   ldir_t* ldir;
   size_t len = fname->len;
+#if FAT_DIR_INDEX_ENTRIES
+  FatDirIndex* idx;
+  bool indexScan = true;  // Only read entries for matching index records.
+  bool seek = false;      // Entry block is not in the cache after a seek.
+  int16_t rec = -1;       // Index record being checked.
+  uint16_t lfnHash = 0;
+  uint16_t sfnHash;
+  // Long name being read for the index.
+  uint16_t entryHash = 0;
+  uint16_t entryIndex = 0;
+  uint8_t entryOrd = 0;
+  uint8_t entryChksum = 0;
+#endif  // FAT_DIR_INDEX_ENTRIES
 
   if (!dirFile->isDir() || isOpen()) {
     DBG_FAIL_MACRO;
@@ -310,15 +323,102 @@ bool FatFile::open(FatFile* dirFile, fname_t* fname, uint8_t oflag) {
   // Number of directory entries needed.
   freeNeed = fname->flags & FNAME_FLAG_NEED_LFN ? 1 + (len + 12)/13 : 1;
 
+#if FAT_DIR_INDEX_ENTRIES
+  idx = dirFile->m_vol->dirIndex(dirFile->m_firstCluster);
+  for (size_t k = 0; k < len; k++) {
+    lfnHash = FatDirIndex::addChar(lfnHash, k, lfnToLower(fname->lfn[k]));
+  }
+  // A name with lost characters never matches an 8.3 entry.
+  sfnHash = fname->flags & FNAME_FLAG_LOST_CHARS ?
+            lfnHash : FatDirIndex::sfnHash(fname->sfn);
+#endif  // FAT_DIR_INDEX_ENTRIES
   dirFile->rewind();
   while (1) {
-    curIndex = dirFile->m_curPosition/32;
-    dir = dirFile->readDirCache(true);
-    if (!dir) {
-      if (dirFile->getError()) {
+#if FAT_DIR_INDEX_ENTRIES
+    if (indexScan && !lfnOrd) {
+      // Not in the last candidate, go to the next one.
+      rec = idx->find(rec + 1, lfnHash, sfnHash);
+      if (rec >= 0) {
+        entryIndex = idx->entry(rec);
+      } else if (oflag & O_CREAT) {
+        // Scan all entries to find free entries.
+        indexScan = false;
+        entryIndex = 0;
+        freeFound = 0;
+        fnameFound = false;
+      } else if (idx->done()) {
+        // Every name is in the index.
         DBG_FAIL_MACRO;
         goto fail;
+      } else {
+        // Scan entries not yet in the index.
+        indexScan = false;
+        entryIndex = idx->end();
+      }
+      entryOrd = 0;
+      if (!dirFile->seekSet(32UL*entryIndex)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      seek = true;
+    }
+    curIndex = dirFile->m_curPosition/32;
+    dir = dirFile->readDirCache(!seek);
+    seek = false;
+#else  // FAT_DIR_INDEX_ENTRIES
+    curIndex = dirFile->m_curPosition/32;
+    dir = dirFile->readDirCache(true);
+#endif  // FAT_DIR_INDEX_ENTRIES
+    if (!dir && dirFile->getError()) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+#if FAT_DIR_INDEX_ENTRIES
+    if (!dir || dir->name[0] == DIR_NAME_FREE) {
+      if (indexScan) {
+        lfnOrd = 0;
+        continue;
+      }
+      idx->skip(entryIndex, curIndex);
+      idx->setDone(curIndex);
+    } else if (dir->name[0] != DIR_NAME_DELETED && DIR_IS_LONG_NAME(dir)) {
+      ldir = reinterpret_cast<ldir_t*>(dir);
+      if (ldir->ord & LDIR_ORD_LAST_LONG_ENTRY) {
+        idx->skip(entryIndex, curIndex);
+        entryIndex = curIndex;
+        entryOrd = ldir->ord & 0X1F;
+        entryChksum = ldir->chksum;
+        entryHash = 0;
+      } else if (entryOrd && ldir->ord == entryOrd - 1 &&
+                 ldir->chksum == entryChksum) {
+        entryOrd--;
+      } else {
+        entryOrd = 0;
       }
+      if (entryOrd) {
+        size_t k = 13*(entryOrd - 1);
+        for (uint8_t i = 0; i < 13; i++, k++) {
+          uint16_t u = lfnGetChar(ldir, i);
+          if (u == 0) {
+            break;
+          }
+          entryHash = FatDirIndex::addChar(entryHash, k, lfnToLower(u));
+        }
+      }
+    } else {
+      if (DIR_IS_FILE_OR_SUBDIR(dir) &&
+          dir->name[0] != DIR_NAME_DELETED && dir->name[0] != '.') {
+        idx->add(entryIndex, curIndex,
+                 entryOrd == 1 && lfnChecksum(dir->name) == entryChksum,
+                 entryHash, FatDirIndex::sfnHash(dir->name));
+      } else {
+        idx->skip(entryIndex, curIndex + 1);
+      }
+      entryIndex = curIndex + 1;
+      entryOrd = 0;
+    }
+#endif  // FAT_DIR_INDEX_ENTRIES
+    if (!dir) {
       // At EOF
       goto create;
     }
@@ -487,6 +587,9 @@ create:
 
   // Force write of entry to device.
   dirFile->m_vol->cacheDirty();
+#if FAT_DIR_INDEX_ENTRIES
+  idx->invalidate();
+#endif  // FAT_DIR_INDEX_ENTRIES
 
 open:
   // open entry in cache.
@@ -579,6 +682,16 @@ bool FatFile::remove() {
 
   // Mark entry deleted.
   dir->name[0] = DIR_NAME_DELETED;
+#if FAT_DIR_INDEX_ENTRIES
+  m_vol->dirIndexInvalidate(m_dirCluster);
+  if (m_firstCluster) {
+    // Index of a removed directory.
+    m_vol->dirIndexInvalidate(m_firstCluster);
+  }
+#endif  // FAT_DIR_INDEX_ENTRIES
+#if FAT_PATH_CACHE_ENTRIES
+  m_vol->pathCacheClear();
+#endif  // FAT_PATH_CACHE_ENTRIES
 
   // Set this file closed.
   m_attr = FILE_ATTR_CLOSED;
@@ -265,6 +265,9 @@ bool FatFile::remove() {
   }
   // Mark entry deleted.
   dir->name[0] = DIR_NAME_DELETED;
+#if FAT_PATH_CACHE_ENTRIES
+  m_vol->pathCacheClear();
+#endif  // FAT_PATH_CACHE_ENTRIES
 
   // Set this file closed.
   m_attr = FILE_ATTR_CLOSED;
@@ -48,7 +48,7 @@ class FatFileSystem : public  FatVolume {
   bool begin(BlockDriver* blockDev, uint8_t part = 0) {
     m_blockDev = blockDev;
     vwd()->close();
-    return (part ? init(part) : init(1) || init(0))
+    return (part ? init(part) : init())
             && vwd()->openRoot(this) && FatFile::setCwd(vwd());
   }
 #if ENABLE_ARDUINO_FEATURES
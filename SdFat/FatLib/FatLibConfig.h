@@ -71,6 +71,106 @@
 #endif  // __arm__
 #endif  // USE_SEPARATE_FAT_CACHE
 //------------------------------------------------------------------------------
+/**
+ * Number of 512 byte blocks in each FatCache.  A single block thrashes when
+ * access alternates between two blocks, for example a directory scan while
+ * reading a file or FAT lookups between data blocks.  Each extra block costs
+ * 512 bytes of RAM (twice that with USE_SEPARATE_FAT_CACHE), so the default
+ * is one block.  Set it to 4 on boards with RAM to spare, such as Teensy
+ * 3.5/3.6, to cut the reads for directory scans and FAT lookups.
+ */
+#ifndef FAT_CACHE_BLOCKS
+#define FAT_CACHE_BLOCKS 1
+#endif  // FAT_CACHE_BLOCKS
+//------------------------------------------------------------------------------
+/**
+ * Blocks per set in FatCache.  FAT_CACHE_BLOCKS must be a multiple of this.
+ * Set it equal to FAT_CACHE_BLOCKS for a fully associative cache.
+ */
+#ifndef FAT_CACHE_WAYS
+#define FAT_CACHE_WAYS FAT_CACHE_BLOCKS
+#endif  // FAT_CACHE_WAYS
+//------------------------------------------------------------------------------
+/**
+ * Set FAT_CACHE_USE_CLOCK nonzero to replace cache blocks with the CLOCK
+ * (second chance) algorithm instead of least recently used.
+ */
+#ifndef FAT_CACHE_USE_CLOCK
+#define FAT_CACHE_USE_CLOCK 0
+#endif  // FAT_CACHE_USE_CLOCK
+//------------------------------------------------------------------------------
+/**
+ * Set FAT_CACHE_STATS nonzero to count cache hits and misses.
+ */
+#ifndef FAT_CACHE_STATS
+#define FAT_CACHE_STATS (FAT_CACHE_BLOCKS > 1)
+#endif  // FAT_CACHE_STATS
+#if FAT_CACHE_BLOCKS < 1 || FAT_CACHE_BLOCKS > 32\
+  || FAT_CACHE_BLOCKS % FAT_CACHE_WAYS != 0
+#error FAT_CACHE_BLOCKS must be 1-32 and a multiple of FAT_CACHE_WAYS
+#endif  // FAT_CACHE_BLOCKS
+//------------------------------------------------------------------------------
+/**
+ * Number of FAT blocks whose second FAT copy may be left stale.  A dirty FAT
+ * block written back by the cache normally also writes its mirror.  With
+ * this nonzero the mirror write is put off and all stale mirrors are copied
+ * in ascending block order by the next sync() or close().  When the list is
+ * full the mirror is written with the block as before.  Each entry costs
+ * four bytes of RAM.  Set to zero to always write the mirror at once.
+ */
+#ifndef FAT_MIRROR_DEFER_BLOCKS
+#if defined(__AVR__)
+#define FAT_MIRROR_DEFER_BLOCKS 4
+#else  // __AVR__
+#define FAT_MIRROR_DEFER_BLOCKS 16
+#endif  // __AVR__
+#endif  // FAT_MIRROR_DEFER_BLOCKS
+/**
+ * Number of sync() or close() calls that bring the second FAT up to date.
+ * With one, every sync() copies the stale blocks.  A larger value lets a
+ * program that writes and closes many small files skip most mirror writes.
+ * The list is also copied when it is full and by
+ * FatVolume::syncFatMirror().  Needs FAT_MIRROR_DEFER_BLOCKS.
+ */
+#ifndef FAT_MIRROR_SYNC_INTERVAL
+#define FAT_MIRROR_SYNC_INTERVAL 1
+#endif  // FAT_MIRROR_SYNC_INTERVAL
+//------------------------------------------------------------------------------
+/**
+ * Size in bytes of the StdioStream buffer, at most 65535.  A larger buffer
+ * lets StdioStream::getLineView() return more lines without a copy and
+ * reads the file in larger pieces.  UNGETC_BUF_SIZE bytes are kept for
+ * ungetc() during input.
+ */
+#ifndef STDIO_STREAM_BUF_SIZE
+#define STDIO_STREAM_BUF_SIZE 64
+#endif  // STDIO_STREAM_BUF_SIZE
+//------------------------------------------------------------------------------
+/**
+ * Number of extents (runs of contiguous clusters) each open file remembers.
+ * Extents are found from the FAT chain as a file is read.  Reads then step
+ * through a run without FAT lookups, and multi-block reads can cover a whole
+ * run instead of stopping at each cluster end.  Each extent adds 12 bytes
+ * to every FatFile.  Zero, the default, disables extents.  Four covers most
+ * files on a card that is not badly fragmented.
+ */
+#ifndef FAT_FILE_EXTENT_COUNT
+#define FAT_FILE_EXTENT_COUNT 0
+#endif  // FAT_FILE_EXTENT_COUNT
+//------------------------------------------------------------------------------
+/**
+ * Number of cluster checkpoints each open file keeps for seekSet().  The
+ * cluster number is recorded at evenly spaced points in the file as it is
+ * read or seeked through, and the spacing doubles as the file outgrows the
+ * table.  A backward seek then walks the FAT chain from the nearest
+ * checkpoint instead of from the first cluster.  Each checkpoint adds
+ * 4 bytes to every FatFile.  Zero, the default, disables checkpoints.
+ * Eight is enough for files read with frequent backward seeks.
+ */
+#ifndef FAT_FILE_CHECKPOINT_COUNT
+#define FAT_FILE_CHECKPOINT_COUNT 0
+#endif  // FAT_FILE_CHECKPOINT_COUNT
+//------------------------------------------------------------------------------
 /**
  * Set USE_MULTI_BLOCK_IO non-zero to use multi-block SD read/write.
  *
@@ -93,6 +193,80 @@
 #define MAINTAIN_FREE_CLUSTER_COUNT 0
 #endif  // MAINTAIN_FREE_CLUSTER_COUNT
 //------------------------------------------------------------------------------
+/**
+ * Set USE_FSINFO nonzero to use the FAT32 FSINFO block.  It is read by the
+ * first allocation after mount, not by mount itself, and its next free hint
+ * becomes the allocation search start.  The hint is written back when it
+ * moves to another FAT block.  The FSINFO free count is never used.  After
+ * allocation changes it is marked unknown, and FatVolume::syncFatMirror()
+ * writes the exact count if it is known.
+ */
+#ifndef USE_FSINFO
+#define USE_FSINFO 1
+#endif  // USE_FSINFO
+//------------------------------------------------------------------------------
+/**
+ * Size in bytes of the in-RAM free cluster bitmap.  Each bit covers a group
+ * of clusters, the smallest power of two that fits the volume in the
+ * bitmap.  A clear bit means the group has no free clusters, so allocation
+ * skips it without reading the FAT.  Every group starts out set at mount
+ * and is cleared when allocation finds it full, so the search reads each
+ * full FAT block once and starts at the FSINFO hint, with no scan of the
+ * whole FAT.  After freeClusterCount() has counted the free clusters, the
+ * count is kept up to date and later calls are instant, as with
+ * MAINTAIN_FREE_CLUSTER_COUNT.
+ * Set to zero to disable.
+ */
+#ifndef FAT_FREE_BITMAP_BYTES
+#if defined(__AVR__)
+#define FAT_FREE_BITMAP_BYTES 0
+#else  // __AVR__
+#define FAT_FREE_BITMAP_BYTES 512
+#endif  // __AVR__
+#endif  // FAT_FREE_BITMAP_BYTES
+//------------------------------------------------------------------------------
+/**
+ * Number of names in the in-RAM index of a directory.  The index maps a
+ * hash of each name to the entry where the name starts.  It is built as
+ * open() scans the directory, so later opens in that directory read only
+ * the entries whose hash matches.  Creating or removing a file in the
+ * directory drops its index.  Each name takes 4 bytes, and a long name
+ * takes a second record for its 8.3 alias.  Only used with long file
+ * names.  Zero, the default, disables the index.  256 with two directories
+ * takes 2 KB per volume, so enable it only on boards with RAM to spare.
+ */
+#ifndef FAT_DIR_INDEX_ENTRIES
+#define FAT_DIR_INDEX_ENTRIES 0
+#endif  // FAT_DIR_INDEX_ENTRIES
+//------------------------------------------------------------------------------
+/**
+ * Number of directories indexed at once.  The least recently used index
+ * is replaced.  Opening a path uses an index for each directory in the
+ * path, so two covers a file in a subdirectory of root.
+ */
+#ifndef FAT_DIR_INDEX_DIRS
+#define FAT_DIR_INDEX_DIRS 2
+#endif  // FAT_DIR_INDEX_DIRS
+//------------------------------------------------------------------------------
+/**
+ * Number of recently opened paths each volume remembers.  A cached path
+ * opens its directory entry directly, without walking the directories in
+ * the path, after checking the entry still holds the same file.  Removing
+ * any file or directory clears the cache.  Each path takes
+ * 28 + FAT_PATH_CACHE_LENGTH bytes.  Zero, the default, disables the
+ * cache.  Four paths is a good size on boards with RAM to spare.
+ */
+#ifndef FAT_PATH_CACHE_ENTRIES
+#define FAT_PATH_CACHE_ENTRIES 0
+#endif  // FAT_PATH_CACHE_ENTRIES
+/**
+ * Size of the path stored in each path cache entry.  Paths of this length
+ * or longer are not cached.
+ */
+#ifndef FAT_PATH_CACHE_LENGTH
+#define FAT_PATH_CACHE_LENGTH 64
+#endif  // FAT_PATH_CACHE_LENGTH
+//------------------------------------------------------------------------------
 /**
  * Set DESTRUCTOR_CLOSES_FILE non-zero to close a file in its destructor.
  *
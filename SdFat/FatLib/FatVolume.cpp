@@ -25,23 +25,98 @@
 #include <string.h>
 #include "FatVolume.h"
 //------------------------------------------------------------------------------
+// Return index of block lbn or FAT_CACHE_BLOCKS if not cached.
+uint8_t FatCache::find(uint32_t lbn) {
+  uint8_t i = (lbn % SET_COUNT)*FAT_CACHE_WAYS;
+  for (uint8_t n = 0; n < FAT_CACHE_WAYS; n++, i++) {
+    if (m_lbn[i] == lbn) {
+      return i;
+    }
+  }
+  return FAT_CACHE_BLOCKS;
+}
+//------------------------------------------------------------------------------
+// Choose the block in lbn's set to replace.  Empty blocks go first and the
+// current block is kept if there is any other choice.
+uint8_t FatCache::victim(uint32_t lbn) {
+#if FAT_CACHE_BLOCKS > 1
+  uint8_t set = lbn % SET_COUNT;
+  uint8_t first = set*FAT_CACHE_WAYS;
+  for (uint8_t i = first; i < first + FAT_CACHE_WAYS; i++) {
+    if (m_lbn[i] == 0XFFFFFFFF) {
+      return i;
+    }
+  }
+#if FAT_CACHE_USE_CLOCK
+  // Clear reference bits until an unreferenced block comes round.
+  while (1) {
+    uint8_t i = first + m_hand[set];
+    if (++m_hand[set] == FAT_CACHE_WAYS) {
+      m_hand[set] = 0;
+    }
+    if (i == m_current && FAT_CACHE_WAYS > 1) {
+      continue;
+    }
+    if (!m_used[i]) {
+      return i;
+    }
+    m_used[i] = 0;
+  }
+#else  // FAT_CACHE_USE_CLOCK
+  uint8_t oldest = first;
+  uint16_t oldestAge = 0;
+  for (uint8_t i = first; i < first + FAT_CACHE_WAYS; i++) {
+    uint16_t age = m_tick - m_used[i];
+    if (i != m_current && age >= oldestAge) {
+      oldest = i;
+      oldestAge = age;
+    }
+  }
+  return oldest;
+#endif  // FAT_CACHE_USE_CLOCK
+#else  // FAT_CACHE_BLOCKS > 1
+  (void)lbn;
+  return 0;
+#endif  // FAT_CACHE_BLOCKS > 1
+}
+//------------------------------------------------------------------------------
 cache_t* FatCache::read(uint32_t lbn, uint8_t option) {
-  if (m_lbn != lbn) {
-    if (!sync()) {
+  uint8_t i = find(lbn);
+  if (i >= FAT_CACHE_BLOCKS) {
+#if FAT_CACHE_STATS
+    m_missCount++;
+#endif  // FAT_CACHE_STATS
+    i = victim(lbn);
+    if (!syncBlock(i)) {
       DBG_FAIL_MACRO;
       goto fail;
     }
     if (!(option & CACHE_OPTION_NO_READ)) {
-      if (!m_vol->readBlock(lbn, m_block.data)) {
+      if (!m_vol->readBlock(lbn, m_block[i].data)) {
+        invalidateBlock(i);
         DBG_FAIL_MACRO;
         goto fail;
       }
     }
-    m_status = 0;
-    m_lbn = lbn;
+    m_status[i] = 0;
+    m_lbn[i] = lbn;
+#if FAT_CACHE_STATS
+  } else {
+    m_hitCount++;
+#endif  // FAT_CACHE_STATS
+  }
+#if FAT_CACHE_BLOCKS > 1
+#if FAT_CACHE_USE_CLOCK
+  m_used[i] = 1;
+#else  // FAT_CACHE_USE_CLOCK
+  m_used[i] = ++m_tick;
+#endif  // FAT_CACHE_USE_CLOCK
+#endif  // FAT_CACHE_BLOCKS > 1
+  m_status[i] |= option & CACHE_STATUS_MASK;
+  if (!(option & CACHE_STATUS_MIRROR_FAT)) {
+    m_current = i;
   }
-  m_status |= option & CACHE_STATUS_MASK;
-  return &m_block;
+  return &m_block[i];
 
 fail:
 
@@ -49,29 +124,226 @@ fail:
 }
 //------------------------------------------------------------------------------
 bool FatCache::sync() {
-  if (m_status & CACHE_STATUS_DIRTY) {
-    if (!m_vol->writeBlock(m_lbn, m_block.data)) {
+#if FAT_CACHE_BLOCKS > 1
+  // Write dirty blocks in ascending order.
+  while (1) {
+    uint8_t k = FAT_CACHE_BLOCKS;
+    for (uint8_t i = 0; i < FAT_CACHE_BLOCKS; i++) {
+      if ((m_status[i] & CACHE_STATUS_DIRTY) &&
+          (k == FAT_CACHE_BLOCKS || m_lbn[i] < m_lbn[k])) {
+        k = i;
+      }
+    }
+    if (k == FAT_CACHE_BLOCKS) {
+      break;
+    }
+    if (!syncBlock(k)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+  }
+#else  // FAT_CACHE_BLOCKS > 1
+  if (!syncBlock(0)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+#endif  // FAT_CACHE_BLOCKS > 1
+  return true;
+
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+bool FatCache::sync(uint32_t lbn, size_t count) {
+  for (uint8_t i = 0; i < FAT_CACHE_BLOCKS; i++) {
+    if ((m_lbn[i] - lbn) < count && !syncBlock(i)) {
       DBG_FAIL_MACRO;
       goto fail;
     }
-    // mirror second FAT
-    if (m_status & CACHE_STATUS_MIRROR_FAT) {
-      uint32_t lbn = m_lbn + m_vol->blocksPerFat();
-      if (!m_vol->writeBlock(lbn, m_block.data)) {
+  }
+  return true;
+
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+bool FatCache::syncBlock(uint8_t i) {
+  if (m_status[i] & CACHE_STATUS_DIRTY) {
+    if (!m_vol->writeBlock(m_lbn[i], m_block[i].data)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    // mirror second FAT unless it can wait for sync
+    if ((m_status[i] & CACHE_STATUS_MIRROR_FAT) &&
+        !m_vol->fatMirrorDefer(m_lbn[i])) {
+      uint32_t lbn = m_lbn[i] + m_vol->blocksPerFat();
+      if (!m_vol->writeBlock(lbn, m_block[i].data)) {
         DBG_FAIL_MACRO;
         goto fail;
       }
     }
-    m_status &= ~CACHE_STATUS_DIRTY;
+    m_status[i] &= ~CACHE_STATUS_DIRTY;
+  }
+  return true;
+
+fail:
+  return false;
+}
+#if FAT_MIRROR_DEFER_BLOCKS
+//------------------------------------------------------------------------------
+// Note that the second FAT copy of block lbn is stale.  Return false if
+// the list is full and the mirror must be written now.
+bool FatVolume::fatMirrorDefer(uint32_t lbn) {
+  for (uint8_t i = 0; i < m_fatMirrorCount; i++) {
+    if (m_fatMirror[i] == lbn) {
+      return true;
+    }
+  }
+  if (m_fatMirrorCount >= FAT_MIRROR_DEFER_BLOCKS) {
+    return false;
+  }
+  m_fatMirror[m_fatMirrorCount++] = lbn;
+  return true;
+}
+//------------------------------------------------------------------------------
+// Copy stale blocks to the second FAT in ascending order.  Called after the
+// caches are written so the first FAT holds the current data.
+bool FatVolume::fatMirrorSync(bool force) {
+#if FAT_MIRROR_SYNC_INTERVAL > 1
+  // A full list would make the next FAT writes mirror at once.
+  if (!force && m_fatMirrorCount < FAT_MIRROR_DEFER_BLOCKS &&
+      ++m_fatMirrorSyncs < FAT_MIRROR_SYNC_INTERVAL) {
+    return true;
+  }
+  m_fatMirrorSyncs = 0;
+#else  // FAT_MIRROR_SYNC_INTERVAL > 1
+  (void)force;
+#endif  // FAT_MIRROR_SYNC_INTERVAL > 1
+  while (m_fatMirrorCount) {
+    uint8_t k = 0;
+    for (uint8_t i = 1; i < m_fatMirrorCount; i++) {
+      if (m_fatMirror[i] < m_fatMirror[k]) {
+        k = i;
+      }
+    }
+    uint32_t lbn = m_fatMirror[k];
+    // A fetch may evict a dirty FAT block.  That only appends to the list.
+    cache_t* pc = cacheFetchFat(lbn, FatCache::CACHE_FOR_READ);
+    if (!pc || !writeBlock(lbn + m_blocksPerFat, pc->data)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    m_fatMirror[k] = m_fatMirror[--m_fatMirrorCount];
+  }
+  return fsInfoSync(force);
+
+fail:
+  return false;
+}
+#endif  // FAT_MIRROR_DEFER_BLOCKS
+#if USE_FSINFO
+//------------------------------------------------------------------------------
+// Read FSINFO once per mount.  Its next free hint replaces the search start
+// so the first allocation doesn't scan the FAT from cluster two.
+bool FatVolume::fsInfoLoad() {
+  cache_t* pc;
+  fat32_fsinfo_t* fsi;
+  if (!m_fsInfoBlock || (m_fsInfoState & FSINFO_LOADED)) {
+    return true;
+  }
+  pc = cacheFetchFat(m_fsInfoBlock, FatCache::CACHE_FOR_READ);
+  if (!pc) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  fsi = &pc->fsinfo;
+  m_fsInfoState |= FSINFO_LOADED;
+  if (fsi->leadSignature != FSINFO_LEAD_SIG ||
+      fsi->structSignature != FSINFO_STRUCT_SIG) {
+    // not a valid FSINFO, never write it
+    m_fsInfoBlock = 0;
+    return true;
+  }
+  m_fsInfoCount = fsi->freeCount;
+  m_fsInfoHint = fsi->nextFree;
+  if (m_allocSearchStart < 2 && m_fsInfoHint > 2 &&
+      m_fsInfoHint <= m_lastCluster) {
+    m_allocSearchStart = m_fsInfoHint - 1;
+  }
+  return true;
+
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+// Keep FSINFO correct for other systems with few writes.  After allocation
+// changes the free count is written as unknown, once, and the next free hint
+// only when it moves to another FAT block.  A forced sync writes the count
+// if it is known.
+bool FatVolume::fsInfoSync(bool force) {
+  cache_t* pc;
+  uint32_t count = 0XFFFFFFFF;
+  uint32_t hint;
+  if (!(m_fsInfoState & FSINFO_DIRTY)) {
+    return true;
+  }
+  if (!fsInfoLoad()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (!m_fsInfoBlock) {
+    m_fsInfoState &= ~FSINFO_DIRTY;
+    return true;
+  }
+#if MAINTAIN_FREE_CLUSTER_COUNT || FAT_FREE_BITMAP_BYTES
+  if (force) {
+    count = m_freeClusterCount;
+  }
+#endif  // MAINTAIN_FREE_CLUSTER_COUNT || FAT_FREE_BITMAP_BYTES
+  hint = m_fsInfoNext ? m_fsInfoNext + 1 : m_fsInfoHint;
+  if (hint > m_lastCluster) {
+    // search wraps to the first data cluster
+    hint = 2;
+  }
+  if (count != m_fsInfoCount || (hint >> 7) != (m_fsInfoHint >> 7)) {
+    pc = cacheFetchFat(m_fsInfoBlock, FatCache::CACHE_FOR_READ);
+    if (!pc) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    pc->fsinfo.freeCount = count;
+    pc->fsinfo.nextFree = hint;
+    // cached copy stays clean
+    if (!writeBlock(m_fsInfoBlock, pc->data)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    m_fsInfoCount = count;
+    m_fsInfoHint = hint;
+  }
+  if (force) {
+    m_fsInfoState &= ~FSINFO_DIRTY;
   }
   return true;
 
 fail:
   return false;
 }
+#endif  // USE_FSINFO
 //------------------------------------------------------------------------------
 bool FatVolume::allocateCluster(uint32_t current, uint32_t* next) {
+  // FSINFO may move the search start
+  if (!current && !fsInfoLoad()) {
+    DBG_FAIL_MACRO;
+    return false;
+  }
   uint32_t find = current ? current : m_allocSearchStart;
+#if FAT_FREE_BITMAP_BYTES
+  if (!freeMapFind(find, &find)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+#else  // FAT_FREE_BITMAP_BYTES
   uint32_t start = find;
   while (1) {
     find++;
@@ -94,6 +366,7 @@ bool FatVolume::allocateCluster(uint32_t current, uint32_t* next) {
       goto fail;
     }
   }
+#endif  // FAT_FREE_BITMAP_BYTES
   // mark end of chain
   if (!fatPutEOC(find)) {
     DBG_FAIL_MACRO;
@@ -110,6 +383,7 @@ bool FatVolume::allocateCluster(uint32_t current, uint32_t* next) {
     m_allocSearchStart = find;
   }
   updateFreeClusterCount(-1);
+  fsInfoUpdate(find);
   *next = find;
   return true;
 
@@ -125,6 +399,11 @@ bool FatVolume::allocContiguous(uint32_t count, uint32_t* firstCluster) {
   uint32_t bgnCluster;
   // end of group
   uint32_t endCluster;
+  // FSINFO may move the search start
+  if (!fsInfoLoad()) {
+    DBG_FAIL_MACRO;
+    return false;
+  }
   // Start at cluster after last allocated cluster.
   uint32_t startCluster = m_allocSearchStart;
   endCluster = bgnCluster = startCluster + 1;
@@ -135,6 +414,25 @@ bool FatVolume::allocContiguous(uint32_t count, uint32_t* firstCluster) {
     if (endCluster > m_lastCluster) {
       bgnCluster = endCluster = 2;
     }
+#if FAT_FREE_BITMAP_BYTES
+    if (!freeMapTest(endCluster >> m_freeMapShift)) {
+      // no free clusters in this group, skip to the next one
+      uint32_t groupEnd = (((endCluster >> m_freeMapShift) + 1)
+                           << m_freeMapShift) - 1;
+      if (groupEnd > m_lastCluster) {
+        groupEnd = m_lastCluster;
+      }
+      if (startCluster >= endCluster && startCluster <= groupEnd) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      if (bgnCluster != endCluster) {
+        setStart = false;
+      }
+      bgnCluster = endCluster = groupEnd + 1;
+      continue;
+    }
+#endif  // FAT_FREE_BITMAP_BYTES
     uint32_t f;
     int8_t fg = fatGet(endCluster, &f);
     if (fg < 0) {
@@ -180,6 +478,7 @@ bool FatVolume::allocContiguous(uint32_t count, uint32_t* firstCluster) {
   }
   // Maintain count of free clusters.
   updateFreeClusterCount(-count);
+  fsInfoUpdate(bgnCluster + count - 1);
 
   // return first cluster number to caller
   *firstCluster = bgnCluster;
@@ -273,6 +572,11 @@ bool FatVolume::fatPut(uint32_t cluster, uint32_t value) {
     DBG_FAIL_MACRO;
     goto fail;
   }
+#if FAT_FREE_BITMAP_BYTES
+  if (value == 0) {
+    freeMapSet(cluster);
+  }
+#endif  // FAT_FREE_BITMAP_BYTES
 
   if (fatType() == 32) {
     lba = m_fatStartBlock + (cluster >> 7);
@@ -341,6 +645,9 @@ fail:
 bool FatVolume::freeChain(uint32_t cluster) {
   uint32_t next;
   int8_t fg;
+  if (fatType() == 16 || fatType() == 32) {
+    return freeChainBlocks(cluster);
+  }
   do {
     fg = fatGet(cluster, &next);
     if (fg < 0) {
@@ -354,6 +661,7 @@ bool FatVolume::freeChain(uint32_t cluster) {
     }
     // Add one to count of free clusters.
     updateFreeClusterCount(1);
+    fsInfoUpdate(0);
 
     if (cluster < m_allocSearchStart) {
       m_allocSearchStart = cluster;
@@ -367,16 +675,139 @@ fail:
   return false;
 }
 //------------------------------------------------------------------------------
+// Free a FAT16 or FAT32 chain one FAT block at a time.  Every entry of the
+// chain in a block is cleared with one cache lookup, so a contiguous run
+// costs one fetch per 256 or 128 clusters.
+bool FatVolume::freeChainBlocks(uint32_t cluster) {
+  uint8_t shift = fatType() == 32 ? 7 : 8;
+  uint32_t mask = (1UL << shift) - 1;
+  uint32_t freed = 0;
+  uint32_t next;
+  cache_t* pc;
+  while (1) {
+    if (cluster < 2 || cluster > m_lastCluster) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    uint32_t base = cluster & ~mask;
+    pc = cacheFetchFat(m_fatStartBlock + (cluster >> shift),
+                       FatCache::CACHE_FOR_WRITE);
+    if (!pc) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    // follow the chain while it stays in this block
+    do {
+      if (cluster < m_allocSearchStart) {
+        m_allocSearchStart = cluster;
+      }
+      if (shift == 7) {
+        next = pc->fat32[cluster & mask] & FAT32MASK;
+        pc->fat32[cluster & mask] = 0;
+      } else {
+        next = pc->fat16[cluster & mask];
+        pc->fat16[cluster & mask] = 0;
+      }
+#if FAT_FREE_BITMAP_BYTES
+      freeMapSet(cluster);
+#endif  // FAT_FREE_BITMAP_BYTES
+      freed++;
+      if (isEOC(next)) {
+        updateFreeClusterCount(freed);
+        fsInfoUpdate(0);
+        return true;
+      }
+      cluster = next;
+    } while ((cluster & ~mask) == base && cluster >= 2);
+  }
+
+fail:
+  updateFreeClusterCount(freed);
+  fsInfoUpdate(0);
+  return false;
+}
+//------------------------------------------------------------------------------
+#if FAT_FREE_BITMAP_BYTES
+// Find a free cluster after cluster after, wrapping at the end of the FAT.
+// Groups found to be full are cleared in the bitmap, so it fills in as
+// allocation moves through the FAT instead of with a scan at mount.
+bool FatVolume::freeMapFind(uint32_t after, uint32_t* found) {
+  uint32_t lastGroup = m_lastCluster >> m_freeMapShift;
+  uint32_t from = after + 1;
+  if (from > m_lastCluster) {
+    from = 2;
+  }
+  uint32_t group = from >> m_freeMapShift;
+  // Every group, the first one twice since its start is skipped at first.
+  // Extra for groups past lastGroup in the last word.
+  uint32_t todo = lastGroup + 2 + 32;
+  while (todo) {
+    uint32_t bits = m_freeMap[group >> 5] >> (group & 31);
+    if (!bits) {
+      // rest of the word is zero
+      uint32_t skip = 32 - (group & 31);
+      if (skip >= todo) {
+        break;
+      }
+      todo -= skip;
+      group += skip;
+      if (group > lastGroup) {
+        group = 0;
+      }
+      from = 0;
+      continue;
+    }
+    if (bits & 1) {
+      uint32_t first = group << m_freeMapShift;
+      uint32_t last = first + (1UL << m_freeMapShift) - 1;
+      if (first < 2) {
+        first = 2;
+      }
+      if (last > m_lastCluster) {
+        last = m_lastCluster;
+      }
+      uint32_t c = from > first ? from : first;
+      for (; c <= last; c++) {
+        uint32_t f;
+        int8_t fg = fatGet(c, &f);
+        if (fg < 0) {
+          DBG_FAIL_MACRO;
+          goto fail;
+        }
+        if (fg && f == 0) {
+          *found = c;
+          return true;
+        }
+      }
+      if (from <= first) {
+        // whole group is in use
+        m_freeMap[group >> 5] &= ~(1UL << (group & 31));
+      }
+    }
+    from = 0;
+    todo--;
+    group = group < lastGroup ? group + 1 : 0;
+  }
+
+fail:
+  return false;
+}
+#endif  // FAT_FREE_BITMAP_BYTES
+//------------------------------------------------------------------------------
 int32_t FatVolume::freeClusterCount() {
-#if MAINTAIN_FREE_CLUSTER_COUNT
+#if MAINTAIN_FREE_CLUSTER_COUNT || FAT_FREE_BITMAP_BYTES
   if (m_freeClusterCount >= 0) {
     return m_freeClusterCount;
   }
-#endif  // MAINTAIN_FREE_CLUSTER_COUNT
+#endif  // MAINTAIN_FREE_CLUSTER_COUNT || FAT_FREE_BITMAP_BYTES
   uint32_t free = 0;
   uint32_t lba;
   uint32_t todo = m_lastCluster + 1;
   uint16_t n;
+#if FAT_FREE_BITMAP_BYTES
+  uint32_t cluster = 0;
+  memset(m_freeMap, 0, sizeof(m_freeMap));
+#endif  // FAT_FREE_BITMAP_BYTES
 
   if (FAT12_SUPPORT && fatType() == 12) {
     for (unsigned i = 2; i < todo; i++) {
@@ -388,6 +819,9 @@ int32_t FatVolume::freeClusterCount() {
       }
       if (fg && c == 0) {
         free++;
+#if FAT_FREE_BITMAP_BYTES
+        freeMapSet(i);
+#endif  // FAT_FREE_BITMAP_BYTES
       }
     }
   } else if (fatType() == 16 || fatType() == 32) {
@@ -406,15 +840,24 @@ int32_t FatVolume::freeClusterCount() {
         for (uint16_t i = 0; i < n; i++) {
           if (pc->fat16[i] == 0) {
             free++;
+#if FAT_FREE_BITMAP_BYTES
+            freeMapSet(cluster + i);
+#endif  // FAT_FREE_BITMAP_BYTES
           }
         }
       } else {
         for (uint16_t i = 0; i < n; i++) {
           if (pc->fat32[i] == 0) {
             free++;
+#if FAT_FREE_BITMAP_BYTES
+            freeMapSet(cluster + i);
+#endif  // FAT_FREE_BITMAP_BYTES
           }
         }
       }
+#if FAT_FREE_BITMAP_BYTES
+      cluster += n;
+#endif  // FAT_FREE_BITMAP_BYTES
       todo -= n;
     }
   } else {
@@ -429,7 +872,90 @@ fail:
   return -1;
 }
 //------------------------------------------------------------------------------
+#if FAT_DIR_INDEX_ENTRIES && USE_LONG_FILE_NAMES
+FatDirIndex* FatVolume::dirIndex(uint32_t cluster) {
+  FatDirIndex* idx = 0;
+  m_dirIndexTick++;
+  for (uint8_t i = 0; i < FAT_DIR_INDEX_DIRS; i++) {
+    FatDirIndex* tmp = &m_dirIndex[i];
+    if (tmp->cluster() == cluster) {
+      idx = tmp;
+      goto done;
+    }
+    // Replace an unused index or else the least recently used.
+    if (!idx || (idx->cluster() != 0XFFFFFFFF &&
+                 (tmp->cluster() == 0XFFFFFFFF ||
+                  (uint16_t)(m_dirIndexTick - tmp->m_used) >
+                  (uint16_t)(m_dirIndexTick - idx->m_used)))) {
+      idx = tmp;
+    }
+  }
+  idx->init(cluster);
+
+done:
+  idx->m_used = m_dirIndexTick;
+  return idx;
+}
+#endif  // FAT_DIR_INDEX_ENTRIES && USE_LONG_FILE_NAMES
+//------------------------------------------------------------------------------
+#if FAT_PATH_CACHE_ENTRIES
+// Return the entry for a path or null if it is not cached.
+FatPathCache_t* FatVolume::pathCacheFind(uint32_t start, uint32_t hash,
+                                         const char* path) {
+  for (uint8_t i = 0; i < FAT_PATH_CACHE_ENTRIES; i++) {
+    FatPathCache_t* pc = &m_pathCache[i];
+    if (pc->dirBlock && pc->start == start && pc->hash == hash &&
+        !strcmp(pc->path, path)) {
+      pc->used = ++m_pathCacheTick;
+      return pc;
+    }
+  }
+  return 0;
+}
+//------------------------------------------------------------------------------
+// Return an unused or the least recently used entry.
+FatPathCache_t* FatVolume::pathCacheSlot() {
+  FatPathCache_t* pc = &m_pathCache[0];
+  for (uint8_t i = 1; i < FAT_PATH_CACHE_ENTRIES && pc->dirBlock; i++) {
+    FatPathCache_t* tmp = &m_pathCache[i];
+    if (!tmp->dirBlock || (uint16_t)(m_pathCacheTick - tmp->used) >
+                          (uint16_t)(m_pathCacheTick - pc->used)) {
+      pc = tmp;
+    }
+  }
+  pc->used = ++m_pathCacheTick;
+  return pc;
+}
+#endif  // FAT_PATH_CACHE_ENTRIES
+//------------------------------------------------------------------------------
 bool FatVolume::init(uint8_t part) {
+  m_cache.init(this);
+#if USE_SEPARATE_FAT_CACHE
+  m_fatCache.init(this);
+#endif  // USE_SEPARATE_FAT_CACHE
+#if FAT_MIRROR_DEFER_BLOCKS
+  m_fatMirrorCount = 0;
+#if FAT_MIRROR_SYNC_INTERVAL > 1
+  m_fatMirrorSyncs = 0;
+#endif  // FAT_MIRROR_SYNC_INTERVAL > 1
+#endif  // FAT_MIRROR_DEFER_BLOCKS
+#if FAT_DIR_INDEX_ENTRIES && USE_LONG_FILE_NAMES
+  m_dirIndexTick = 0;
+  for (uint8_t i = 0; i < FAT_DIR_INDEX_DIRS; i++) {
+    m_dirIndex[i].invalidate();
+    m_dirIndex[i].m_used = 0;
+  }
+#endif  // FAT_DIR_INDEX_ENTRIES && USE_LONG_FILE_NAMES
+#if FAT_PATH_CACHE_ENTRIES
+  m_pathCacheTick = 0;
+  pathCacheClear();
+#endif  // FAT_PATH_CACHE_ENTRIES
+  return initFat(part);
+}
+//------------------------------------------------------------------------------
+// Read the MBR and boot sector.  The cache is not cleared so init() can try
+// partition one and then a super floppy with one read of block zero.
+bool FatVolume::initFat(uint8_t part) {
   uint32_t clusterCount;
   uint32_t totalBlocks;
   uint32_t volumeStartBlock = 0;
@@ -438,10 +964,11 @@ bool FatVolume::init(uint8_t part) {
   uint8_t tmp;
   m_fatType = 0;
   m_allocSearchStart = 1;
-  m_cache.init(this);
-#if USE_SEPARATE_FAT_CACHE
-  m_fatCache.init(this);
-#endif  // USE_SEPARATE_FAT_CACHE
+#if USE_FSINFO
+  m_fsInfoBlock = 0;
+  m_fsInfoState = 0;
+  m_fsInfoNext = 0;
+#endif  // USE_FSINFO
   // if part == 0 assume super floppy with FAT boot sector in block zero
   // if part > 0 assume mbr volume with partition table
   if (part) {
@@ -510,6 +1037,18 @@ bool FatVolume::init(uint8_t part) {
 
   // Indicate unknown number of free clusters.
   setFreeClusterCount(-1);
+#if FAT_FREE_BITMAP_BYTES
+  m_freeMapShift = 0;
+  while ((m_lastCluster >> m_freeMapShift) >= 8UL*FAT_FREE_BITMAP_BYTES) {
+    m_freeMapShift++;
+  }
+  // Every group may have a free cluster until allocation finds it full.
+  memset(m_freeMap, 0, sizeof(m_freeMap));
+  for (uint32_t group = 0; group <= (m_lastCluster >> m_freeMapShift);
+       group++) {
+    m_freeMap[group >> 5] |= 1UL << (group & 31);
+  }
+#endif  // FAT_FREE_BITMAP_BYTES
   // FAT type is determined by cluster count
   if (clusterCount < 4085) {
     m_fatType = 12;
@@ -522,6 +1061,12 @@ bool FatVolume::init(uint8_t part) {
   } else {
     m_rootDirStart = fbs->fat32RootCluster;
     m_fatType = 32;
+#if USE_FSINFO
+    // read by the first allocation or sync that needs it
+    if (fbs->fat32FSInfo) {
+      m_fsInfoBlock = volumeStartBlock + fbs->fat32FSInfo;
+    }
+#endif  // USE_FSINFO
   }
   return true;
 
@@ -588,8 +1133,9 @@ bool FatVolume::wipe(print_t* pr) {
     goto fail;
   }
   if (fatType() == 32) {
-    // Reserve root cluster.
-    if (!fatPutEOC(m_rootDirStart) || !cacheSync()) {
+    // Reserve root cluster.  Force the mirror, clearing m_fatType below
+    // drops any copy to the second FAT that is still pending.
+    if (!fatPutEOC(m_rootDirStart) || !syncFatMirror()) {
       DBG_FAIL_MACRO;
       goto fail;
     }
@@ -92,6 +92,17 @@ union cache_t {
 /**
  * \class FatCache
  * \brief Block cache.
+ *
+ * Holds FAT_CACHE_BLOCKS blocks split into sets of FAT_CACHE_WAYS blocks.
+ * A block may only live in set (lbn % number of sets) and the least
+ * recently used block of the set is replaced, or the next one without its
+ * reference bit if FAT_CACHE_USE_CLOCK is nonzero.
+ *
+ * block(), dirty() and lbn() refer to the current block, the one returned
+ * by the last read() that was not a FAT read.  The current block is not
+ * replaced by a FAT read unless it is the only choice, so callers that fetch
+ * a directory block and then look up the FAT see the same behavior as with
+ * the single block cache.
  */
 class FatCache {
  public:
@@ -113,48 +124,276 @@ class FatCache {
     = CACHE_STATUS_DIRTY | CACHE_OPTION_NO_READ;
   /** \return Cache block address. */
   cache_t* block() {
-    return &m_block;
+    return &m_block[m_current];
   }
   /** Set current block dirty. */
   void dirty() {
-    m_status |= CACHE_STATUS_DIRTY;
+    m_status[m_current] |= CACHE_STATUS_DIRTY;
   }
   /** Initialize the cache.
    * \param[in] vol FatVolume that owns this FatCache.
    */
   void init(FatVolume *vol) {
     m_vol = vol;
+    m_current = 0;
+#if FAT_CACHE_BLOCKS > 1
+    m_tick = 0;
+#if FAT_CACHE_USE_CLOCK
+    for (uint8_t i = 0; i < SET_COUNT; i++) {
+      m_hand[i] = 0;
+    }
+#endif  // FAT_CACHE_USE_CLOCK
+#endif  // FAT_CACHE_BLOCKS > 1
+#if FAT_CACHE_STATS
+    resetStats();
+#endif  // FAT_CACHE_STATS
     invalidate();
   }
-  /** Invalidate current cache block. */
+  /** Invalidate all cache blocks. */
   void invalidate() {
-    m_status = 0;
-    m_lbn = 0XFFFFFFFF;
+    for (uint8_t i = 0; i < FAT_CACHE_BLOCKS; i++) {
+      invalidateBlock(i);
+    }
+  }
+  /** Invalidate cached copies of a range of blocks.
+   * \param[in] lbn First block of the range.
+   * \param[in] count Number of blocks in the range.
+   */
+  void invalidate(uint32_t lbn, size_t count) {
+    for (uint8_t i = 0; i < FAT_CACHE_BLOCKS; i++) {
+      if ((m_lbn[i] - lbn) < count) {
+        invalidateBlock(i);
+      }
+    }
   }
   /** \return dirty status */
   bool isDirty() {
-    return m_status & CACHE_STATUS_DIRTY;
+    return m_status[m_current] & CACHE_STATUS_DIRTY;
+  }
+  /** \return true if a block is in the cache.
+   * \param[in] lbn Block to look for.
+   */
+  bool isCached(uint32_t lbn) {
+    return find(lbn) < FAT_CACHE_BLOCKS;
   }
   /** \return Logical block number for cached block. */
   uint32_t lbn() {
-    return m_lbn;
+    return m_lbn[m_current];
   }
   /** Read a block into the cache.
    * \param[in] lbn Block to read.
    * \param[in] option mode for cached block.
    * \return Address of cached block. */
   cache_t* read(uint32_t lbn, uint8_t option);
-  /** Write current block if dirty.
+  /** Write all dirty blocks.
    * \return true for success else false.
    */
   bool sync();
+  /** Write dirty cached copies of a range of blocks.
+   * \param[in] lbn First block of the range.
+   * \param[in] count Number of blocks in the range.
+   * \return true for success else false.
+   */
+  bool sync(uint32_t lbn, size_t count);
+#if FAT_CACHE_STATS
+  /** \return Number of reads found in the cache. */
+  uint32_t hitCount() const {
+    return m_hitCount;
+  }
+  /** \return Number of reads that went to the block device. */
+  uint32_t missCount() const {
+    return m_missCount;
+  }
+  /** Zero the hit and miss counts. */
+  void resetStats() {
+    m_hitCount = 0;
+    m_missCount = 0;
+  }
+#endif  // FAT_CACHE_STATS
 
  private:
-  uint8_t m_status;
+  static const uint8_t SET_COUNT = FAT_CACHE_BLOCKS/FAT_CACHE_WAYS;
+  uint8_t find(uint32_t lbn);
+  void invalidateBlock(uint8_t i) {
+    m_status[i] = 0;
+    m_lbn[i] = 0XFFFFFFFF;
+  }
+  bool syncBlock(uint8_t i);
+  uint8_t victim(uint32_t lbn);
+
+  uint8_t m_current;
+  uint8_t m_status[FAT_CACHE_BLOCKS];
   FatVolume* m_vol;
-  uint32_t m_lbn;
-  cache_t m_block;
+  uint32_t m_lbn[FAT_CACHE_BLOCKS];
+#if FAT_CACHE_BLOCKS > 1
+  uint16_t m_tick;
+#if FAT_CACHE_USE_CLOCK
+  uint8_t m_hand[SET_COUNT];
+#endif  // FAT_CACHE_USE_CLOCK
+  // LRU: value of m_tick at last use.  CLOCK: reference bit.
+  uint16_t m_used[FAT_CACHE_BLOCKS];
+#endif  // FAT_CACHE_BLOCKS > 1
+#if FAT_CACHE_STATS
+  uint32_t m_hitCount;
+  uint32_t m_missCount;
+#endif  // FAT_CACHE_STATS
+  cache_t m_block[FAT_CACHE_BLOCKS];
 };
+#if FAT_DIR_INDEX_ENTRIES && USE_LONG_FILE_NAMES
+//==============================================================================
+/**
+ * \class FatDirIndex
+ * \brief Name hash index for one directory.
+ *
+ * Records are added in directory order as open() reads entries at end(),
+ * so each scan extends the index.  A record is only a hint, the entry it
+ * points to is compared with the name before it is used.
+ */
+class FatDirIndex {
+ public:
+  /** Add one character to a name hash.  The result does not depend on the
+   * order characters are added, so long name entries may be hashed as
+   * they are read, last part first.
+   * \param[in] hash Hash of other characters.
+   * \param[in] k Position of the character in the name.
+   * \param[in] c The character.
+   * \return The new hash.
+   */
+  static uint16_t addChar(uint16_t hash, uint8_t k, uint8_t c) {
+    uint16_t t = (c ^ (37*k))*0X9E37;
+    return hash + (t ^ (t >> 7));
+  }
+  /** \return Hash of an 8.3 directory entry name.
+   * \param[in] sfn The 11 byte name.
+   */
+  static uint16_t sfnHash(const uint8_t* sfn) {
+    uint16_t hash = 0;
+    for (uint8_t k = 0; k < 11; k++) {
+      hash = addChar(hash, k, sfn[k]);
+    }
+    return hash;
+  }
+  /** Record a name that starts at end().
+   * \param[in] first Index of the first entry for the name.
+   * \param[in] index Index of the 8.3 entry for the name.
+   * \param[in] lfn True if entries first to index - 1 hold a long name.
+   * \param[in] lfnHash Hash of the long name.
+   * \param[in] sfnHash Hash of the 8.3 name.
+   */
+  void add(uint16_t first, uint16_t index, bool lfn,
+           uint16_t lfnHash, uint16_t sfnHash) {
+    if (first != m_end || m_count + (lfn ? 2 : 1) > FAT_DIR_INDEX_ENTRIES) {
+      return;
+    }
+    if (lfn) {
+      m_hash[m_count] = lfnHash;
+      m_entry[m_count++] = first;
+    }
+    // Opening by the 8.3 alias starts at the 8.3 entry, as in a full scan.
+    m_hash[m_count] = sfnHash;
+    m_entry[m_count++] = index;
+    m_end = index + 1;
+  }
+  /** \return The directory's first cluster. */
+  uint32_t cluster() const {
+    return m_cluster;
+  }
+  /** \return True if every entry in the directory is in the index. */
+  bool done() const {
+    return m_done;
+  }
+  /** \return Index of the first entry not in the index. */
+  uint16_t end() const {
+    return m_end;
+  }
+  /** \return Entry index for a record.
+   * \param[in] i The record.
+   */
+  uint16_t entry(uint16_t i) const {
+    return m_entry[i];
+  }
+  /** Find the next record that matches either of two hashes.
+   * \param[in] i First record to check.
+   * \param[in] h1 First hash.
+   * \param[in] h2 Second hash.
+   * \return The matching record or -1 if none.
+   */
+  int16_t find(uint16_t i, uint16_t h1, uint16_t h2) const {
+    for (; i < m_count; i++) {
+      if (m_hash[i] == h1 || m_hash[i] == h2) {
+        return i;
+      }
+    }
+    return -1;
+  }
+  /** Start an empty index.
+   * \param[in] cluster The directory's first cluster.
+   */
+  void init(uint32_t cluster) {
+    m_cluster = cluster;
+    m_count = 0;
+    m_end = 0;
+    m_done = false;
+  }
+  /** Mark the index unused. */
+  void invalidate() {
+    m_cluster = 0XFFFFFFFF;
+  }
+  /** Mark the end of the directory.
+   * \param[in] index Index of the first free entry or entry count.
+   */
+  void setDone(uint16_t index) {
+    if (index == m_end) {
+      m_done = true;
+    }
+  }
+  /** Step over entries that hold no name.
+   * \param[in] first Index of the first entry.
+   * \param[in] next Index of the entry after the last entry.
+   */
+  void skip(uint16_t first, uint16_t next) {
+    if (first == m_end) {
+      m_end = next;
+    }
+  }
+ private:
+  friend class FatVolume;
+  bool m_done;
+  uint16_t m_used;  // m_dirIndexTick at last use.
+  uint16_t m_count;
+  uint16_t m_end;
+  uint32_t m_cluster;
+  uint16_t m_hash[FAT_DIR_INDEX_ENTRIES];
+  uint16_t m_entry[FAT_DIR_INDEX_ENTRIES];
+};
+#endif  // FAT_DIR_INDEX_ENTRIES && USE_LONG_FILE_NAMES
+#if FAT_PATH_CACHE_ENTRIES
+//------------------------------------------------------------------------------
+/**
+ * \struct FatPathCache_t
+ * \brief Directory entry for a recently opened path.
+ */
+struct FatPathCache_t {
+  /** Block with the directory entry, zero if unused. */
+  uint32_t dirBlock;
+  /** First cluster of the directory the path starts in. */
+  uint32_t start;
+  /** Hash of the path. */
+  uint32_t hash;
+  /** First cluster of the directory that holds the entry. */
+  uint32_t dirCluster;
+  /** First cluster of the file, checked against the entry. */
+  uint32_t firstCluster;
+  /** Index of the entry in its directory. */
+  uint16_t dirIndex;
+  /** Value of m_pathCacheTick at last use. */
+  uint16_t used;
+  /** Number of long name entries before the entry. */
+  uint8_t lfnOrd;
+  /** The path, compared on a hash match. */
+  char path[FAT_PATH_CACHE_LENGTH];
+};
+#endif  // FAT_PATH_CACHE_ENTRIES
 //==============================================================================
 /**
  * \class FatVolume
@@ -220,7 +459,7 @@ class FatVolume {
    * the value false is returned for failure.
    */
   bool init() {
-    return init(1) || init(0);
+    return init(1) || initFat(0);
   }
   /** Initialize a FAT volume.
 
@@ -242,6 +481,16 @@ class FatVolume {
   uint32_t rootDirStart() const {
     return m_rootDirStart;
   }
+  /** Write all cached blocks and bring the second FAT up to date even if
+   * FAT_MIRROR_SYNC_INTERVAL would let it wait.  With USE_FSINFO the known
+   * free count is also written to FSINFO.  Call before the card is removed.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool syncFatMirror() {
+    return cacheSync() && fatMirrorSync(true) && syncBlocks();
+  }
   /** \return The number of blocks in the volume */
   uint32_t volumeBlockCount() const {
     return blocksPerCluster()*clusterCount();
@@ -260,6 +509,31 @@ class FatVolume {
   int8_t dbgFat(uint32_t n, uint32_t* v) {
     return fatGet(n, v);
   }
+#if FAT_CACHE_STATS
+  /** \return Number of block reads satisfied by the cache. */
+  uint32_t cacheHitCount() const {
+#if USE_SEPARATE_FAT_CACHE
+    return m_cache.hitCount() + m_fatCache.hitCount();
+#else  // USE_SEPARATE_FAT_CACHE
+    return m_cache.hitCount();
+#endif  // USE_SEPARATE_FAT_CACHE
+  }
+  /** \return Number of block reads that missed the cache. */
+  uint32_t cacheMissCount() const {
+#if USE_SEPARATE_FAT_CACHE
+    return m_cache.missCount() + m_fatCache.missCount();
+#else  // USE_SEPARATE_FAT_CACHE
+    return m_cache.missCount();
+#endif  // USE_SEPARATE_FAT_CACHE
+  }
+  /** Zero the cache hit and miss counts. */
+  void cacheResetStats() {
+    m_cache.resetStats();
+#if USE_SEPARATE_FAT_CACHE
+    m_fatCache.resetStats();
+#endif  // USE_SEPARATE_FAT_CACHE
+  }
+#endif  // FAT_CACHE_STATS
 //------------------------------------------------------------------------------
  private:
   // Allow FatFile and FatCache access to FatVolume private functions.
@@ -298,7 +572,7 @@ class FatVolume {
     return m_blockDev->writeBlocks(block, src, nb);
   }
 #endif  // USE_MULTI_BLOCK_IO
-#if MAINTAIN_FREE_CLUSTER_COUNT
+#if MAINTAIN_FREE_CLUSTER_COUNT || FAT_FREE_BITMAP_BYTES
   int32_t  m_freeClusterCount;     // Count of free clusters in volume.
   void setFreeClusterCount(int32_t value) {
     m_freeClusterCount = value;
@@ -316,6 +590,90 @@ class FatVolume {
     (void)change;
   }
 #endif  // MAINTAIN_FREE_CLUSTER_COUNT
+#if USE_FSINFO
+  static const uint8_t FSINFO_LOADED = 1;
+  static const uint8_t FSINFO_DIRTY = 2;
+  uint8_t  m_fsInfoState;
+  uint32_t m_fsInfoBlock;          // FAT32 FSINFO block, zero if none.
+  uint32_t m_fsInfoNext;           // Last cluster allocated, zero if none.
+  uint32_t m_fsInfoCount;          // Free count in the FSINFO block.
+  uint32_t m_fsInfoHint;           // Next free hint in the FSINFO block.
+  bool fsInfoLoad();
+  bool fsInfoSync(bool force);
+  void fsInfoUpdate(uint32_t allocated) {
+    if (allocated) {
+      m_fsInfoNext = allocated;
+    }
+    m_fsInfoState |= FSINFO_DIRTY;
+  }
+#else  // USE_FSINFO
+  bool fsInfoLoad() {
+    return true;
+  }
+  bool fsInfoSync(bool force) {
+    (void)force;
+    return true;
+  }
+  void fsInfoUpdate(uint32_t allocated) {
+    (void)allocated;
+  }
+#endif  // USE_FSINFO
+#if FAT_FREE_BITMAP_BYTES
+  // Bit n is set if clusters n << m_freeMapShift ... ((n + 1) << shift) - 1
+  // may include a free cluster.
+  uint8_t  m_freeMapShift;
+  uint32_t m_freeMap[(FAT_FREE_BITMAP_BYTES + 3)/4];
+  bool freeMapFind(uint32_t after, uint32_t* found);
+  void freeMapSet(uint32_t cluster) {
+    uint32_t group = cluster >> m_freeMapShift;
+    m_freeMap[group >> 5] |= 1UL << (group & 31);
+  }
+  bool freeMapTest(uint32_t group) const {
+    return m_freeMap[group >> 5] & (1UL << (group & 31));
+  }
+#endif  // FAT_FREE_BITMAP_BYTES
+#if FAT_DIR_INDEX_ENTRIES && USE_LONG_FILE_NAMES
+  uint16_t m_dirIndexTick;
+  FatDirIndex m_dirIndex[FAT_DIR_INDEX_DIRS];
+  FatDirIndex* dirIndex(uint32_t cluster);
+  void dirIndexInvalidate(uint32_t cluster) {
+    for (uint8_t i = 0; i < FAT_DIR_INDEX_DIRS; i++) {
+      if (m_dirIndex[i].cluster() == cluster) {
+        m_dirIndex[i].invalidate();
+      }
+    }
+  }
+#endif  // FAT_DIR_INDEX_ENTRIES && USE_LONG_FILE_NAMES
+#if FAT_PATH_CACHE_ENTRIES
+  uint16_t m_pathCacheTick;
+  FatPathCache_t m_pathCache[FAT_PATH_CACHE_ENTRIES];
+  FatPathCache_t* pathCacheFind(uint32_t start, uint32_t hash,
+                                const char* path);
+  FatPathCache_t* pathCacheSlot();
+  void pathCacheClear() {
+    for (uint8_t i = 0; i < FAT_PATH_CACHE_ENTRIES; i++) {
+      m_pathCache[i].dirBlock = 0;
+    }
+  }
+#endif  // FAT_PATH_CACHE_ENTRIES
+
+#if FAT_MIRROR_DEFER_BLOCKS
+  uint8_t m_fatMirrorCount;
+#if FAT_MIRROR_SYNC_INTERVAL > 1
+  uint8_t m_fatMirrorSyncs;
+#endif  // FAT_MIRROR_SYNC_INTERVAL > 1
+  uint32_t m_fatMirror[FAT_MIRROR_DEFER_BLOCKS];
+  bool fatMirrorDefer(uint32_t lbn);
+  bool fatMirrorSync(bool force = false);
+#else  // FAT_MIRROR_DEFER_BLOCKS
+  bool fatMirrorDefer(uint32_t lbn) {
+    (void)lbn;
+    return false;
+  }
+  bool fatMirrorSync(bool force = false) {
+    return fsInfoSync(force);
+  }
+#endif  // FAT_MIRROR_DEFER_BLOCKS
 
 // block caches
   FatCache m_cache;
@@ -326,7 +684,8 @@ class FatVolume {
                            options | FatCache::CACHE_STATUS_MIRROR_FAT);
   }
   bool cacheSync() {
-    return m_cache.sync() && m_fatCache.sync() && syncBlocks();
+    return m_cache.sync() && m_fatCache.sync() && fatMirrorSync() &&
+           syncBlocks();
   }
 #else  //
   cache_t* cacheFetchFat(uint32_t blockNumber, uint8_t options) {
@@ -334,7 +693,7 @@ class FatVolume {
                           options | FatCache::CACHE_STATUS_MIRROR_FAT);
   }
   bool cacheSync() {
-    return m_cache.sync() && syncBlocks();
+    return m_cache.sync() && fatMirrorSync() && syncBlocks();
   }
 #endif  // USE_SEPARATE_FAT_CACHE
   cache_t* cacheFetchData(uint32_t blockNumber, uint8_t options) {
@@ -343,9 +702,20 @@ class FatVolume {
   void cacheInvalidate() {
     m_cache.invalidate();
   }
+  // Drop cached copies of blocks about to be overwritten by a direct write.
+  void cacheInvalidate(uint32_t blockNumber, size_t count) {
+    m_cache.invalidate(blockNumber, count);
+  }
+  bool cacheIsCached(uint32_t blockNumber) {
+    return m_cache.isCached(blockNumber);
+  }
   bool cacheSyncData() {
     return m_cache.sync();
   }
+  // Write back cached blocks about to be read by a direct read.
+  bool cacheSyncData(uint32_t blockNumber, size_t count) {
+    return m_cache.sync(blockNumber, count);
+  }
   cache_t *cacheAddress() {
     return m_cache.block();
   }
@@ -368,6 +738,8 @@ class FatVolume {
     return fatPut(cluster, 0x0FFFFFFF);
   }
   bool freeChain(uint32_t cluster);
+  bool freeChainBlocks(uint32_t cluster);
+  bool initFat(uint8_t part);
   bool isEOC(uint32_t cluster) const {
     return cluster > m_lastCluster;
   }
@@ -94,6 +94,24 @@ char* StdioStream::fgets(char* str, size_t num, size_t* len) {
   return str;
 }
 //------------------------------------------------------------------------------
+const char* StdioStream::getLineView(size_t* len, char* buf, size_t size) {
+  uint8_t* end;
+  const char* line;
+  if (m_r == 0 && !fillBuf()) {
+    return 0;
+  }
+  end = reinterpret_cast<uint8_t*>(memchr(m_p, '\n', m_r));
+  if (!end) {
+    // line crosses the end of the buffer
+    return fgets(buf, size, len);
+  }
+  line = reinterpret_cast<const char*>(m_p);
+  *len = ++end - m_p;
+  m_r -= *len;
+  m_p = end;
+  return line;
+}
+//------------------------------------------------------------------------------
 bool StdioStream::fopen(const char* path, const char* mode) {
   uint8_t oflag;
   switch (*mode++) {
@@ -493,7 +511,7 @@ bool StdioStream::flushBuf() {
     m_p = m_buf;
     return true;
   }
-  uint8_t n = m_p - m_buf;
+  uint16_t n = m_p - m_buf;
   m_p = m_buf;
   m_w = sizeof(m_buf);
   if (FatFile::write(m_buf, n) == n) {
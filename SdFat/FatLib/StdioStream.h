@@ -34,7 +34,7 @@
 /** Total size of stream buffer. The entire buffer is used for output.
   * During input UNGETC_BUF_SIZE of this space is reserved for ungetc.
   */
-const uint8_t STREAM_BUF_SIZE = 64;
+const uint16_t STREAM_BUF_SIZE = STDIO_STREAM_BUF_SIZE;
 /** Amount of buffer allocated for ungetc during input. */
 const uint8_t UNGETC_BUF_SIZE = 2;
 //------------------------------------------------------------------------------
@@ -199,6 +199,27 @@ class StdioStream : private FatFile {
    */
   char* fgets(char* str, size_t num, size_t* len = 0);
   //----------------------------------------------------------------------------
+  /** Get a line, without a copy if it is in the stream buffer.
+   *
+   * A line that ends in the stream buffer is returned as a pointer into
+   * the buffer and is not null terminated.  A line that crosses the end of
+   * the buffer is read into \a buf by fgets(), so a line longer than
+   * \a size - 1 is returned in pieces.  The new-line is retained.
+   *
+   * The line is valid until the next call that reads, writes or positions
+   * the stream.
+   *
+   * \param[out] len Length of the line.
+   *
+   * \param[out] buf Array for a line that crosses the end of the buffer.
+   *
+   * \param[in] size Size of \a buf.
+   *
+   * \return Pointer to the line, or a null pointer at end-of-file or if an
+   * error occurs.
+   */
+  const char* getLineView(size_t* len, char* buf, size_t size);
+  //----------------------------------------------------------------------------
   /** Open a stream.
    *
    * Open a file and associates the stream with it.
@@ -659,8 +680,13 @@ class StdioStream : private FatFile {
   //----------------------------------------------------------------------------
   uint8_t  m_flags;
   uint8_t* m_p;
+#if STDIO_STREAM_BUF_SIZE > 255
+  uint16_t m_r;
+  uint16_t m_w;
+#else  // STDIO_STREAM_BUF_SIZE > 255
   uint8_t  m_r;
   uint8_t  m_w;
+#endif  // STDIO_STREAM_BUF_SIZE > 255
   uint8_t  m_buf[STREAM_BUF_SIZE];
 };
 //------------------------------------------------------------------------------
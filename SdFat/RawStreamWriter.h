@@ -0,0 +1,211 @@
+/**
+ * Copyright (c) 2011-2018 Bill Greiman
+ * This file is part of the SdFat library for SD memory cards.
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef RawStreamWriter_h
+#define RawStreamWriter_h
+/**
+ * \file
+ * \brief RawStreamWriter class
+ */
+#include "FatLib/FatFile.h"
+//------------------------------------------------------------------------------
+/**
+ * \class RawStreamWriter
+ * \brief Append 512 byte blocks to a contiguous file in one multi-block
+ * write.
+ *
+ * The file must have been created with FatFile::createContiguous().  The
+ * card is kept in a single write sequence so writeBlock() only moves data.
+ * No FAT, directory or cache block is touched until checkpoint() or close()
+ * records the size.  Data written after the last checkpoint is lost if
+ * power fails.
+ *
+ * CardClass is the card type returned by SdFat::card() or SdFatSdio::card(),
+ * for example SdSpiCard or SdioCard.  Don't access the volume while the
+ * writer is open.
+ *
+ * SdioCard ends a write sequence after the block count given to
+ * writeStart(), which can be at most 0XFFFF, so a new sequence is started
+ * every RUN_BLOCKS blocks.
+ */
+template<class CardClass>
+class RawStreamWriter {
+ public:
+  RawStreamWriter() : m_card(0), m_file(0), m_writing(false) {}
+  /** Start a write sequence at the beginning of a contiguous file.
+   *
+   * The directory entry is set to zero length.  The space allocated by
+   * createContiguous(), rounded up to whole clusters, is available.
+   *
+   * \param[in] card The card that holds the file.
+   * \param[in] file An open contiguous file.
+   * \param[in] checkpointBlocks Call checkpoint() from writeBlock() every
+   *            \a checkpointBlocks blocks. Zero for no automatic checkpoint.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool begin(CardClass* card, FatFile* file, uint32_t checkpointBlocks = 0) {
+    uint32_t bgnBlock, endBlock;
+    if (isOpen() || !file->contiguousRange(&bgnBlock, &endBlock) ||
+        !file->syncContiguous(0)) {
+      return false;
+    }
+    m_card = card;
+    m_file = file;
+    m_firstBlock = bgnBlock;
+    m_maxBlocks = endBlock - bgnBlock + 1;
+    // size must fit in the directory entry
+    if (m_maxBlocks > (0XFFFFFFFF >> 9)) {
+      m_maxBlocks = 0XFFFFFFFF >> 9;
+    }
+    m_blockCount = 0;
+    m_checkpointBlocks = checkpointBlocks;
+    m_checkpointLeft = checkpointBlocks;
+    return startWrite();
+  }
+  /** \return Number of blocks written. */
+  uint32_t blockCount() const {
+    return m_blockCount;
+  }
+  /** Record the size of the data written so far.  The write sequence is
+   * stopped, the directory entry is written and a new sequence is started
+   * for the rest of the file.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool checkpoint() {
+    if (!isOpen() || !stopWrite() ||
+        !m_file->syncContiguous(m_blockCount << 9)) {
+      return false;
+    }
+    return m_blockCount < m_maxBlocks ? startWrite() : true;
+  }
+  /** Stop the write sequence and record the file size.  The file is not
+   * closed.
+   *
+   * \param[in] freeUnused Free the clusters past the data written.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool close(bool freeUnused = true) {
+    if (!isOpen()) {
+      return true;
+    }
+    bool rtn = stopWrite();
+    if (!m_file->syncContiguous(m_blockCount << 9) ||
+        (freeUnused && !m_file->truncate(m_blockCount << 9))) {
+      rtn = false;
+    }
+    m_file = 0;
+    return rtn;
+  }
+  /** \return Number of blocks that can still be written. */
+  uint32_t freeBlocks() const {
+    return m_maxBlocks - m_blockCount;
+  }
+  /** Check for a busy card.  Calling writeBlock() only when this is false
+   * keeps the time spent in writeBlock() to the block transfer.
+   *
+   * \return true if the card is busy.
+   */
+  bool isBusy() {
+    return m_writing && m_card->isBusy();
+  }
+  /** \return true if the writer is open. */
+  bool isOpen() const {
+    return m_file != 0;
+  }
+  /** Append a block to the file.
+   *
+   * \param[in] src Pointer to the 512 bytes to be written.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool writeBlock(const uint8_t* src) {
+    if (!m_writing || m_blockCount >= m_maxBlocks ||
+        !m_card->writeData(src)) {
+      return false;
+    }
+    m_blockCount++;
+    m_runLeft--;
+    if (m_checkpointBlocks && --m_checkpointLeft == 0) {
+      m_checkpointLeft = m_checkpointBlocks;
+      return checkpoint();
+    }
+    if (m_runLeft == 0 && m_blockCount < m_maxBlocks) {
+      return stopWrite() && startWrite();
+    }
+    return true;
+  }
+  /** Append blocks to the file.
+   *
+   * \param[in] src Pointer to the data to be written.
+   * \param[in] count Number of 512 byte blocks to be written.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool writeBlocks(const uint8_t* src, size_t count) {
+    for (size_t i = 0; i < count; i++, src += 512) {
+      if (!writeBlock(src)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  /** Largest block count for one write sequence. */
+  static const uint32_t RUN_BLOCKS = 0XFFFF;
+  bool startWrite() {
+    // the card can pre-erase the rest of the run
+    m_runLeft = m_maxBlocks - m_blockCount;
+    if (m_runLeft > RUN_BLOCKS) {
+      m_runLeft = RUN_BLOCKS;
+    }
+    m_writing = m_card->writeStart(m_firstBlock + m_blockCount, m_runLeft);
+    return m_writing;
+  }
+  bool stopWrite() {
+    if (!m_writing) {
+      return true;
+    }
+    m_writing = false;
+    return m_card->writeStop();
+  }
+  CardClass* m_card;
+  FatFile* m_file;
+  bool m_writing;
+  uint32_t m_firstBlock;
+  uint32_t m_maxBlocks;
+  uint32_t m_blockCount;
+  uint32_t m_checkpointBlocks;
+  uint32_t m_checkpointLeft;
+  uint32_t m_runLeft;
+};
+#endif  // RawStreamWriter_h
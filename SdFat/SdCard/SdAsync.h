@@ -0,0 +1,124 @@
+/**
+ * Copyright (c) 2011-2018 Bill Greiman
+ * This file is part of the SdFat library for SD memory cards.
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SdAsync_h
+#define SdAsync_h
+/**
+ * \file
+ * \brief Request queue for asynchronous block I/O
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include "SdFatConfig.h"
+//------------------------------------------------------------------------------
+/** Completion callback for readBlocksAsync() and writeBlocksAsync().
+ *
+ * \param[in] context The context pointer passed with the request.
+ * \param[in] ok true if the transfer succeeded, false if it failed.
+ */
+typedef void (*SdAsyncCallback)(void* context, bool ok);
+//------------------------------------------------------------------------------
+/**
+ * \struct SdAsyncRequest
+ * \brief One queued asynchronous block transfer.
+ */
+struct SdAsyncRequest {
+  /** Next block to transfer. */
+  uint32_t block;
+  /** Data for the next block. */
+  uint8_t* buf;
+  /** Blocks left to transfer. */
+  size_t count;
+  /** True for a write, false for a read. */
+  bool write;
+  /** Called when the request completes, may be null. */
+  SdAsyncCallback callback;
+  /** Passed to callback. */
+  void* context;
+};
+#if SD_ASYNC_QUEUE_SIZE || defined(DOXYGEN)
+//------------------------------------------------------------------------------
+/**
+ * \class SdAsyncQueue
+ * \brief Bounded FIFO of SdAsyncRequest.
+ */
+class SdAsyncQueue {
+ public:
+  SdAsyncQueue() : m_head(0), m_count(0) {}
+  /** \return Number of requests in the queue. */
+  uint8_t count() const {
+    return m_count;
+  }
+  /** \return The oldest request.  The queue must not be empty. */
+  SdAsyncRequest* front() {
+    return &m_queue[m_head];
+  }
+  /** Remove the oldest request and call its callback.
+   *
+   * \param[in] ok Status passed to the callback.
+   */
+  void pop(bool ok) {
+    // copy so the callback may queue another request
+    SdAsyncRequest rq = m_queue[m_head];
+    m_head = (m_head + 1) % SD_ASYNC_QUEUE_SIZE;
+    m_count--;
+    if (rq.callback) {
+      rq.callback(rq.context, ok);
+    }
+  }
+  /** Add a request.
+   *
+   * \param[in] block First block to transfer.
+   * \param[in] buf Data for the transfer.
+   * \param[in] count Number of blocks.
+   * \param[in] write True for a write, false for a read.
+   * \param[in] callback Called when the request completes, may be null.
+   * \param[in] context Passed to callback.
+   *
+   * \return false if the queue is full or count is zero.
+   */
+  bool push(uint32_t block, uint8_t* buf, size_t count, bool write,
+            SdAsyncCallback callback, void* context) {
+    if (m_count >= SD_ASYNC_QUEUE_SIZE || count == 0) {
+      return false;
+    }
+    SdAsyncRequest* rq =
+      &m_queue[(m_head + m_count) % SD_ASYNC_QUEUE_SIZE];
+    rq->block = block;
+    rq->buf = buf;
+    rq->count = count;
+    rq->write = write;
+    rq->callback = callback;
+    rq->context = context;
+    m_count++;
+    return true;
+  }
+
+ private:
+  SdAsyncRequest m_queue[SD_ASYNC_QUEUE_SIZE];
+  uint8_t m_head;
+  uint8_t m_count;
+};
+#endif  // SD_ASYNC_QUEUE_SIZE
+#endif  // SdAsync_h
@@ -0,0 +1,57 @@
+/**
+ * Copyright (c) 2011-2018 Bill Greiman
+ * This file is part of the SdFat library for SD memory cards.
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SdCrc_h
+#define SdCrc_h
+/**
+ * \file
+ * \brief CRC functions for SD commands and data blocks
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include "SdFatConfig.h"
+#if USE_SD_CRC || ENABLE_SPI_CLOCK_TUNING
+//------------------------------------------------------------------------------
+/** Compute the CRC7 for an SD command.
+ *
+ * \param[in] data Command bytes.
+ * \param[in] n Number of bytes.
+ * \return The CRC7 shifted left one bit with the end bit set, ready to send
+ * as the last command byte.
+ */
+uint8_t CRC7(const uint8_t* data, uint8_t n);
+//------------------------------------------------------------------------------
+/** Compute the CRC-CCITT for an SD data block.
+ *
+ * Uses the x^16,x^12,x^5,x^1 polynomial with zero seed.  USE_SD_CRC
+ * selects the function.  The USE_SD_CRC 1 function is used for clock
+ * tuning if USE_SD_CRC is zero.
+ *
+ * \param[in] data Data bytes.
+ * \param[in] n Number of bytes.
+ * \return The CRC.
+ */
+uint16_t CRC_CCITT(const uint8_t* data, size_t n);
+#endif  // USE_SD_CRC || ENABLE_SPI_CLOCK_TUNING
+#endif  // SdCrc_h
@@ -118,6 +118,9 @@ const uint8_t SD_CARD_TYPE_SDHC = 3;
 /** Set SCK rate to F_CPU/32. */
 #define SPI_SIXTEENTH_SPEED SD_SCK_HZ(F_CPU/32)
 //------------------------------------------------------------------------------
+/** SCK rate for card identification, the highest rate the spec allows. */
+const uint32_t SD_INIT_SCK_HZ = 400000;
+//------------------------------------------------------------------------------
 // SD operation timeouts
 /** init timeout ms */
 const uint16_t SD_INIT_TIMEOUT = 2000;
@@ -477,4 +480,31 @@ inline uint32_t sdCardCapacity(csd_t* csd) {
     return 0;
   }
 }
+//-----------------------------------------------------------------------------
+/** \return The erase sector size in 512 byte blocks.  The fields have the
+ * same position in version 1 and version 2 CSD registers.
+ */
+inline uint32_t sdEraseBlocks(csd_t* csd) {
+  uint8_t sector_size = (csd->v1.sector_size_high << 1)
+                        | csd->v1.sector_size_low;
+  uint8_t write_bl_len = (csd->v1.write_bl_len_high << 2)
+                         | csd->v1.write_bl_len_low;
+  if (write_bl_len < 9 || write_bl_len > 11) {
+    return 0;
+  }
+  return (uint32_t)(sector_size + 1) << (write_bl_len - 9);
+}
+//-----------------------------------------------------------------------------
+/** \return The allocation unit size in 512 byte blocks from the 64 byte SD
+ * Status returned by ACMD13, zero if the card doesn't report one.
+ */
+inline uint32_t sdAuBlocks(const uint8_t* status) {
+  // AU_SIZE is bits 431:428, the high nibble of byte 10.
+  static const uint32_t auLarge[] = {24576, 32768, 49152, 65536, 131072};
+  uint8_t au = status[10] >> 4;
+  if (au == 0) {
+    return 0;
+  }
+  return au <= 10 ? 16UL << au : auLarge[au - 11];
+}
 #endif  // SdInfo_h
@@ -23,112 +23,180 @@
  * DEALINGS IN THE SOFTWARE.
  */
 #include "SdSpiCard.h"
+#include "SdCrc.h"
 // debug trace macro
 #define SD_TRACE(m, b)
 // #define SD_TRACE(m, b) Serial.print(m);Serial.println(b);
 #define SD_CS_DBG(m)
 // #define SD_CS_DBG(m) Serial.println(F(m));
+// startup phase timing
+#if ENABLE_SD_INIT_TIMING
+#define SD_INIT_START() m_phaseUs = micros()
+#define SD_INIT_PHASE(field) initPhase(&m_initTiming.field)
+#else  // ENABLE_SD_INIT_TIMING
+#define SD_INIT_START()
+#define SD_INIT_PHASE(field)
+#endif  // ENABLE_SD_INIT_TIMING
 //==============================================================================
-#if USE_SD_CRC
-// CRC functions
-//------------------------------------------------------------------------------
-static uint8_t CRC7(const uint8_t* data, uint8_t n) {
-  uint8_t crc = 0;
-  for (uint8_t i = 0; i < n; i++) {
-    uint8_t d = data[i];
-    for (uint8_t j = 0; j < 8; j++) {
-      crc <<= 1;
-      if ((d & 0x80) ^ (crc & 0x80)) {
-        crc ^= 0x09;
-      }
-      d <<= 1;
+// SdSpiCard member functions
+//------------------------------------------------------------------------------
+#if SD_ASYNC_QUEUE_SIZE
+// Finish queued requests before a synchronous call uses the card.
+void SdSpiCard::asyncDrain() {
+  if (!m_asyncPolling) {
+    while (asyncPoll()) {
     }
   }
-  return (crc << 1) | 1;
-}
-//------------------------------------------------------------------------------
-#if USE_SD_CRC == 1
-// Shift based CRC-CCITT
-// uses the x^16,x^12,x^5,x^1 polynomial.
-static uint16_t CRC_CCITT(const uint8_t *data, size_t n) {
-  uint16_t crc = 0;
-  for (size_t i = 0; i < n; i++) {
-    crc = (uint8_t)(crc >> 8) | (crc << 8);
-    crc ^= data[i];
-    crc ^= (uint8_t)(crc & 0xff) >> 4;
-    crc ^= crc << 12;
-    crc ^= (crc & 0xff) << 5;
-  }
-  return crc;
-}
-#elif USE_SD_CRC > 1  // CRC_CCITT
-//------------------------------------------------------------------------------
-// Table based CRC-CCITT
-// uses the x^16,x^12,x^5,x^1 polynomial.
-#ifdef __AVR__
-static const uint16_t crctab[] PROGMEM = {
-#else  // __AVR__
-static const uint16_t crctab[] = {
-#endif  // __AVR__
-  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
-  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
-  0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
-  0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
-  0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
-  0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
-  0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
-  0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
-  0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
-  0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
-  0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
-  0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
-  0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
-  0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
-  0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
-  0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
-  0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
-  0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
-  0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
-  0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
-  0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
-  0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
-  0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
-  0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
-  0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
-  0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
-  0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
-  0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
-  0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
-  0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
-  0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
-  0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
-};
-static uint16_t CRC_CCITT(const uint8_t* data, size_t n) {
-  uint16_t crc = 0;
-  for (size_t i = 0; i < n; i++) {
-#ifdef __AVR__
-    crc = pgm_read_word(&crctab[(crc >> 8 ^ data[i]) & 0XFF]) ^ (crc << 8);
-#else  // __AVR__
-    crc = crctab[(crc >> 8 ^ data[i]) & 0XFF] ^ (crc << 8);
-#endif  // __AVR__
-  }
-  return crc;
-}
-#endif  // CRC_CCITT
-#endif  // USE_SD_CRC
-//==============================================================================
-// SdSpiCard member functions
+}
+//------------------------------------------------------------------------------
+uint8_t SdSpiCard::asyncPoll() {
+  uint8_t n;
+  m_asyncPolling = true;
+  n = asyncStep();
+  m_asyncPolling = false;
+  return n;
+}
+//------------------------------------------------------------------------------
+uint8_t SdSpiCard::asyncStep() {
+  while (m_asyncQueue.count()) {
+    SdAsyncRequest* rq = m_asyncQueue.front();
+    int8_t rtn;
+    switch (m_asyncState) {
+      case ASYNC_START:
+        // wait for the card to finish any earlier write
+        spiStart();
+        if (spiReceive() != 0XFF) {
+          if (isTimedOut(m_asyncT0, SD_WRITE_TIMEOUT)) {
+            error(SD_CARD_ERROR_WRITE_TIMEOUT);
+            goto fail;
+          }
+          spiStop();
+          return m_asyncQueue.count();
+        }
+        if (rq->write ? !writeStart(rq->block) : !readStart(rq->block)) {
+          goto fail;
+        }
+        m_asyncState = rq->write ? ASYNC_WRITE_DATA : ASYNC_READ_TOKEN;
+        m_asyncT0 = curTimeMS();
+        break;
+
+      case ASYNC_READ_TOKEN:
+        rtn = readDataStart(rq->buf, false);
+        if (rtn < 0) {
+          goto fail;
+        }
+        if (rtn == 0) {
+          if (isTimedOut(m_asyncT0, SD_READ_TIMEOUT)) {
+            error(SD_CARD_ERROR_READ_TIMEOUT);
+            goto fail;
+          }
+          return m_asyncQueue.count();
+        }
+        m_asyncState = ASYNC_READ_DATA;
+#if SD_SPI_DMA_RECEIVE
+        // block is received in the background
+        return m_asyncQueue.count();
+#endif  // SD_SPI_DMA_RECEIVE
+        break;
+
+      case ASYNC_READ_DATA:
+        if (!readDataFinish(rq->buf)) {
+          goto fail;
+        }
+        rq->block++;
+        rq->buf += 512;
+        if (--rq->count == 0) {
+          if (!readStop()) {
+            goto fail;
+          }
+          goto done;
+        }
+        m_asyncState = ASYNC_READ_TOKEN;
+        m_asyncT0 = curTimeMS();
+        break;
+
+      case ASYNC_WRITE_DATA:
+        // wait for the previous block to be programmed
+        if (spiReceive() != 0XFF) {
+          if (isTimedOut(m_asyncT0, SD_WRITE_TIMEOUT)) {
+            error(SD_CARD_ERROR_WRITE_TIMEOUT);
+            goto fail;
+          }
+          return m_asyncQueue.count();
+        }
+        if (rq->count == 0) {
+          spiSend(STOP_TRAN_TOKEN);
+          spiStop();
+          goto done;
+        }
+        if (!writeData(WRITE_MULTIPLE_TOKEN, rq->buf)) {
+          goto fail;
+        }
+        rq->block++;
+        rq->buf += 512;
+        rq->count--;
+        m_asyncT0 = curTimeMS();
+        break;
+    }
+    continue;
+
+   fail:
+    spiStop();
+    m_asyncState = ASYNC_START;
+    m_asyncT0 = curTimeMS();
+    m_asyncQueue.pop(false);
+    continue;
+
+   done:
+    m_asyncState = ASYNC_START;
+    m_asyncT0 = curTimeMS();
+    m_asyncQueue.pop(true);
+  }
+  return 0;
+}
+//------------------------------------------------------------------------------
+bool SdSpiCard::asyncQueue(uint32_t lba, uint8_t* buf, size_t nb, bool write,
+                           SdAsyncCallback callback, void* context) {
+  if (m_asyncQueue.count() == 0) {
+    m_asyncState = ASYNC_START;
+    m_asyncT0 = curTimeMS();
+  }
+  return m_asyncQueue.push(lba, buf, nb, write, callback, context);
+}
+//------------------------------------------------------------------------------
+bool SdSpiCard::readBlocksAsync(uint32_t lba, uint8_t* dst, size_t nb,
+                                SdAsyncCallback callback, void* context) {
+  return asyncQueue(lba, dst, nb, false, callback, context);
+}
+//------------------------------------------------------------------------------
+bool SdSpiCard::writeBlocksAsync(uint32_t lba, const uint8_t* src, size_t nb,
+                                 SdAsyncCallback callback, void* context) {
+  return asyncQueue(lba, const_cast<uint8_t*>(src), nb, true,
+                    callback, context);
+}
+#endif  // SD_ASYNC_QUEUE_SIZE
 //------------------------------------------------------------------------------
 bool SdSpiCard::begin(SdSpiDriver* spi, uint8_t csPin, SPISettings settings) {
   m_spiActive = false;
   m_errorCode = SD_CARD_ERROR_NONE;
   m_type = 0;
   m_spiDriver = spi;
+#if ENABLE_SPI_CLOCK_TUNING
+  m_sckHz = 0;
+#endif  // ENABLE_SPI_CLOCK_TUNING
+#if ENABLE_SD_INIT_TIMING
+  m_initTiming = SdInitTiming();
+#endif  // ENABLE_SD_INIT_TIMING
+  SD_INIT_START();
   uint16_t t0 = curTimeMS();
   uint32_t arg;
+  uint16_t polls = 0;
+#if SD_ACMD41_MAX_BACKOFF_US
+  uint16_t backoff = 0;
+#endif  // SD_ACMD41_MAX_BACKOFF_US
 
   m_spiDriver->begin(csPin);
-  m_spiDriver->setSpiSettings(SD_SCK_HZ(250000));
+  m_spiDriver->setSpiSettings(SD_SCK_HZ(SD_INIT_SCK_HZ));
   spiStart();
 
   // must supply min of 74 clock cycles with CS high.
@@ -144,6 +212,7 @@ bool SdSpiCard::begin(SdSpiDriver* spi, uint8_t csPin, SPISettings settings) {
       goto fail;
     }
   }
+  SD_INIT_PHASE(cmd0Us);
 #if USE_SD_CRC
   if (cardCommand(CMD59, 1) != R1_IDLE_STATE) {
     error(SD_CARD_ERROR_CMD59);
@@ -168,6 +237,7 @@ bool SdSpiCard::begin(SdSpiDriver* spi, uint8_t csPin, SPISettings settings) {
       goto fail;
     }
   }
+  SD_INIT_PHASE(cmd8Us);
   // initialize card and send host supports SDHC if SD2
   arg = type() == SD_CARD_TYPE_SD2 ? 0X40000000 : 0;
 
@@ -177,7 +247,30 @@ bool SdSpiCard::begin(SdSpiDriver* spi, uint8_t csPin, SPISettings settings) {
       error(SD_CARD_ERROR_ACMD41);
       goto fail;
     }
+    if (polls < 0XFFFE) {
+      polls++;
+    }
+#if SD_ACMD41_MAX_BACKOFF_US
+    // Fast cards are ready after a few polls.  Slow cards take tens to
+    // hundreds of ms so let the card run its initialization undisturbed.
+    if (polls > 4) {
+      backoff = backoff ? 2*backoff : 64;
+      if (backoff > SD_ACMD41_MAX_BACKOFF_US) {
+        backoff = SD_ACMD41_MAX_BACKOFF_US;
+      }
+      spiStop();
+      uint32_t m = micros();
+      while ((micros() - m) < backoff) {}
+    }
+#endif  // SD_ACMD41_MAX_BACKOFF_US
   }
+  SD_INIT_PHASE(acmd41Us);
+#if ENABLE_SD_INIT_TIMING
+  m_initTiming.acmd41Count = polls + 1;
+#endif  // ENABLE_SD_INIT_TIMING
+  // The card has left identification mode so the full clock is allowed.
+  spiStop();
+  m_spiDriver->setSpiSettings(settings);
   // if SD2 read OCR register to check for SDHC card
   if (type() == SD_CARD_TYPE_SD2) {
     if (cardCommand(CMD58, 0)) {
@@ -191,9 +284,9 @@ bool SdSpiCard::begin(SdSpiDriver* spi, uint8_t csPin, SPISettings settings) {
     for (uint8_t i = 0; i < 3; i++) {
       spiReceive();
     }
+    spiStop();
   }
-  spiStop();
-  m_spiDriver->setSpiSettings(settings);
+  SD_INIT_PHASE(ocrUs);
   return true;
 
 fail:
@@ -203,6 +296,9 @@ fail:
 //------------------------------------------------------------------------------
 // send command and return error code.  Return zero for OK
 uint8_t SdSpiCard::cardCommand(uint8_t cmd, uint32_t arg) {
+#if SD_ASYNC_QUEUE_SIZE
+  asyncDrain();
+#endif  // SD_ASYNC_QUEUE_SIZE
   // select card
   if (!m_spiActive) {
     spiStart();
@@ -298,6 +394,9 @@ bool SdSpiCard::eraseSingleBlockEnable() {
 //------------------------------------------------------------------------------
 bool SdSpiCard::isBusy() {
   bool rtn = true;
+#if SD_ASYNC_QUEUE_SIZE
+  asyncDrain();
+#endif  // SD_ASYNC_QUEUE_SIZE
   bool spiActive = m_spiActive;
   if (!spiActive) {
     spiStart();
@@ -391,17 +490,86 @@ bool SdSpiCard::readData(uint8_t* dst, size_t count) {
     error(SD_CARD_ERROR_READ_CRC);
     goto fail;
   }
-#else
+#elif ENABLE_SPI_CLOCK_TUNING
+  // save crc for tuneSpiClock()
+  m_readCrc = spiReceive() << 8;
+  m_readCrc |= spiReceive();
+#else  // USE_SD_CRC
+  // discard crc
+  spiReceive();
+  spiReceive();
+#endif  // USE_SD_CRC
+  return true;
+
+fail:
+  spiStop();
+  return false;
+}
+//------------------------------------------------------------------------------
+#if SD_SPI_READ_AHEAD || SD_ASYNC_QUEUE_SIZE
+int8_t SdSpiCard::readDataStart(uint8_t* dst, bool wait) {
+  // wait for start block token
+  uint16_t t0 = curTimeMS();
+  while ((m_status = spiReceive()) == 0XFF) {
+    if (!wait) {
+      return 0;
+    }
+    if (isTimedOut(t0, SD_READ_TIMEOUT)) {
+      error(SD_CARD_ERROR_READ_TIMEOUT);
+      goto fail;
+    }
+  }
+  if (m_status != DATA_START_BLOCK) {
+    error(SD_CARD_ERROR_READ);
+    goto fail;
+  }
+#if SD_SPI_DMA_RECEIVE
+  m_spiDriver->receiveStart(dst, 512);
+#else  // SD_SPI_DMA_RECEIVE
+  if ((m_status = spiReceive(dst, 512))) {
+    error(SD_CARD_ERROR_DMA);
+    goto fail;
+  }
+#endif  // SD_SPI_DMA_RECEIVE
+  return 1;
+
+fail:
+  spiStop();
+  return -1;
+}
+//------------------------------------------------------------------------------
+bool SdSpiCard::readDataFinish(const uint8_t* dst) {
+#if USE_SD_CRC
+  uint16_t crc;
+#endif  // USE_SD_CRC
+#if SD_SPI_DMA_RECEIVE
+  if ((m_status = m_spiDriver->receiveFinish())) {
+    error(SD_CARD_ERROR_DMA);
+    goto fail;
+  }
+#endif  // SD_SPI_DMA_RECEIVE
+#if USE_SD_CRC
+  // get crc
+  crc = (spiReceive() << 8) | spiReceive();
+  if (crc != CRC_CCITT(dst, 512)) {
+    error(SD_CARD_ERROR_READ_CRC);
+    goto fail;
+  }
+#else  // USE_SD_CRC
+  (void)dst;
   // discard crc
   spiReceive();
   spiReceive();
 #endif  // USE_SD_CRC
   return true;
 
+#if SD_SPI_DMA_RECEIVE || USE_SD_CRC
 fail:
   spiStop();
   return false;
+#endif  // SD_SPI_DMA_RECEIVE || USE_SD_CRC
 }
+#endif  // SD_SPI_READ_AHEAD || SD_ASYNC_QUEUE_SIZE
 //------------------------------------------------------------------------------
 bool SdSpiCard::readOCR(uint32_t* ocr) {
   uint8_t *p = reinterpret_cast<uint8_t*>(ocr);
@@ -502,6 +670,91 @@ fail:
   spiStop();
   return false;
 }
+#if ENABLE_SPI_CLOCK_TUNING
+// SCK steps in MHz for tuneSpiClock().  The SPI driver rounds rates it
+// can't generate down so nearby steps may run at the same rate.
+static const uint8_t tuneMHz[] = {4, 8, 12, 16, 20, 25, 30, 40, 50};
+//------------------------------------------------------------------------------
+bool SdSpiCard::tuneRead(uint32_t block, uint8_t* buf, uint16_t* crc) {
+  // Not readBlock() in SdSpiCardEX, it may use read-ahead buffers.
+  if (!SdSpiCard::readBlock(block, buf)) {
+    return false;
+  }
+  *crc = CRC_CCITT(buf, 512);
+#if !USE_SD_CRC
+  // readData() checks the CRC if USE_SD_CRC is nonzero.
+  if (*crc != m_readCrc) {
+    error(SD_CARD_ERROR_READ_CRC);
+    return false;
+  }
+#endif  // !USE_SD_CRC
+  return true;
+}
+//------------------------------------------------------------------------------
+bool SdSpiCard::tuneStep(const uint32_t* block, const uint16_t* ref,
+                         uint8_t* buf) {
+  for (uint8_t pass = 0; pass < SD_SPI_TUNE_PASSES; pass++) {
+    for (uint8_t i = 0; i < 3; i++) {
+      uint16_t crc;
+      if (!tuneRead(block[i], buf, &crc) || crc != ref[i]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+uint32_t SdSpiCard::tuneSpiClock(uint32_t maxSckHz) {
+  SD_INIT_START();
+  uint8_t buf[512];
+  uint32_t block[3];
+  uint16_t ref[3];
+  uint32_t hz = maxSckHz < SD_SPI_TUNE_BASE_HZ ? maxSckHz : SD_SPI_TUNE_BASE_HZ;
+  uint32_t n = cardSize();
+  m_sckHz = 0;
+  if (n == 0) {
+    goto fail;
+  }
+  block[0] = 0;
+  block[1] = n/2;
+  block[2] = n - 1;
+  // Reference data at a rate any card and wiring should handle.
+  m_spiDriver->setSpiSettings(SD_SCK_HZ(hz));
+  for (uint8_t i = 0; i < 3; i++) {
+    if (!tuneRead(block[i], buf, &ref[i])) {
+      goto fail;
+    }
+  }
+  for (uint8_t i = 0; hz < maxSckHz; i++) {
+    uint32_t next = i < sizeof(tuneMHz) ? 1000000UL*tuneMHz[i] : maxSckHz;
+    if (next > maxSckHz) {
+      next = maxSckHz;
+    }
+    if (next <= hz) {
+      continue;
+    }
+    m_spiDriver->setSpiSettings(SD_SCK_HZ(next));
+    if (!tuneStep(block, ref, buf)) {
+      break;
+    }
+    hz = next;
+  }
+  // A failed step may leave the card part way through a transfer so
+  // check the selected rate again.
+  m_spiDriver->setSpiSettings(SD_SCK_HZ(hz));
+  if (!tuneStep(block, ref, buf) && !tuneStep(block, ref, buf)) {
+    goto fail;
+  }
+  m_errorCode = SD_CARD_ERROR_NONE;
+  m_sckHz = hz;
+  SD_INIT_PHASE(tuneUs);
+  return hz;
+
+fail:
+  SD_INIT_PHASE(tuneUs);
+  return 0;
+}
+#endif  // ENABLE_SPI_CLOCK_TUNING
 //------------------------------------------------------------------------------
 // wait for card to go not busy
 bool SdSpiCard::waitNotBusy(uint16_t timeoutMS) {
@@ -562,9 +815,15 @@ fail:
 }
 //------------------------------------------------------------------------------
 bool SdSpiCard::writeBlocks(uint32_t block, const uint8_t* src, size_t count) {
+#if USE_SD_PRE_ERASE
+  if (count > 1 ? !writeStart(block, count) : !writeStart(block)) {
+    goto fail;
+  }
+#else  // USE_SD_PRE_ERASE
   if (!writeStart(block)) {
     goto fail;
   }
+#endif  // USE_SD_PRE_ERASE
   for (size_t b = 0; b < count; b++, src += 512) {
     if (!writeData(src)) {
       goto fail;
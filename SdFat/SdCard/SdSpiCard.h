@@ -33,6 +33,42 @@
 #include "SdInfo.h"
 #include "../FatLib/BaseBlockDriver.h"
 #include "../SpiDriver/SdSpiDriver.h"
+#include "SdAsync.h"
+/** SD_SPI_DMA_RECEIVE is nonzero if the SdSpiCard driver can receive in the
+ *  background.
+ */
+#if SD_SPI_ASYNC_RECEIVE && SD_HAS_CUSTOM_SPI\
+  && !USE_STANDARD_SPI_LIBRARY && !ENABLE_SOFTWARE_SPI_CLASS
+#define SD_SPI_DMA_RECEIVE 1
+#else  // SD_SPI_DMA_RECEIVE
+#define SD_SPI_DMA_RECEIVE 0
+#endif  // SD_SPI_DMA_RECEIVE
+/** Number of SdSpiCardEX read-ahead buffers actually used. */
+#define SD_SPI_READ_AHEAD (SD_SPI_DMA_RECEIVE ? SD_READ_AHEAD_BLOCKS : 0)
+#if ENABLE_SPI_CLOCK_TUNING
+/** SCK rate used by tuneSpiClock() for the reference reads. */
+const uint32_t SD_SPI_TUNE_BASE_HZ = SD_INIT_SCK_HZ;
+#endif  // ENABLE_SPI_CLOCK_TUNING
+#if ENABLE_SD_INIT_TIMING || defined(DOXYGEN)
+/**
+ * \struct SdInitTiming
+ * \brief Microseconds spent in each phase of card startup.
+ */
+struct SdInitTiming {
+  /** Power up clocks and CMD0 at SD_INIT_SCK_HZ. */
+  uint32_t cmd0Us;
+  /** CMD59 and CMD8 at SD_INIT_SCK_HZ. */
+  uint32_t cmd8Us;
+  /** ACMD41 polls until the card leaves the idle state. */
+  uint32_t acmd41Us;
+  /** CMD58 OCR read at the begin() clock. */
+  uint32_t ocrUs;
+  /** tuneSpiClock(), zero if it has not been called. */
+  uint32_t tuneUs;
+  /** Number of ACMD41 commands sent. */
+  uint16_t acmd41Count;
+};
+#endif  // ENABLE_SD_INIT_TIMING
 //==============================================================================
 /**
  * \class SdSpiCard
@@ -45,7 +81,57 @@ class SdSpiCard {
 #endif  // ENABLE_EXTENDED_TRANSFER_CLASS || ENABLE_SDIO_CLASS
  public:
   /** Construct an instance of SdSpiCard. */
-  SdSpiCard() : m_errorCode(SD_CARD_ERROR_INIT_NOT_CALLED), m_type(0) {}
+  SdSpiCard() : m_errorCode(SD_CARD_ERROR_INIT_NOT_CALLED), m_type(0) {
+#if SD_ASYNC_QUEUE_SIZE
+    m_asyncPolling = false;
+#endif  // SD_ASYNC_QUEUE_SIZE
+  }
+#if SD_ASYNC_QUEUE_SIZE || defined(DOXYGEN)
+  /** \return Number of asynchronous requests not yet complete. */
+  uint8_t asyncPending() const {
+    return m_asyncQueue.count();
+  }
+  /** Advance queued asynchronous requests as far as possible without
+   * waiting for the card.  Call often, for example from loop().
+   *
+   * \return Number of asynchronous requests not yet complete.
+   */
+  uint8_t asyncPoll();
+  /**
+   * Queue a read of multiple 512 byte blocks.  The read is done by later
+   * calls to asyncPoll().
+   *
+   * \param[in] lba Logical block to be read.
+   * \param[out] dst Location that will receive the data.  Must stay valid
+   *            until the request completes.
+   * \param[in] nb Number of blocks to be read.
+   * \param[in] callback Called with the result, may be null.
+   * \param[in] context Passed to callback.
+   *
+   * \note A synchronous call made while asyncPending() is nonzero first
+   * waits for the queued requests to finish.  No other device on the SPI
+   * bus may be used until then.  Call syncBlocks() first for SdSpiCardEX.
+   *
+   * \return false if the queue is full or nb is zero.
+   */
+  bool readBlocksAsync(uint32_t lba, uint8_t* dst, size_t nb,
+                       SdAsyncCallback callback = 0, void* context = 0);
+  /**
+   * Queue a write of multiple 512 byte blocks.  The write is done by later
+   * calls to asyncPoll().
+   *
+   * \param[in] lba Logical block to be written.
+   * \param[in] src Data to be written.  Must stay valid until the request
+   *            completes.
+   * \param[in] nb Number of blocks to be written.
+   * \param[in] callback Called with the result, may be null.
+   * \param[in] context Passed to callback.
+   *
+   * \return false if the queue is full or nb is zero.
+   */
+  bool writeBlocksAsync(uint32_t lba, const uint8_t* src, size_t nb,
+                        SdAsyncCallback callback = 0, void* context = 0);
+#endif  // SD_ASYNC_QUEUE_SIZE
   /** Initialize the SD card.
    * \param[in] spi SPI driver for card.
    * \param[in] csPin card chip select pin.
@@ -53,6 +139,20 @@ class SdSpiCard {
    * \return true for success else false.
    */
   bool begin(SdSpiDriver* spi, uint8_t csPin, SPISettings spiSettings);
+#if ENABLE_SPI_CLOCK_TUNING || defined(DOXYGEN)
+  /** Initialize the SD card and select the fastest SPI clock that passes
+   * the tuneSpiClock() checks.
+   *
+   * \param[in] spi SPI driver for card.
+   * \param[in] csPin card chip select pin.
+   * \param[in] maxSckHz Highest SCK rate to try in Hz.
+   * \return true for success else false.
+   */
+  bool begin(SdSpiDriver* spi, uint8_t csPin, uint32_t maxSckHz) {
+    return begin(spi, csPin, SD_SCK_HZ(SD_SPI_TUNE_BASE_HZ)) &&
+           tuneSpiClock(maxSckHz);
+  }
+#endif  // ENABLE_SPI_CLOCK_TUNING
   /**
    * Determine the size of an SD flash memory card.
    *
@@ -153,6 +253,26 @@ class SdSpiCard {
    * the value false is returned for failure.
    */
   bool readData(uint8_t *dst);
+#if SD_SPI_READ_AHEAD || SD_ASYNC_QUEUE_SIZE || defined(DOXYGEN)
+  /** Start a background read of one data block in a multiple block read
+   * sequence.  Not for user apps.
+   *
+   * \param[out] dst Pointer to the location for the data to be read.
+   * \param[in] wait Wait for the card if the block is not ready yet.
+   *
+   * \return One if the read was started, zero if wait is false and the
+   * card is not ready, or -1 for an error.
+   */
+  int8_t readDataStart(uint8_t* dst, bool wait);
+  /** Finish a read started by readDataStart().  Not for user apps.
+   *
+   * \param[in] dst Pointer to the data, used for the CRC check.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool readDataFinish(const uint8_t* dst);
+#endif  // SD_SPI_READ_AHEAD || SD_ASYNC_QUEUE_SIZE
   /** Read OCR register.
    *
    * \param[out] ocr Value of OCR register.
@@ -205,6 +325,10 @@ class SdSpiCard {
    * \param[in] lba Logical block to be written.
    * \param[in] nb Number of blocks to be written.
    * \param[in] src Pointer to the location of the data to be written.
+   *
+   * \note If USE_SD_PRE_ERASE is nonzero and nb is more than one, the card
+   * is told to pre-erase nb blocks.
+   *
    * \return The value true is returned for success and
    * the value false is returned for failure.
    */
@@ -245,6 +369,37 @@ class SdSpiCard {
    * the value false is returned for failure.
    */
   bool writeStop();
+#if ENABLE_SPI_CLOCK_TUNING || defined(DOXYGEN)
+  /** \return SCK rate in Hz chosen by tuneSpiClock(), zero if the clock
+   * has not been tuned.  The SPI driver may run at a lower rate if it can't
+   * generate this one.
+   */
+  uint32_t spiClock() const {
+    return m_sckHz;
+  }
+  /** Step the SPI clock up a ladder of rates and keep the fastest rate
+   * that reads test blocks without error.
+   *
+   * Blocks zero, the middle block and the last block are read at
+   * SD_SPI_TUNE_BASE_HZ.  At each step they are read SD_SPI_TUNE_PASSES
+   * times.  A step fails if a read fails, the data CRC is bad, or the data
+   * differs from the low speed read.  Call this just after begin(), it uses
+   * 512 bytes of stack.
+   *
+   * \param[in] maxSckHz Highest SCK rate to try in Hz.
+   * \return The SCK rate selected or zero if the card can't be read at
+   * the lowest step.
+   */
+  uint32_t tuneSpiClock(uint32_t maxSckHz);
+#endif  // ENABLE_SPI_CLOCK_TUNING
+#if ENABLE_SD_INIT_TIMING || defined(DOXYGEN)
+  /** \return Time spent in each phase of the last begin() and
+   * tuneSpiClock() call.
+   */
+  const SdInitTiming& initTiming() const {
+    return m_initTiming;
+  }
+#endif  // ENABLE_SD_INIT_TIMING
   /** Set CS low and activate the card. */
   void spiStart();
   /** Set CS high and deactivate the card. */
@@ -256,10 +411,22 @@ class SdSpiCard {
     cardCommand(CMD55, 0);
     return cardCommand(cmd, arg);
   }
+#if ENABLE_SD_INIT_TIMING
+  // Store the time since the previous phase ended in *us.
+  void initPhase(uint32_t* us) {
+    uint32_t now = micros();
+    *us = now - m_phaseUs;
+    m_phaseUs = now;
+  }
+#endif  // ENABLE_SD_INIT_TIMING
   uint8_t cardCommand(uint8_t cmd, uint32_t arg);
   bool isTimedOut(uint16_t startMS, uint16_t timeoutMS);
   bool readData(uint8_t* dst, size_t count);
   bool readRegister(uint8_t cmd, void* buf);
+#if ENABLE_SPI_CLOCK_TUNING
+  bool tuneRead(uint32_t block, uint8_t* buf, uint16_t* crc);
+  bool tuneStep(const uint32_t* block, const uint16_t* ref, uint8_t* buf);
+#endif  // ENABLE_SPI_CLOCK_TUNING
 
   void type(uint8_t value) {
     m_type = value;
@@ -294,11 +461,35 @@ class SdSpiCard {
   void spiUnselect() {
     m_spiDriver->unselect();
   }
+#if SD_ASYNC_QUEUE_SIZE
+  void asyncDrain();
+  bool asyncQueue(uint32_t lba, uint8_t* buf, size_t nb, bool write,
+                  SdAsyncCallback callback, void* context);
+  uint8_t asyncStep();
+  static const uint8_t ASYNC_START = 0;
+  static const uint8_t ASYNC_READ_TOKEN = 1;
+  static const uint8_t ASYNC_READ_DATA = 2;
+  static const uint8_t ASYNC_WRITE_DATA = 3;
+  SdAsyncQueue m_asyncQueue;
+  uint16_t m_asyncT0;
+  uint8_t m_asyncState;
+  bool m_asyncPolling;
+#endif  // SD_ASYNC_QUEUE_SIZE
   uint8_t m_errorCode;
   SdSpiDriver *m_spiDriver;
   bool    m_spiActive;
   uint8_t m_status;
   uint8_t m_type;
+#if ENABLE_SPI_CLOCK_TUNING
+  uint32_t m_sckHz;
+#if !USE_SD_CRC
+  uint16_t m_readCrc;
+#endif  // !USE_SD_CRC
+#endif  // ENABLE_SPI_CLOCK_TUNING
+#if ENABLE_SD_INIT_TIMING
+  SdInitTiming m_initTiming;
+  uint32_t m_phaseUs;
+#endif  // ENABLE_SD_INIT_TIMING
 };
 //==============================================================================
 /**
@@ -317,8 +508,26 @@ class SdSpiCardEX : public SdSpiCard {
    */
   bool begin(SdSpiDriver* spi, uint8_t csPin, SPISettings spiSettings) {
     m_curState = IDLE_STATE;
+#if SD_SPI_READ_AHEAD
+    m_raCount = 0;
+    m_raPending = false;
+#endif  // SD_SPI_READ_AHEAD
     return SdSpiCard::begin(spi, csPin, spiSettings);
   }
+#if ENABLE_SPI_CLOCK_TUNING || defined(DOXYGEN)
+  /** Initialize the SD card and tune the SPI clock.
+   *
+   * \param[in] spi SPI driver.
+   * \param[in] csPin Card chip select pin number.
+   * \param[in] maxSckHz Highest SCK rate to try in Hz.
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool begin(SdSpiDriver* spi, uint8_t csPin, uint32_t maxSckHz) {
+    return begin(spi, csPin, SD_SCK_HZ(SD_SPI_TUNE_BASE_HZ)) &&
+           tuneSpiClock(maxSckHz);
+  }
+#endif  // ENABLE_SPI_CLOCK_TUNING
   /**
    * Read a 512 byte block from an SD card.
    *
@@ -367,6 +576,18 @@ class SdSpiCardEX : public SdSpiCard {
   static const uint32_t IDLE_STATE = 0;
   static const uint32_t READ_STATE = 1;
   static const uint32_t WRITE_STATE = 2;
+#if SD_SPI_READ_AHEAD
+  bool readAheadFinish();
+  bool readAheadStart(bool wait);
+  // Blocks m_raBlock ... m_raBlock + m_raCount - 1 are in the ring starting
+  // at m_raBuf[m_raHead].  If m_raPending is true, the next block is being
+  // received into the following slot.
+  uint8_t m_raBuf[SD_SPI_READ_AHEAD][512];
+  uint32_t m_raBlock;
+  uint8_t m_raHead;
+  uint8_t m_raCount;
+  bool m_raPending;
+#endif  // SD_SPI_READ_AHEAD
   uint32_t m_curBlock;
   uint8_t m_curState;
 };
@@ -23,7 +23,62 @@
  * DEALINGS IN THE SOFTWARE.
  */
 #include "SdSpiCard.h"
+#if SD_SPI_READ_AHEAD
+//-----------------------------------------------------------------------------
+// Complete the background receive, if any, and add it to the ring.
+bool SdSpiCardEX::readAheadFinish() {
+  if (m_raPending) {
+    m_raPending = false;
+    uint8_t slot = (m_raHead + m_raCount) % SD_SPI_READ_AHEAD;
+    if (!SdSpiCard::readDataFinish(m_raBuf[slot])) {
+      m_raCount = 0;
+      return false;
+    }
+    m_raCount++;
+  }
+  return true;
+}
+//-----------------------------------------------------------------------------
+// Start receiving the next block of the read sequence into a free slot.  If
+// wait is false, only start if the card already has the block ready.
+bool SdSpiCardEX::readAheadStart(bool wait) {
+  if (m_raPending || m_raCount >= SD_SPI_READ_AHEAD) {
+    return true;
+  }
+  uint8_t slot = (m_raHead + m_raCount) % SD_SPI_READ_AHEAD;
+  int8_t rtn = SdSpiCard::readDataStart(m_raBuf[slot], wait);
+  if (rtn < 0) {
+    m_raCount = 0;
+    return false;
+  }
+  if (rtn > 0) {
+    m_raPending = true;
+    m_curBlock++;
+  }
+  return true;
+}
+#endif  // SD_SPI_READ_AHEAD
+//-----------------------------------------------------------------------------
 bool SdSpiCardEX::readBlock(uint32_t block, uint8_t* dst) {
+#if SD_SPI_READ_AHEAD
+  bool sequential;
+  if (!readAheadFinish()) {
+    return false;
+  }
+  if ((block - m_raBlock) < m_raCount) {
+    // drop any blocks the caller skipped
+    uint8_t skip = block - m_raBlock;
+    m_raHead = (m_raHead + skip) % SD_SPI_READ_AHEAD;
+    m_raCount -= skip;
+    memcpy(dst, m_raBuf[m_raHead], 512);
+    m_raHead = (m_raHead + 1) % SD_SPI_READ_AHEAD;
+    m_raCount--;
+    m_raBlock = block + 1;
+    return readAheadStart(false);
+  }
+  m_raCount = 0;
+  sequential = m_curState == READ_STATE && block == m_curBlock;
+#endif  // SD_SPI_READ_AHEAD
   if (m_curState != READ_STATE || block != m_curBlock) {
     if (!syncBlocks()) {
       return false;
@@ -38,6 +93,14 @@ bool SdSpiCardEX::readBlock(uint32_t block, uint8_t* dst) {
     return false;
   }
   m_curBlock++;
+#if SD_SPI_READ_AHEAD
+  if (sequential) {
+    // second block in a row, start reading ahead
+    m_raBlock = m_curBlock;
+    m_raHead = 0;
+    return readAheadStart(true);
+  }
+#endif  // SD_SPI_READ_AHEAD
   return true;
 }
 //-----------------------------------------------------------------------------
@@ -51,6 +114,13 @@ bool SdSpiCardEX::readBlocks(uint32_t block, uint8_t* dst, size_t nb) {
 }
 //-----------------------------------------------------------------------------
 bool SdSpiCardEX::syncBlocks() {
+#if SD_SPI_READ_AHEAD
+  bool rtn = readAheadFinish();
+  m_raCount = 0;
+  if (!rtn) {
+    return false;
+  }
+#endif  // SD_SPI_READ_AHEAD
   if (m_curState == READ_STATE) {
     m_curState = IDLE_STATE;
     if (!SdSpiCard::readStop()) {
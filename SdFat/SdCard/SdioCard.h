@@ -26,12 +26,56 @@
 #define SdioCard_h
 #include "SysCall.h"
 #include "BlockDriver.h"
+#include "SdAsync.h"
 /**
  * \class SdioCard
  * \brief Raw SDIO access to SD and SDHC flash memory cards.
  */
 class SdioCard : public BaseBlockDriver {
  public:
+#if SD_ASYNC_QUEUE_SIZE || defined(DOXYGEN)
+  /** \return Number of asynchronous requests not yet complete. */
+  uint8_t asyncPending();
+  /** Advance queued asynchronous requests without waiting for the card.
+   * Call often, for example from loop().
+   *
+   * \return Number of asynchronous requests not yet complete.
+   */
+  uint8_t asyncPoll();
+  /**
+   * Queue a DMA read of multiple 512 byte blocks.  The read is started and
+   * completed by later calls to asyncPoll().
+   *
+   * \param[in] lba Logical block to be read.
+   * \param[out] dst Location that will receive the data.  Must be 32-bit
+   *            aligned and stay valid until the request completes.
+   * \param[in] nb Number of blocks to be read.
+   * \param[in] callback Called with the result, may be null.
+   * \param[in] context Passed to callback.
+   *
+   * \note A synchronous call made while asyncPending() is nonzero first
+   * waits for the queued requests to finish.
+   *
+   * \return false if the queue is full or nb is zero.
+   */
+  bool readBlocksAsync(uint32_t lba, uint8_t* dst, size_t nb,
+                       SdAsyncCallback callback = 0, void* context = 0);
+  /**
+   * Queue a DMA write of multiple 512 byte blocks.  The write is started and
+   * completed by later calls to asyncPoll().
+   *
+   * \param[in] lba Logical block to be written.
+   * \param[in] src Data to be written.  Must be 32-bit aligned and stay
+   *            valid until the request completes.
+   * \param[in] nb Number of blocks to be written.
+   * \param[in] callback Called with the result, may be null.
+   * \param[in] context Passed to callback.
+   *
+   * \return false if the queue is full or nb is zero.
+   */
+  bool writeBlocksAsync(uint32_t lba, const uint8_t* src, size_t nb,
+                        SdAsyncCallback callback = 0, void* context = 0);
+#endif  // SD_ASYNC_QUEUE_SIZE
   /** Initialize the SD card.
    * \return true for success else false.
    */
@@ -147,6 +191,13 @@ class SdioCard : public BaseBlockDriver {
    * the value false is returned for failure.
    */
   bool readStart(uint32_t lba, uint32_t count);
+  /** Return the 64 byte SD Status.
+   * \param[out] status location for 64 status bytes, must be 32-bit
+   *             aligned.
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool readStatus(uint8_t* status);
   /** End a read multiple blocks sequence.
    *
    * \return The value true is returned for success and
@@ -94,6 +94,9 @@ const uint32_t DATA_WRITE_MULTI_PGM = SDHC_XFERTYP_DPSEL |
 
 const uint32_t ACMD6_XFERTYP = SDHC_XFERTYP_CMDINX(ACMD6) | CMD_RESP_R1;
 
+const uint32_t ACMD13_XFERTYP = SDHC_XFERTYP_CMDINX(ACMD13) | CMD_RESP_R1 |
+                                DATA_READ_DMA;
+
 const uint32_t ACMD41_XFERTYP = SDHC_XFERTYP_CMDINX(ACMD41) | CMD_RESP_R3;
 
 const uint32_t CMD0_XFERTYP = SDHC_XFERTYP_CMDINX(CMD0) | CMD_RESP_NONE;
@@ -145,7 +148,12 @@ const uint32_t CMD38_XFERTYP = SDHC_XFERTYP_CMDINX(CMD38) | CMD_RESP_R1b;
 const uint32_t CMD55_XFERTYP = SDHC_XFERTYP_CMDINX(CMD55) | CMD_RESP_R1;
 
 //=============================================================================
+#if SD_ASYNC_QUEUE_SIZE
+static void asyncDrain();
+static uint8_t asyncStep();
+#endif  // SD_ASYNC_QUEUE_SIZE
 static bool cardCommand(uint32_t xfertyp, uint32_t arg);
+static void dmaStart(uint32_t xfertyp, uint32_t lba, uint8_t* buf, size_t n);
 static void enableGPIO(bool enable);
 static void enableDmaIrs();
 static void initSDHC();
@@ -171,6 +179,12 @@ static uint32_t m_sdClkKhz = 0;
 static uint32_t m_ocr;
 static cid_t m_cid;
 static csd_t m_csd;
+#if SD_ASYNC_QUEUE_SIZE
+static SdAsyncQueue m_asyncQueue;
+static bool m_asyncActive = false;
+static bool m_asyncPolling = false;
+static uint32_t m_asyncMicros;
+#endif  // SD_ASYNC_QUEUE_SIZE
 //=============================================================================
 #define USE_DEBUG_MODE 0
 #if USE_DEBUG_MODE
@@ -214,6 +228,9 @@ static bool cardAcmd(uint32_t rca, uint32_t xfertyp, uint32_t arg) {
 }
 //-----------------------------------------------------------------------------
 static bool cardCommand(uint32_t xfertyp, uint32_t arg) {
+#if SD_ASYNC_QUEUE_SIZE
+  asyncDrain();
+#endif  // SD_ASYNC_QUEUE_SIZE
   DBG_IRQSTAT();
   if (waitTimeout(isBusyCommandInhibit)) {
     return false;  // Caller will set errorCode.
@@ -260,6 +277,16 @@ static void enableGPIO(bool enable) {
   PORTE_PCR5 = enable ? PORT_CMD_DATA : 0;  // SDHC_D2
 }
 //-----------------------------------------------------------------------------
+// Start a DMA transfer, the card must not be busy.
+static void dmaStart(uint32_t xfertyp, uint32_t lba, uint8_t* buf, size_t n) {
+  enableDmaIrs();
+  SDHC_DSADDR  = (uint32_t)buf;
+  SDHC_CMDARG = m_highCapacity ? lba : 512*lba;
+  SDHC_BLKATTR = SDHC_BLKATTR_BLKCNT(n) | SDHC_BLKATTR_BLKSIZE(512);
+  SDHC_IRQSIGEN = SDHC_IRQSIGEN_MASK;
+  SDHC_XFERTYP = xfertyp;
+}
+//-----------------------------------------------------------------------------
 static void enableDmaIrs() {
   m_dmaBusy = true;
   m_irqstat = 0;
@@ -337,13 +364,7 @@ static bool rdWrBlocks(uint32_t xfertyp,
   if (yieldTimeout(isBusyCMD13)) {
     return sdError(SD_CARD_ERROR_CMD13);
   }
-  enableDmaIrs();
-  SDHC_DSADDR  = (uint32_t)buf;
-  SDHC_CMDARG = m_highCapacity ? lba : 512*lba;
-  SDHC_BLKATTR = SDHC_BLKATTR_BLKCNT(n) | SDHC_BLKATTR_BLKSIZE(512);
-  SDHC_IRQSIGEN = SDHC_IRQSIGEN_MASK;
-  SDHC_XFERTYP = xfertyp;
-
+  dmaStart(xfertyp, lba, buf, n);
   return waitDmaStatus();
 }
 //-----------------------------------------------------------------------------
@@ -451,6 +472,83 @@ static bool waitTimeout(bool (*fcn)()) {
   return false;  // Caller will set errorCode.
 }
 //=============================================================================
+#if SD_ASYNC_QUEUE_SIZE
+// Finish queued requests before a synchronous call uses the card.
+static void asyncDrain() {
+  if (!m_asyncPolling) {
+    m_asyncPolling = true;
+    while (asyncStep()) {
+    }
+    m_asyncPolling = false;
+  }
+}
+//-----------------------------------------------------------------------------
+static uint8_t asyncStep() {
+  while (m_asyncQueue.count()) {
+    SdAsyncRequest* rq = m_asyncQueue.front();
+    bool ok;
+    if (!m_asyncActive) {
+      if (3 & (uint32_t)rq->buf) {
+        ok = sdError(SD_CARD_ERROR_DMA);
+      } else if (isBusyCMD13()) {
+        if ((micros() - m_asyncMicros) <= BUSY_TIMEOUT_MICROS) {
+          return m_asyncQueue.count();
+        }
+        ok = sdError(SD_CARD_ERROR_CMD13);
+      } else {
+        dmaStart(rq->write ? CMD25_DMA_XFERTYP : CMD18_DMA_XFERTYP,
+                 rq->block, rq->buf, rq->count);
+        m_asyncActive = true;
+        m_asyncMicros = micros();
+        return m_asyncQueue.count();
+      }
+    } else {
+      if (isBusyDMA() && (micros() - m_asyncMicros) <= BUSY_TIMEOUT_MICROS) {
+        return m_asyncQueue.count();
+      }
+      m_asyncActive = false;
+      ok = !isBusyDMA() && (m_irqstat & SDHC_IRQSTAT_TC) &&
+           !(m_irqstat & SDHC_IRQSTAT_ERROR);
+      if (!ok) {
+        sdError(rq->write ? SD_CARD_ERROR_CMD25 : SD_CARD_ERROR_CMD18);
+      }
+    }
+    m_asyncMicros = micros();
+    m_asyncQueue.pop(ok);
+  }
+  return 0;
+}
+//=============================================================================
+uint8_t SdioCard::asyncPending() {
+  return m_asyncQueue.count();
+}
+//-----------------------------------------------------------------------------
+uint8_t SdioCard::asyncPoll() {
+  uint8_t n;
+  m_asyncPolling = true;
+  n = asyncStep();
+  m_asyncPolling = false;
+  return n;
+}
+//-----------------------------------------------------------------------------
+bool SdioCard::readBlocksAsync(uint32_t lba, uint8_t* dst, size_t nb,
+                               SdAsyncCallback callback, void* context) {
+  if (m_asyncQueue.count() == 0) {
+    m_asyncMicros = micros();
+  }
+  return m_asyncQueue.push(lba, dst, nb, false, callback, context);
+}
+//-----------------------------------------------------------------------------
+bool SdioCard::writeBlocksAsync(uint32_t lba, const uint8_t* src, size_t nb,
+                                SdAsyncCallback callback, void* context) {
+  if (m_asyncQueue.count() == 0) {
+    m_asyncMicros = micros();
+  }
+  return m_asyncQueue.push(lba, const_cast<uint8_t*>(src), nb, true,
+                           callback, context);
+}
+#endif  // SD_ASYNC_QUEUE_SIZE
+//-----------------------------------------------------------------------------
 bool SdioCard::begin() {
   uint32_t kHzSdClk;
   uint32_t arg;
@@ -692,6 +790,30 @@ bool SdioCard::readStart(uint32_t lba, uint32_t count) {
   return true;
 }
 //-----------------------------------------------------------------------------
+bool SdioCard::readStatus(uint8_t* status) {
+  // ACMD13 returns 64 bytes.
+  if (3 & (uint32_t)status) {
+    return sdError(SD_CARD_ERROR_DMA);
+  }
+  if (waitTimeout(isBusyCMD13)) {
+    return sdError(SD_CARD_ERROR_CMD13);
+  }
+  if (!cardCommand(CMD55_XFERTYP, m_rca)) {
+    return sdError(SD_CARD_ERROR_ACMD13);
+  }
+  enableDmaIrs();
+  SDHC_DSADDR  = (uint32_t)status;
+  SDHC_CMDARG = 0;
+  SDHC_BLKATTR = SDHC_BLKATTR_BLKCNT(1) | SDHC_BLKATTR_BLKSIZE(64);
+  SDHC_IRQSIGEN = SDHC_IRQSIGEN_MASK;
+  SDHC_XFERTYP = ACMD13_XFERTYP;
+
+  if (!waitDmaStatus()) {
+    return sdError(SD_CARD_ERROR_ACMD13);
+  }
+  return true;
+}
+//-----------------------------------------------------------------------------
 bool SdioCard::readStop() {
   return transferStop();
 }
@@ -32,6 +32,8 @@
 #include "BlockDriver.h"
 #include "FatLib/FatLib.h"
 #include "SdCard/SdioCard.h"
+#include "RawStreamWriter.h"
+#include "SdFormatter.h"
 #if INCLUDE_SDIOS
 #include "sdios.h"
 #endif  // INCLUDE_SDIOS
@@ -90,6 +92,19 @@ class SdFileSystem : public FatFileSystem {
   bool begin() {
     return FatFileSystem::begin(&m_card);
   }
+  /** Format the card with SdFormatter and mount the new volume.
+   * All data on the card is lost.
+   *
+   * \param[in] pr Print stream for status dots or zero.
+   * \return true for success else false.
+   */
+  bool format(print_t* pr = 0) {
+    SdFormatter<SdDriverClass> formatter;
+    cache_t* cache;
+    vwd()->close();
+    cache = cacheClear();
+    return cache && formatter.format(&m_card, cache->data, pr) && begin();
+  }
   /** \return Pointer to SD card object */
   SdDriverClass *card() {
     m_card.syncBlocks();
@@ -330,6 +345,19 @@ class SdFat : public SdFileSystem<SdSpiCard> {
     return m_card.begin(&m_spi, csPin, spiSettings) &&
            SdFileSystem::begin();
   }
+#if ENABLE_SPI_CLOCK_TUNING || defined(DOXYGEN)
+  /** Initialize SD card and file system with the fastest SPI clock that
+   * passes SdSpiCard::tuneSpiClock().
+   *
+   * \param[in] csPin SD card chip select pin.
+   * \param[in] maxSckHz Highest SCK rate to try in Hz.
+   * \return true for success else false.
+   */
+  bool begin(uint8_t csPin, uint32_t maxSckHz) {
+    return m_card.begin(&m_spi, csPin, maxSckHz) &&
+           SdFileSystem::begin();
+  }
+#endif  // ENABLE_SPI_CLOCK_TUNING
   /** Initialize SD card for diagnostic use only.
    *
    * \param[in] csPin SD card chip select pin.
@@ -463,6 +491,19 @@ class SdFatEX : public SdFileSystem<SdSpiCardEX> {
     return m_card.begin(&m_spi, csPin, spiSettings) &&
            SdFileSystem::begin();
   }
+#if ENABLE_SPI_CLOCK_TUNING || defined(DOXYGEN)
+  /** Initialize SD card and file system with the fastest SPI clock that
+   * passes SdSpiCard::tuneSpiClock().
+   *
+   * \param[in] csPin SD card chip select pin.
+   * \param[in] maxSckHz Highest SCK rate to try in Hz.
+   * \return true for success else false.
+   */
+  bool begin(uint8_t csPin, uint32_t maxSckHz) {
+    return m_card.begin(&m_spi, csPin, maxSckHz) &&
+           SdFileSystem::begin();
+  }
+#endif  // ENABLE_SPI_CLOCK_TUNING
 
  private:
   SdFatSpiDriver m_spi;
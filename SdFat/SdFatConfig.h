@@ -101,6 +101,80 @@
  */
 #define MAINTAIN_FREE_CLUSTER_COUNT 0
 //------------------------------------------------------------------------------
+/**
+ * Set USE_FSINFO nonzero to use the FAT32 FSINFO block.  It is read by the
+ * first allocation after mount, not by mount itself, and its next free hint
+ * becomes the allocation search start.  The hint is written back when it
+ * moves to another FAT block.  The FSINFO free count is never used.  After
+ * allocation changes it is marked unknown, and FatVolume::syncFatMirror()
+ * writes the exact count if it is known.
+ */
+#ifndef USE_FSINFO
+#define USE_FSINFO 1
+#endif  // USE_FSINFO
+//------------------------------------------------------------------------------
+/**
+ * Size in bytes of the in-RAM free cluster bitmap.  Each bit covers a group
+ * of clusters, the smallest power of two that fits the volume in the
+ * bitmap.  A clear bit means the group has no free clusters, so allocation
+ * skips it without reading the FAT.  Every group starts out set at mount
+ * and is cleared when allocation finds it full, so the search reads each
+ * full FAT block once and starts at the FSINFO hint, with no scan of the
+ * whole FAT.  After freeClusterCount() has counted the free clusters, the
+ * count is kept up to date and later calls are instant, as with
+ * MAINTAIN_FREE_CLUSTER_COUNT.
+ * Set to zero to disable.
+ */
+#ifndef FAT_FREE_BITMAP_BYTES
+#if defined(__AVR__)
+#define FAT_FREE_BITMAP_BYTES 0
+#else  // __AVR__
+#define FAT_FREE_BITMAP_BYTES 512
+#endif  // __AVR__
+#endif  // FAT_FREE_BITMAP_BYTES
+//------------------------------------------------------------------------------
+/**
+ * Number of names in the in-RAM index of a directory.  The index maps a
+ * hash of each name to the entry where the name starts.  It is built as
+ * open() scans the directory, so later opens in that directory read only
+ * the entries whose hash matches.  Creating or removing a file in the
+ * directory drops its index.  Each name takes 4 bytes, and a long name
+ * takes a second record for its 8.3 alias.  Only used with long file
+ * names.  Zero, the default, disables the index.  256 with two directories
+ * takes 2 KB per volume, so enable it only on boards with RAM to spare.
+ */
+#ifndef FAT_DIR_INDEX_ENTRIES
+#define FAT_DIR_INDEX_ENTRIES 0
+#endif  // FAT_DIR_INDEX_ENTRIES
+//------------------------------------------------------------------------------
+/**
+ * Number of directories indexed at once.  The least recently used index
+ * is replaced.  Opening a path uses an index for each directory in the
+ * path, so two covers a file in a subdirectory of root.
+ */
+#ifndef FAT_DIR_INDEX_DIRS
+#define FAT_DIR_INDEX_DIRS 2
+#endif  // FAT_DIR_INDEX_DIRS
+//------------------------------------------------------------------------------
+/**
+ * Number of recently opened paths each volume remembers.  A cached path
+ * opens its directory entry directly, without walking the directories in
+ * the path, after checking the entry still holds the same file.  Removing
+ * any file or directory clears the cache.  Each path takes
+ * 28 + FAT_PATH_CACHE_LENGTH bytes.  Zero, the default, disables the
+ * cache.  Four paths is a good size on boards with RAM to spare.
+ */
+#ifndef FAT_PATH_CACHE_ENTRIES
+#define FAT_PATH_CACHE_ENTRIES 0
+#endif  // FAT_PATH_CACHE_ENTRIES
+/**
+ * Size of the path stored in each path cache entry.  Paths of this length
+ * or longer are not cached.
+ */
+#ifndef FAT_PATH_CACHE_LENGTH
+#define FAT_PATH_CACHE_LENGTH 64
+#endif  // FAT_PATH_CACHE_LENGTH
+//------------------------------------------------------------------------------
 /**
  * To enable SD card CRC checking set USE_SD_CRC nonzero.
  *
@@ -109,8 +183,64 @@
  *
  * Set USE_SD_CRC to 2 to used a larger table driven CRC-CCITT function.  This
  * function is faster for AVR but may be slower for ARM and other processors.
+ *
+ * Set USE_SD_CRC to 3 to use a slice-by-4 CRC-CCITT function with four
+ * tables, 2 KB of flash.  This is the fastest software function on 32-bit
+ * processors.  AVR uses the USE_SD_CRC 2 function.
+ *
+ * Set USE_SD_CRC to 4 to use the CRC module on Teensy 3.x.  Other boards
+ * use the USE_SD_CRC 3 function.
+ *
+ * Values above 1 also use a 256 byte table for the command CRC7.
+ *
+ * tools/crcbench.cpp compares the functions on a PC.
  */
+#ifndef USE_SD_CRC
 #define USE_SD_CRC 0
+#endif  // USE_SD_CRC
+//------------------------------------------------------------------------------
+/**
+ * Set ENABLE_SPI_CLOCK_TUNING nonzero to add SdSpiCard::tuneSpiClock() and
+ * begin() calls that take a maximum SCK rate in Hz instead of SPISettings.
+ *
+ * After the card is initialized the SPI clock is stepped up a ladder of
+ * rates.  Each step reads test blocks SD_SPI_TUNE_PASSES times, checks the
+ * data CRC sent by the card and compares the data with a read done at
+ * 400 kHz.  The fastest step that passes is kept.  The data CRC is checked
+ * even if USE_SD_CRC is zero.
+ *
+ * tuneSpiClock() needs a 512 byte buffer on the stack so it is disabled
+ * by default for AVR.
+ */
+#ifndef ENABLE_SPI_CLOCK_TUNING
+#if defined(__AVR__)
+#define ENABLE_SPI_CLOCK_TUNING 0
+#else  // __AVR__
+#define ENABLE_SPI_CLOCK_TUNING 1
+#endif  // __AVR__
+#endif  // ENABLE_SPI_CLOCK_TUNING
+/** Number of times each test block is read at each clock step. */
+#ifndef SD_SPI_TUNE_PASSES
+#define SD_SPI_TUNE_PASSES 4
+#endif  // SD_SPI_TUNE_PASSES
+//------------------------------------------------------------------------------
+/**
+ * Set ENABLE_SD_INIT_TIMING nonzero to record the time SdSpiCard::begin()
+ * and SdSpiCard::tuneSpiClock() spend in each phase of card startup.
+ * See SdSpiCard::initTiming().
+ */
+#ifndef ENABLE_SD_INIT_TIMING
+#define ENABLE_SD_INIT_TIMING 1
+#endif  // ENABLE_SD_INIT_TIMING
+/**
+ * Longest pause in microseconds between ACMD41 polls while the card is busy
+ * with its power up initialization.  The first few polls are sent back to
+ * back, then the pause doubles up to this limit.  The card is deselected
+ * during the pause.  Set to zero to poll continuously.
+ */
+#ifndef SD_ACMD41_MAX_BACKOFF_US
+#define SD_ACMD41_MAX_BACKOFF_US 1000
+#endif  // SD_ACMD41_MAX_BACKOFF_US
 //------------------------------------------------------------------------------
 /**
  * Handle Watchdog Timer for WiFi modules.
@@ -168,6 +298,104 @@
 #define USE_SEPARATE_FAT_CACHE 0
 #endif  // __arm__
 //------------------------------------------------------------------------------
+/**
+ * Number of 512 byte blocks in each FatCache.  A single block thrashes when
+ * access alternates between two blocks, for example a directory scan while
+ * reading a file or FAT lookups between data blocks.  Each extra block costs
+ * 512 bytes of RAM (twice that with USE_SEPARATE_FAT_CACHE), so the default
+ * is one block.  Set it to 4 on boards with RAM to spare, such as Teensy
+ * 3.5/3.6, to cut the reads for directory scans and FAT lookups.
+ *
+ * May also be set on the compiler command line.
+ */
+#ifndef FAT_CACHE_BLOCKS
+#define FAT_CACHE_BLOCKS 1
+#endif  // FAT_CACHE_BLOCKS
+//------------------------------------------------------------------------------
+/**
+ * Blocks per set in FatCache.  FAT_CACHE_BLOCKS must be a multiple of this.
+ * Set it equal to FAT_CACHE_BLOCKS for a fully associative cache.
+ */
+#ifndef FAT_CACHE_WAYS
+#define FAT_CACHE_WAYS FAT_CACHE_BLOCKS
+#endif  // FAT_CACHE_WAYS
+//------------------------------------------------------------------------------
+/**
+ * Set FAT_CACHE_USE_CLOCK nonzero to replace cache blocks with the CLOCK
+ * (second chance) algorithm instead of least recently used.
+ */
+#ifndef FAT_CACHE_USE_CLOCK
+#define FAT_CACHE_USE_CLOCK 0
+#endif  // FAT_CACHE_USE_CLOCK
+//------------------------------------------------------------------------------
+/**
+ * Set FAT_CACHE_STATS nonzero to count cache hits and misses.
+ */
+#ifndef FAT_CACHE_STATS
+#define FAT_CACHE_STATS (FAT_CACHE_BLOCKS > 1)
+#endif  // FAT_CACHE_STATS
+//------------------------------------------------------------------------------
+/**
+ * Number of FAT blocks whose second FAT copy may be left stale.  A dirty FAT
+ * block written back by the cache normally also writes its mirror.  With
+ * this nonzero the mirror write is put off and all stale mirrors are copied
+ * in ascending block order by the next sync() or close().  When the list is
+ * full the mirror is written with the block as before.  Each entry costs
+ * four bytes of RAM.  Set to zero to always write the mirror at once.
+ */
+#ifndef FAT_MIRROR_DEFER_BLOCKS
+#if defined(__AVR__)
+#define FAT_MIRROR_DEFER_BLOCKS 4
+#else  // __AVR__
+#define FAT_MIRROR_DEFER_BLOCKS 16
+#endif  // __AVR__
+#endif  // FAT_MIRROR_DEFER_BLOCKS
+/**
+ * Number of sync() or close() calls that bring the second FAT up to date.
+ * With one, every sync() copies the stale blocks.  A larger value lets a
+ * program that writes and closes many small files skip most mirror writes.
+ * The list is also copied when it is full and by
+ * FatVolume::syncFatMirror().  Needs FAT_MIRROR_DEFER_BLOCKS.
+ */
+#ifndef FAT_MIRROR_SYNC_INTERVAL
+#define FAT_MIRROR_SYNC_INTERVAL 1
+#endif  // FAT_MIRROR_SYNC_INTERVAL
+//------------------------------------------------------------------------------
+/**
+ * Size in bytes of the StdioStream buffer, at most 65535.  A larger buffer
+ * lets StdioStream::getLineView() return more lines without a copy and
+ * reads the file in larger pieces.  UNGETC_BUF_SIZE bytes are kept for
+ * ungetc() during input.
+ */
+#ifndef STDIO_STREAM_BUF_SIZE
+#define STDIO_STREAM_BUF_SIZE 64
+#endif  // STDIO_STREAM_BUF_SIZE
+//------------------------------------------------------------------------------
+/**
+ * Number of extents (runs of contiguous clusters) each open file remembers.
+ * Extents are found from the FAT chain as a file is read.  Reads then step
+ * through a run without FAT lookups, and multi-block reads can cover a whole
+ * run instead of stopping at each cluster end.  Each extent adds 12 bytes
+ * to every FatFile.  Zero, the default, disables extents.  Four covers most
+ * files on a card that is not badly fragmented.
+ */
+#ifndef FAT_FILE_EXTENT_COUNT
+#define FAT_FILE_EXTENT_COUNT 0
+#endif  // FAT_FILE_EXTENT_COUNT
+//------------------------------------------------------------------------------
+/**
+ * Number of cluster checkpoints each open file keeps for seekSet().  The
+ * cluster number is recorded at evenly spaced points in the file as it is
+ * read or seeked through, and the spacing doubles as the file outgrows the
+ * table.  A backward seek then walks the FAT chain from the nearest
+ * checkpoint instead of from the first cluster.  Each checkpoint adds
+ * 4 bytes to every FatFile.  Zero, the default, disables checkpoints.
+ * Eight is enough for files read with frequent backward seeks.
+ */
+#ifndef FAT_FILE_CHECKPOINT_COUNT
+#define FAT_FILE_CHECKPOINT_COUNT 0
+#endif  // FAT_FILE_CHECKPOINT_COUNT
+//------------------------------------------------------------------------------
 /**
  * Set USE_MULTI_BLOCK_IO nonzero to use multi-block SD read/write.
  *
@@ -178,6 +406,15 @@
 #else  // RAMEND
 #define USE_MULTI_BLOCK_IO 1
 #endif  // RAMEND
+//------------------------------------------------------------------------------
+/**
+ * Set USE_SD_PRE_ERASE nonzero to have SdSpiCard::writeBlocks() send the
+ * block count with ACMD23 before a multi-block write.  The card can then
+ * erase the whole span at once instead of block by block.
+ */
+#ifndef USE_SD_PRE_ERASE
+#define USE_SD_PRE_ERASE USE_MULTI_BLOCK_IO
+#endif  // USE_SD_PRE_ERASE
 //-----------------------------------------------------------------------------
 /** Enable SDIO driver if available. */
 #if defined(__MK64FX512__) || defined(__MK66FX1M0__)
@@ -211,4 +448,34 @@
 #else  // USE_STANDARD_SPI_LIBRARY
 #define IMPLEMENT_SPI_PORT_SELECTION 1
 #endif  // USE_STANDARD_SPI_LIBRARY
+//------------------------------------------------------------------------------
+/**
+ * Number of 512 byte read-ahead buffers for SdFatEX.  When blocks are read
+ * in sequence, the next block is received into a spare buffer in the
+ * background while the caller works on the current one.
+ *
+ * This needs a custom SPI driver that can receive with DMA in the background
+ * (SD_SPI_ASYNC_RECEIVE in SdSpiDriver.h), at present the SAM3X driver.  It is
+ * ignored for other boards and for the standard or software SPI drivers.
+ */
+#if defined(__SAM3X8E__) || defined(__SAM3X8H__)
+#define SD_READ_AHEAD_BLOCKS 2
+#else  // SD_READ_AHEAD_BLOCKS
+#define SD_READ_AHEAD_BLOCKS 0
+#endif  // SD_READ_AHEAD_BLOCKS
+//------------------------------------------------------------------------------
+/**
+ * Maximum number of queued readBlocksAsync()/writeBlocksAsync() requests
+ * for SdSpiCard and SdioCard.  Set to zero to remove the asynchronous API.
+ *
+ * Requests advance only when asyncPoll() is called.  Card busy and token
+ * waits never block.  Data transfers run in the background where the
+ * driver can do DMA: SDIO, and SAM3X with the custom SPI driver.  Other
+ * drivers copy each block during the asyncPoll() call.
+ */
+#ifdef __AVR__
+#define SD_ASYNC_QUEUE_SIZE 0
+#else  // __AVR__
+#define SD_ASYNC_QUEUE_SIZE 4
+#endif  // __AVR__
 #endif  // SdFatConfig_h
@@ -0,0 +1,427 @@
+/**
+ * Copyright (c) 2011-2018 Bill Greiman
+ * This file is part of the SdFat library for SD memory cards.
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SdFormatter_h
+#define SdFormatter_h
+/**
+ * \file
+ * \brief SdFormatter class
+ */
+#include <string.h>
+#include "FatLib/FatLibConfig.h"
+#include "FatLib/FatStructs.h"
+#include "SdCard/SdInfo.h"
+//------------------------------------------------------------------------------
+/**
+ * \class SdFormatter
+ * \brief Format an SD card with the layout used by the SD Association
+ * formatter.
+ *
+ * The cluster size and the boundary unit come from the card capacity as in
+ * the SD file system specification.  The boundary unit is raised to the
+ * allocation unit in the card's SD Status if that is larger.  SDSC cards
+ * that don't report one use the erase sector size in the CSD, which has no
+ * meaning for SDHC and SDXC cards.  The partition starts on
+ * a boundary unit and the data area starts on a boundary unit, so every
+ * cluster lies inside one erase block and a multi-block write of a
+ * contiguous file never straddles two.
+ *
+ * Cards up to 2 GB are formatted FAT16 with a 512 entry root directory.
+ * Larger cards are formatted FAT32 with the root directory in cluster two.
+ *
+ * CardClass is the card type returned by SdFat::card() or SdFatSdio::card(),
+ * for example SdSpiCard or SdioCard.  The volume must be mounted again with
+ * begin() after the card is formatted.
+ */
+template<class CardClass>
+class SdFormatter {
+ public:
+  SdFormatter() : m_fatType(0) {}
+  /** Format the card.  All data on the card is lost.
+   *
+   * \param[in] card The card to format.
+   * \param[in] secBuf A 512 byte buffer.
+   * \param[in] pr Print stream for status dots or zero.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool format(CardClass* card, uint8_t* secBuf, print_t* pr = 0) {
+    csd_t csd;
+    // word aligned for SdioCard DMA
+    uint32_t status[16];
+    uint32_t capacityMB;
+    uint32_t eraseBlocks;
+    m_card = card;
+    m_buf = secBuf;
+    m_pr = pr;
+    m_fatType = 0;
+    m_blockCount = card->cardSize();
+    if (m_blockCount == 0 || !card->readCSD(&csd)) {
+      return false;
+    }
+    capacityMB = m_blockCount >> 11;
+    if (capacityMB <= 6) {
+      // too small for FAT16
+      return false;
+    } else if (capacityMB <= 16) {
+      m_blocksPerCluster = 2;
+    } else if (capacityMB <= 32) {
+      m_blocksPerCluster = 4;
+    } else if (capacityMB <= 64) {
+      m_blocksPerCluster = 8;
+    } else if (capacityMB <= 128) {
+      m_blocksPerCluster = 16;
+    } else if (capacityMB <= 1024) {
+      m_blocksPerCluster = 32;
+    } else if (capacityMB <= 32768) {
+      m_blocksPerCluster = 64;
+    } else {
+      m_blocksPerCluster = 128;
+    }
+    // Boundary unit in blocks from the SD file system specification.
+    if (capacityMB <= 64) {
+      m_alignBlocks = 64;
+    } else if (capacityMB <= 256) {
+      m_alignBlocks = 128;
+    } else if (capacityMB <= 2048) {
+      m_alignBlocks = 256;
+    } else if (capacityMB <= 32768) {
+      m_alignBlocks = 8192;
+    } else {
+      m_alignBlocks = 32768;
+    }
+    uint8_t* sdStatus = reinterpret_cast<uint8_t*>(status);
+    eraseBlocks = card->readStatus(sdStatus) ? sdAuBlocks(sdStatus) : 0;
+    if (eraseBlocks == 0 && csd.v1.csd_ver == 0) {
+      eraseBlocks = sdEraseBlocks(&csd);
+    }
+    if (eraseBlocks > m_alignBlocks) {
+      m_alignBlocks = eraseBlocks;
+    }
+    // CHS geometry for the MBR.
+    if (capacityMB <= 16) {
+      m_heads = 2;
+      m_sectorsPerTrack = 16;
+    } else if (capacityMB <= 32) {
+      m_heads = 4;
+      m_sectorsPerTrack = 16;
+    } else if (capacityMB <= 128) {
+      m_heads = 8;
+      m_sectorsPerTrack = 32;
+    } else if (capacityMB <= 504) {
+      m_heads = 16;
+      m_sectorsPerTrack = 32;
+    } else if (capacityMB <= 1008) {
+      m_heads = 32;
+      m_sectorsPerTrack = 63;
+    } else if (capacityMB <= 2016) {
+      m_heads = 64;
+      m_sectorsPerTrack = 63;
+    } else if (capacityMB <= 4032) {
+      m_heads = 128;
+      m_sectorsPerTrack = 63;
+    } else {
+      m_heads = 255;
+      m_sectorsPerTrack = 63;
+    }
+    m_serial = m_blockCount ^ micros();
+    if (capacityMB <= 2048 && layoutFat16()) {
+      return makeFat16();
+    }
+    // Use smaller clusters if the card is just above the FAT16 limit.
+    while (!layoutFat32()) {
+      if (m_blocksPerCluster == 1) {
+        return false;
+      }
+      m_blocksPerCluster >>= 1;
+    }
+    return makeFat32();
+  }
+  /** \return Alignment of the partition and data area in blocks. */
+  uint32_t alignBlocks() const {
+    return m_alignBlocks;
+  }
+  /** \return The number of blocks in a cluster. */
+  uint8_t blocksPerCluster() const {
+    return m_blocksPerCluster;
+  }
+  /** \return The number of clusters in the volume. */
+  uint32_t clusterCount() const {
+    return m_clusterCount;
+  }
+  /** \return The first block of the data area. */
+  uint32_t dataStartBlock() const {
+    return m_dataStart;
+  }
+  /** \return The FAT type of the last format, zero if it failed. */
+  uint8_t fatType() const {
+    return m_fatType;
+  }
+  /** \return The first block of the partition. */
+  uint32_t partitionStartBlock() const {
+    return m_relSector;
+  }
+
+ private:
+  // Boot block, two FATs and a 512 entry root directory before the data
+  // area.  The data area starts on a boundary unit.
+  bool layoutFat16() {
+    uint32_t r;
+    for (m_dataStart = 2*m_alignBlocks;; m_dataStart += m_alignBlocks) {
+      if (m_dataStart >= m_blockCount) {
+        return false;
+      }
+      m_clusterCount = (m_blockCount - m_dataStart)/m_blocksPerCluster;
+      m_fatSize = (m_clusterCount + 2 + 255)/256;
+      r = 1 + 2*m_fatSize + ROOT16_BLOCKS;
+      if (m_dataStart >= m_alignBlocks + r) {
+        break;
+      }
+    }
+    m_relSector = m_dataStart - r;
+    m_reservedBlocks = 1;
+    m_partSize = m_clusterCount*m_blocksPerCluster + r;
+    return 4085 <= m_clusterCount && m_clusterCount < 65525;
+  }
+  // The partition starts on a boundary unit.  The reserved area is padded
+  // so the data area also starts on one.  A very large allocation unit can
+  // need more padding than the reserved count holds, so then the partition
+  // only starts on a 4 MiB boundary.
+  bool layoutFat32() {
+    m_relSector = m_alignBlocks;
+    for (m_dataStart = 2*m_alignBlocks;; m_dataStart += m_alignBlocks) {
+      if (m_dataStart >= m_blockCount) {
+        return false;
+      }
+      m_clusterCount = (m_blockCount - m_dataStart)/m_blocksPerCluster;
+      m_fatSize = (m_clusterCount + 2 + 127)/128;
+      if (m_dataStart >= m_relSector + 9 + 2*m_fatSize) {
+        break;
+      }
+    }
+    m_reservedBlocks = m_dataStart - m_relSector - 2*m_fatSize;
+    if (m_reservedBlocks > 0XFFFF) {
+      // The reserved count is 16 bits.  Move the partition up in 4 MiB
+      // steps, the data area stays on a boundary unit.
+      m_relSector += (m_reservedBlocks - 0XFFFF + 8191) & ~8191UL;
+      m_reservedBlocks = m_dataStart - m_relSector - 2*m_fatSize;
+    }
+    m_partSize = m_clusterCount*m_blocksPerCluster + m_dataStart - m_relSector;
+    return 65525 <= m_clusterCount && m_clusterCount < 0X0FFFFFF5;
+  }
+  bool makeFat16() {
+    fat_boot_t* pb = reinterpret_cast<fat_boot_t*>(m_buf);
+    uint32_t fatStart = m_relSector + m_reservedBlocks;
+    if (!zeroBlocks(fatStart, 2*m_fatSize + ROOT16_BLOCKS)) {
+      return false;
+    }
+    m_buf[0] = 0XF8;
+    m_buf[1] = 0XFF;
+    m_buf[2] = 0XFF;
+    m_buf[3] = 0XFF;
+    if (!writeFatStart(fatStart)) {
+      return false;
+    }
+    initBoot(pb);
+    pb->reservedSectorCount = m_reservedBlocks;
+    pb->rootDirEntryCount = 16*ROOT16_BLOCKS;
+    if (m_partSize < 0X10000) {
+      pb->totalSectors16 = m_partSize;
+    } else {
+      pb->totalSectors32 = m_partSize;
+    }
+    pb->sectorsPerFat16 = m_fatSize;
+    pb->driveNumber = 0X80;
+    pb->bootSignature = EXTENDED_BOOT_SIG;
+    pb->volumeSerialNumber = m_serial;
+    memcpy(pb->volumeLabel, "NO NAME    ", sizeof(pb->volumeLabel));
+    memcpy(pb->fileSystemType, "FAT16   ", sizeof(pb->fileSystemType));
+    pb->bootSectorSig0 = BOOTSIG0;
+    pb->bootSectorSig1 = BOOTSIG1;
+    if (!m_card->writeBlock(m_relSector, m_buf)) {
+      return false;
+    }
+    return writeMbr(m_partSize < 0X10000 ? 0X04 : 0X06, 16);
+  }
+  bool makeFat32() {
+    fat32_boot_t* pb = reinterpret_cast<fat32_boot_t*>(m_buf);
+    fat32_fsinfo_t* pf = reinterpret_cast<fat32_fsinfo_t*>(m_buf);
+    uint32_t fatStart = m_relSector + m_reservedBlocks;
+    uint32_t* fat = reinterpret_cast<uint32_t*>(m_buf);
+    // Reserved area, FATs and the root directory cluster.
+    if (!zeroBlocks(m_relSector,
+                    m_dataStart + m_blocksPerCluster - m_relSector)) {
+      return false;
+    }
+    fat[0] = 0X0FFFFFF8;
+    fat[1] = 0X0FFFFFFF;
+    fat[2] = FAT32EOC;
+    if (!writeFatStart(fatStart)) {
+      return false;
+    }
+    initBoot(reinterpret_cast<fat_boot_t*>(m_buf));
+    pb->reservedSectorCount = m_reservedBlocks;
+    pb->totalSectors32 = m_partSize;
+    pb->sectorsPerFat32 = m_fatSize;
+    pb->fat32RootCluster = 2;
+    pb->fat32FSInfo = 1;
+    pb->fat32BackBootBlock = 6;
+    pb->driveNumber = 0X80;
+    pb->bootSignature = EXTENDED_BOOT_SIG;
+    pb->volumeSerialNumber = m_serial;
+    memcpy(pb->volumeLabel, "NO NAME    ", sizeof(pb->volumeLabel));
+    memcpy(pb->fileSystemType, "FAT32   ", sizeof(pb->fileSystemType));
+    pb->bootSectorSig0 = BOOTSIG0;
+    pb->bootSectorSig1 = BOOTSIG1;
+    if (!m_card->writeBlock(m_relSector, m_buf) ||
+        !m_card->writeBlock(m_relSector + 6, m_buf)) {
+      return false;
+    }
+    memset(m_buf, 0, 512);
+    pf->leadSignature = FSINFO_LEAD_SIG;
+    pf->structSignature = FSINFO_STRUCT_SIG;
+    pf->freeCount = m_clusterCount - 1;
+    pf->nextFree = 3;
+    pf->tailSignature[2] = BOOTSIG0;
+    pf->tailSignature[3] = BOOTSIG1;
+    if (!m_card->writeBlock(m_relSector + 1, m_buf) ||
+        !m_card->writeBlock(m_relSector + 7, m_buf)) {
+      return false;
+    }
+    return writeMbr(m_relSector + m_partSize <= 16450560 ? 0X0B : 0X0C, 32);
+  }
+  // Common part of the FAT16 and FAT32 boot block.
+  void initBoot(fat_boot_t* pb) {
+    memset(m_buf, 0, 512);
+    pb->jump[0] = 0XEB;
+    pb->jump[1] = 0X00;
+    pb->jump[2] = 0X90;
+    memcpy(pb->oemId, "SdFat   ", sizeof(pb->oemId));
+    pb->bytesPerSector = 512;
+    pb->sectorsPerCluster = m_blocksPerCluster;
+    pb->fatCount = 2;
+    pb->mediaType = 0XF8;
+    pb->sectorsPerTrack = m_sectorsPerTrack;
+    pb->headCount = m_heads;
+    pb->hidddenSectors = m_relSector;
+  }
+  // Cylinder, head and sector for an LBA, the maximum if it won't fit.
+  void lbaToChs(uint32_t lba, uint8_t* head, uint8_t* sector,
+                uint16_t* cylinder) {
+    uint32_t track = (uint32_t)m_heads*m_sectorsPerTrack;
+    if (lba < 1024*track) {
+      *cylinder = lba/track;
+      *head = (lba % track)/m_sectorsPerTrack;
+      *sector = (lba % m_sectorsPerTrack) + 1;
+    } else {
+      *cylinder = 1023;
+      *head = 254;
+      *sector = 63;
+    }
+  }
+  // The MBR is written last so a failed format doesn't look like a volume.
+  bool writeMbr(uint8_t partType, uint8_t fatType) {
+    mbr_t* mbr = reinterpret_cast<mbr_t*>(m_buf);
+    part_t* p = mbr->part;
+    uint8_t head;
+    uint8_t sector;
+    uint16_t cylinder;
+    memset(m_buf, 0, 512);
+    lbaToChs(m_relSector, &head, &sector, &cylinder);
+    p->beginHead = head;
+    p->beginSector = sector;
+    p->beginCylinderHigh = cylinder >> 8;
+    p->beginCylinderLow = cylinder;
+    p->type = partType;
+    lbaToChs(m_relSector + m_partSize - 1, &head, &sector, &cylinder);
+    p->endHead = head;
+    p->endSector = sector;
+    p->endCylinderHigh = cylinder >> 8;
+    p->endCylinderLow = cylinder;
+    p->firstSector = m_relSector;
+    p->totalSectors = m_partSize;
+    mbr->mbrSig0 = BOOTSIG0;
+    mbr->mbrSig1 = BOOTSIG1;
+    if (!m_card->writeBlock(0, m_buf) || !m_card->syncBlocks()) {
+      return false;
+    }
+    m_fatType = fatType;
+    if (m_pr) {
+      m_pr->write('\r');
+      m_pr->write('\n');
+    }
+    return true;
+  }
+  // Copy the first FAT block in m_buf to both FATs.
+  bool writeFatStart(uint32_t fatStart) {
+    return m_card->writeBlock(fatStart, m_buf) &&
+           m_card->writeBlock(fatStart + m_fatSize, m_buf);
+  }
+  // Zero blocks with multi-block writes.  Extended cards may hold a
+  // write sequence open so end it first.  SdioCard limits a sequence to
+  // 0XFFFF blocks, so larger areas take several.
+  bool zeroBlocks(uint32_t lbn, uint32_t count) {
+    memset(m_buf, 0, 512);
+    if (!m_card->syncBlocks()) {
+      return false;
+    }
+    for (uint32_t nb = 0; nb < count;) {
+      uint32_t run = count - nb < 0XFFFF ? count - nb : 0XFFFF;
+      if (!m_card->writeStart(lbn + nb, run)) {
+        return false;
+      }
+      for (uint32_t end = nb + run; nb < end; nb++) {
+        if (m_pr && (nb & 0XFF) == 0) {
+          m_pr->write('.');
+        }
+        if (!m_card->writeData(m_buf)) {
+          return false;
+        }
+      }
+      if (!m_card->writeStop()) {
+        return false;
+      }
+    }
+    return true;
+  }
+  static const uint16_t ROOT16_BLOCKS = 32;
+  CardClass* m_card;
+  uint8_t* m_buf;
+  print_t* m_pr;
+  uint8_t m_fatType;
+  uint8_t m_blocksPerCluster;
+  uint8_t m_heads;
+  uint8_t m_sectorsPerTrack;
+  uint32_t m_alignBlocks;
+  uint32_t m_blockCount;
+  uint32_t m_clusterCount;
+  uint32_t m_dataStart;
+  uint32_t m_fatSize;
+  uint32_t m_partSize;
+  uint32_t m_relSector;
+  uint32_t m_reservedBlocks;
+  uint32_t m_serial;
+};
+#endif  // SdFormatter_h
@@ -38,6 +38,15 @@
 #define SDCARD_SPI SPI
 #endif  // SDCARD_SPI
 //-----------------------------------------------------------------------------
+/** SD_SPI_ASYNC_RECEIVE is nonzero if SdSpiAltDriver can receive in the
+ *  background with receiveStart() and receiveFinish().
+ */
+#if defined(__SAM3X8E__) || defined(__SAM3X8H__)
+#define SD_SPI_ASYNC_RECEIVE 1
+#else  // SD_SPI_ASYNC_RECEIVE
+#define SD_SPI_ASYNC_RECEIVE 0
+#endif  // SD_SPI_ASYNC_RECEIVE
+//-----------------------------------------------------------------------------
 /**
  * \class SdSpiLibDriver
  * \brief SdSpiLibDriver - use standard SPI library.
@@ -156,6 +165,21 @@ class SdSpiAltDriver {
   * \return Zero for no error or nonzero error code.
   */
   uint8_t receive(uint8_t* buf, size_t n);
+#if SD_SPI_ASYNC_RECEIVE || defined(DOXYGEN)
+  /** Start receiving multiple bytes in the background.
+  *
+  * \param[out] buf Buffer to receive the data.
+  * \param[in] n Number of bytes to receive.
+  *
+  * \note No other SPI access is allowed until receiveFinish() is called.
+  */
+  void receiveStart(uint8_t* buf, size_t n);
+  /** Wait for a receive started by receiveStart() to complete.
+  *
+  * \return Zero for no error or nonzero error code.
+  */
+  uint8_t receiveFinish();
+#endif  // SD_SPI_ASYNC_RECEIVE
   /** Send a byte.
    *
    * \param[in] data Byte to send
@@ -239,9 +263,7 @@ class SdSpiSoftDriver : public SdSpiBaseDriver {
   * \return Zero for no error or nonzero error code.
   */
   uint8_t receive(uint8_t* buf, size_t n) {
-    for (size_t i = 0; i < n; i++) {
-      buf[i] = receive();
-    }
+    m_spi.receive(buf, n);
     return 0;
   }
   /** Send a byte.
@@ -257,9 +279,7 @@ class SdSpiSoftDriver : public SdSpiBaseDriver {
    * \param[in] n Number of bytes to send.
    */
   void send(const uint8_t* buf , size_t n) {
-    for (size_t i = 0; i < n; i++) {
-      send(buf[i]);
-    }
+    m_spi.send(buf, n);
   }
   /** Set CS low. */
   void select() {
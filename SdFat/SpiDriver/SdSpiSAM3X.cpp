@@ -25,7 +25,11 @@
 #include "SdSpiDriver.h"
 #if defined(__SAM3X8E__) || defined(__SAM3X8H__)
 /** Use SAM3X DMAC if nonzero */
+#ifndef USE_SAM3X_DMAC
 #define USE_SAM3X_DMAC 1
+#endif  // USE_SAM3X_DMAC
+/** Move block data in 16-bit frames if DMAC is not used. */
+#define USE_SAM3X_16BIT_FRAME 1
 /** Use extra Bus Matrix arbitration fix if nonzero */
 #define USE_SAM3X_BUS_MATRIX_FIX 0
 /** Time in ms for DMA receive timeout */
@@ -156,6 +160,66 @@ static inline uint8_t spiTransfer(uint8_t b) {
   return b;
 }
 //------------------------------------------------------------------------------
+#if !USE_SAM3X_DMAC && USE_SAM3X_16BIT_FRAME
+// Set frame size.  Only call with the transmitter empty.
+static inline void spiFrameBits(Spi* pSpi, uint32_t bits) {
+  uint32_t csr = pSpi->SPI_CSR[SPI_CHIP_SEL] & ~SPI_CSR_BITS_Msk;
+  pSpi->SPI_CSR[SPI_CHIP_SEL] = csr | bits;
+}
+//------------------------------------------------------------------------------
+// Wait for a status flag.  Reading SR clears OVRES so it is kept in *sr.
+static inline void spiWaitSR(Spi* pSpi, uint32_t flag, uint32_t* sr) {
+  uint32_t s;
+  do {
+    s = pSpi->SPI_SR;
+    *sr |= s;
+  } while ((s & flag) == 0);
+}
+//------------------------------------------------------------------------------
+// Receive an even number of bytes in 16-bit frames.  The next frame waits
+// in TDR so SCK runs without gaps between frames.  A frame is lost if an
+// interrupt delays reading RDR, so return nonzero if RDR was overrun.
+static uint8_t spiReceive16(Spi* pSpi, uint8_t* buf, size_t n) {
+  uint8_t* limit = buf + n - 2;
+  uint32_t sr = 0;
+  spiFrameBits(pSpi, SPI_CSR_BITS_16_BIT);
+  // clear overrun error
+  pSpi->SPI_SR;
+  pSpi->SPI_TDR = 0XFFFF;
+  while (buf < limit) {
+    spiWaitSR(pSpi, SPI_SR_TDRE, &sr);
+    pSpi->SPI_TDR = 0XFFFF;
+    spiWaitSR(pSpi, SPI_SR_RDRF, &sr);
+    uint16_t w = pSpi->SPI_RDR;
+    *buf++ = w >> 8;
+    *buf++ = w;
+  }
+  spiWaitSR(pSpi, SPI_SR_RDRF, &sr);
+  uint16_t w = pSpi->SPI_RDR;
+  *buf++ = w >> 8;
+  *buf = w;
+  spiFrameBits(pSpi, SPI_CSR_BITS_8_BIT);
+  return sr & SPI_SR_OVRES ? 1 : 0;
+}
+//------------------------------------------------------------------------------
+// Send an even number of bytes in 16-bit frames.
+static void spiSend16(Spi* pSpi, const uint8_t* buf, size_t n) {
+  const uint8_t* limit = buf + n;
+  while ((pSpi->SPI_SR & SPI_SR_TXEMPTY) == 0) {}
+  spiFrameBits(pSpi, SPI_CSR_BITS_16_BIT);
+  while (buf < limit) {
+    uint16_t w = *buf++ << 8;
+    w |= *buf++;
+    while ((pSpi->SPI_SR & SPI_SR_TDRE) == 0) {}
+    pSpi->SPI_TDR = w;
+  }
+  while ((pSpi->SPI_SR & SPI_SR_TXEMPTY) == 0) {}
+  spiFrameBits(pSpi, SPI_CSR_BITS_8_BIT);
+}
+// Result of the last spiReceive16() for receiveFinish().
+static uint8_t m_rxStatus = 0;
+#endif  // !USE_SAM3X_DMAC && USE_SAM3X_16BIT_FRAME
+//------------------------------------------------------------------------------
 /** SPI receive a byte */
 uint8_t SdSpiAltDriver::receive() {
   return spiTransfer(0XFF);
@@ -163,15 +227,40 @@ uint8_t SdSpiAltDriver::receive() {
 //------------------------------------------------------------------------------
 /** SPI receive multiple bytes */
 uint8_t SdSpiAltDriver::receive(uint8_t* buf, size_t n) {
+  receiveStart(buf, n);
+  return receiveFinish();
+}
+//------------------------------------------------------------------------------
+/** Start SPI receive of multiple bytes */
+void SdSpiAltDriver::receiveStart(uint8_t* buf, size_t n) {
   Spi* pSpi = SPI0;
-  int rtn = 0;
 #if USE_SAM3X_DMAC
   // clear overrun error
   uint32_t s = pSpi->SPI_SR;
 
   spiDmaRX(buf, n);
   spiDmaTX(0, n);
-
+#elif USE_SAM3X_16BIT_FRAME
+  // get one byte if n is odd
+  if (n & 1) {
+    *buf++ = spiTransfer(0XFF);
+    n--;
+  }
+  m_rxStatus = n ? spiReceive16(pSpi, buf, n) : 0;
+#else  // USE_SAM3X_DMAC
+  for (size_t i = 0; i < n; i++) {
+    pSpi->SPI_TDR = 0XFF;
+    while ((pSpi->SPI_SR & SPI_SR_RDRF) == 0) {}
+    buf[i] = pSpi->SPI_RDR;
+  }
+#endif  // USE_SAM3X_DMAC
+}
+//------------------------------------------------------------------------------
+/** Wait for SPI receive of multiple bytes */
+uint8_t SdSpiAltDriver::receiveFinish() {
+  int rtn = 0;
+#if USE_SAM3X_DMAC
+  Spi* pSpi = SPI0;
   uint32_t m = millis();
   while (!dmac_channel_transfer_done(SPI_DMAC_RX_CH)) {
     if ((millis() - m) > SAM3X_DMA_TIMEOUT)  {
@@ -184,12 +273,8 @@ uint8_t SdSpiAltDriver::receive(uint8_t* buf, size_t n) {
   if (pSpi->SPI_SR & SPI_SR_OVRES) {
     rtn |= 1;
   }
-#else  // USE_SAM3X_DMAC
-  for (size_t i = 0; i < n; i++) {
-    pSpi->SPI_TDR = 0XFF;
-    while ((pSpi->SPI_SR & SPI_SR_RDRF) == 0) {}
-    buf[i] = pSpi->SPI_RDR;
-  }
+#elif USE_SAM3X_16BIT_FRAME
+  rtn = m_rxStatus;
 #endif  // USE_SAM3X_DMAC
   return rtn;
 }
@@ -204,6 +289,15 @@ void SdSpiAltDriver::send(const uint8_t* buf , size_t n) {
 #if USE_SAM3X_DMAC
   spiDmaTX(buf, n);
   while (!dmac_channel_transfer_done(SPI_DMAC_TX_CH)) {}
+#elif USE_SAM3X_16BIT_FRAME
+  // send one byte if n is odd
+  if (n & 1) {
+    spiTransfer(*buf++);
+    n--;
+  }
+  if (n) {
+    spiSend16(pSpi, buf, n);
+  }
 #else  // #if USE_SAM3X_DMAC
   while ((pSpi->SPI_SR & SPI_SR_TXEMPTY) == 0) {}
   for (size_t i = 0; i < n; i++) {
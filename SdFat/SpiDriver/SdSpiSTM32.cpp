@@ -24,6 +24,7 @@
  */
 #if defined(__STM32F1__) || defined(__STM32F4__)
 #include "SdSpiDriver.h"
+#ifndef USE_STM32_DMA
 #if defined(__STM32F1__)
 #define USE_STM32_DMA 1
 #elif defined(__STM32F4__)
@@ -31,6 +32,9 @@
 #else  // defined(__STM32F1__)
 #error Unknown STM32 type
 #endif  // defined(__STM32F1__)
+#endif  // USE_STM32_DMA
+/** Move block data in 16-bit frames if DMA is not used. */
+#define USE_STM32_16BIT_FRAME 1
 //------------------------------------------------------------------------------
 static SPIClass m_SPI1(1);
 #if BOARD_NR_SPI >= 2
@@ -42,6 +46,74 @@ static SPIClass m_SPI3(3);
 #if BOARD_NR_SPI > 3
 #error BOARD_NR_SPI too large
 #endif
+#if !USE_STM32_DMA && USE_STM32_16BIT_FRAME
+//------------------------------------------------------------------------------
+// Set 8 or 16-bit frames.  DFF may only be changed with the SPI disabled.
+static void spiDataSize16(spi_reg_map* regs, bool wide) {
+  while (regs->SR & SPI_SR_BSY) {}
+  regs->CR1 &= ~SPI_CR1_SPE;
+  if (wide) {
+    regs->CR1 |= SPI_CR1_DFF;
+  } else {
+    regs->CR1 &= ~SPI_CR1_DFF;
+  }
+  regs->CR1 |= SPI_CR1_SPE;
+}
+//------------------------------------------------------------------------------
+// Wait for a status flag.  Reading DR then SR clears OVR so it is kept
+// in *sr.
+static inline void spiWaitSR(spi_reg_map* regs, uint32_t flag, uint32_t* sr) {
+  uint32_t s;
+  do {
+    s = regs->SR;
+    *sr |= s;
+  } while ((s & flag) == 0);
+}
+//------------------------------------------------------------------------------
+// Receive an even number of bytes in 16-bit frames.  The next frame waits
+// in DR so SCK runs without gaps between frames.  A frame is lost if an
+// interrupt delays reading DR, so return nonzero if DR was overrun.
+static uint8_t spiReceive16(spi_reg_map* regs, uint8_t* buf, size_t n) {
+  uint8_t* limit = buf + n - 2;
+  uint32_t sr = 0;
+  spiDataSize16(regs, true);
+  // discard stale data and clear overrun
+  regs->DR;
+  regs->SR;
+  regs->DR = 0XFFFF;
+  while (buf < limit) {
+    spiWaitSR(regs, SPI_SR_TXE, &sr);
+    regs->DR = 0XFFFF;
+    spiWaitSR(regs, SPI_SR_RXNE, &sr);
+    uint16_t w = regs->DR;
+    *buf++ = w >> 8;
+    *buf++ = w;
+  }
+  spiWaitSR(regs, SPI_SR_RXNE, &sr);
+  uint16_t w = regs->DR;
+  *buf++ = w >> 8;
+  *buf = w;
+  spiDataSize16(regs, false);
+  return sr & SPI_SR_OVR ? 1 : 0;
+}
+//------------------------------------------------------------------------------
+// Send an even number of bytes in 16-bit frames.
+static void spiSend16(spi_reg_map* regs, const uint8_t* buf, size_t n) {
+  const uint8_t* limit = buf + n;
+  spiDataSize16(regs, true);
+  while (buf < limit) {
+    uint16_t w = *buf++ << 8;
+    w |= *buf++;
+    while (!(regs->SR & SPI_SR_TXE)) {}
+    regs->DR = w;
+  }
+  while (!(regs->SR & SPI_SR_TXE)) {}
+  spiDataSize16(regs, false);
+  // leave DR empty and clear overrun
+  regs->DR;
+  regs->SR;
+}
+#endif  // !USE_STM32_DMA && USE_STM32_16BIT_FRAME
 //------------------------------------------------------------------------------
 /** Set SPI options for access to SD/SDHC cards.
  *
@@ -87,6 +159,13 @@ uint8_t SdSpiAltDriver::receive() {
 uint8_t SdSpiAltDriver::receive(uint8_t* buf, size_t n) {
 #if USE_STM32_DMA
   return m_spi->dmaTransfer(0, buf, n);
+#elif USE_STM32_16BIT_FRAME
+  // get one byte if n is odd
+  if (n & 1) {
+    *buf++ = m_spi->transfer(0XFF);
+    n--;
+  }
+  return n ? spiReceive16(m_spi->dev()->regs, buf, n) : 0;
 #else  // USE_STM32_DMA
   m_spi->read(buf, n);
   return 0;
@@ -109,6 +188,15 @@ void SdSpiAltDriver::send(uint8_t b) {
 void SdSpiAltDriver::send(const uint8_t* buf , size_t n) {
 #if USE_STM32_DMA
   m_spi->dmaTransfer(const_cast<uint8*>(buf), 0, n);
+#elif USE_STM32_16BIT_FRAME
+  // send one byte if n is odd
+  if (n & 1) {
+    m_spi->transfer(*buf++);
+    n--;
+  }
+  if (n) {
+    spiSend16(m_spi->dev()->regs, buf, n);
+  }
 #else  // USE_STM32_DMA
   m_spi->write(const_cast<uint8*>(buf), n);
 #endif  // USE_STM32_DMA
@@ -188,9 +188,105 @@ void SdSpiAltDriver::send(const uint8_t* buf , size_t n) {
   }
 #endif  // SPI_USE_8BIT_FRAME
 }
+#elif defined(KINETISL)
+//==============================================================================
+// Teensy LC SPI0 has a transmit buffer but no FIFO.  Block data uses 16-bit
+// frames with the next frame waiting in the buffer.  SPI0 has no overrun
+// flag, so interrupts are held off from queuing a frame until the one
+// before it is read.
+//------------------------------------------------------------------------------
+/** Receive a byte.
+ *
+ * \return The byte.
+ */
+uint8_t SdSpiAltDriver::receive() {
+  return SPI.transfer(0XFF);
+}
+/** Receive multiple bytes.
+ *
+ * \param[out] buf Buffer to receive the data.
+ * \param[in] n Number of bytes to receive.
+ *
+ * \return Zero for no error or nonzero error code.
+ */
+uint8_t SdSpiAltDriver::receive(uint8_t* buf, size_t n) {
+  // get one byte if n is odd
+  if (n & 1) {
+    *buf++ = SPI.transfer(0XFF);
+    n--;
+  }
+  if (n == 0) {
+    return 0;
+  }
+  uint8_t* limit = buf + n - 2;
+  SPI0_C2 |= SPI_C2_SPIMODE;
+  // clear SPRF
+  SPI0_S;
+  SPI0_DL;
+  SPI0_DL = 0XFF;
+  SPI0_DH = 0XFF;
+  while (buf < limit) {
+    while (!(SPI0_S & SPI_S_SPTEF)) {}
+    noInterrupts();
+    SPI0_DL = 0XFF;
+    SPI0_DH = 0XFF;
+    while (!(SPI0_S & SPI_S_SPRF)) {}
+    // DL read last clears SPRF
+    buf[0] = SPI0_DH;
+    buf[1] = SPI0_DL;
+    interrupts();
+    buf += 2;
+  }
+  while (!(SPI0_S & SPI_S_SPRF)) {}
+  buf[0] = SPI0_DH;
+  buf[1] = SPI0_DL;
+  SPI0_C2 &= ~SPI_C2_SPIMODE;
+  return 0;
+}
+/** Send a byte.
+ *
+ * \param[in] b Byte to send
+ */
+void SdSpiAltDriver::send(uint8_t b) {
+  SPI.transfer(b);
+}
+/** Send multiple bytes.
+ *
+ * \param[in] buf Buffer for data to be sent.
+ * \param[in] n Number of bytes to send.
+ */
+void SdSpiAltDriver::send(const uint8_t* buf , size_t n) {
+  // send one byte if n is odd
+  if (n & 1) {
+    SPI.transfer(*buf++);
+    n--;
+  }
+  if (n == 0) {
+    return;
+  }
+  const uint8_t* limit = buf + n;
+  SPI0_C2 |= SPI_C2_SPIMODE;
+  SPI0_S;
+  // first frame goes straight to the shifter
+  SPI0_DL = buf[1];
+  SPI0_DH = buf[0];
+  buf += 2;
+  while (buf < limit) {
+    while (!(SPI0_S & SPI_S_SPTEF)) {}
+    SPI0_DL = buf[1];
+    SPI0_DH = buf[0];
+    buf += 2;
+    // discard received frame
+    while (!(SPI0_S & SPI_S_SPRF)) {}
+    SPI0_DL;
+  }
+  while (!(SPI0_S & SPI_S_SPRF)) {}
+  SPI0_DL;
+  SPI0_C2 &= ~SPI_C2_SPIMODE;
+}
 #else  // KINETISK
 //==============================================================================
-// Use standard SPI library if not KINETISK
+// Use standard SPI library if not KINETISK or KINETISL
 //------------------------------------------------------------------------------
 /** Receive a byte.
  *
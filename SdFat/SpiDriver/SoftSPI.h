@@ -58,8 +58,8 @@ class SoftSPI {
   /** Initialize SoftSPI pins. */
   void begin() {
     fastPinConfig(MisoPin, MISO_MODE, MISO_LEVEL);
-    fastPinConfig(MosiPin, MOSI_MODE, !MODE_CPHA(Mode));
-    fastPinConfig(SckPin, SCK_MODE, MODE_CPOL(Mode));
+    fastPinConfig(MosiPin, MOSI_MODE, !CPHA);
+    fastPinConfig(SckPin, SCK_MODE, CPOL);
   }
   //----------------------------------------------------------------------------
   /** Soft SPI receive byte.
@@ -79,6 +79,21 @@ class SoftSPI {
     return data;
   }
   //----------------------------------------------------------------------------
+  /** Soft SPI receive bytes with MOSI held high.
+   *
+   * SD cards expect 0XFF on MOSI while data is read so MOSI is set once
+   * and the loop only clocks SCK and samples MISO.
+   *
+   * @param[out] buf Buffer for data received.
+   * @param[in] n Number of bytes to receive.
+   */
+  void receive(uint8_t* buf, size_t n) {
+    fastDigitalWrite(MosiPin, 1);
+    for (size_t i = 0; i < n; i++) {
+      buf[i] = receive();
+    }
+  }
+  //----------------------------------------------------------------------------
   /** Soft SPI send byte.
    * @param[in] data Data byte to send.
    */
@@ -94,6 +109,16 @@ class SoftSPI {
     sendBit(0, data);
   }
   //----------------------------------------------------------------------------
+  /** Soft SPI send bytes.
+   * @param[in] buf Data to send.
+   * @param[in] n Number of bytes to send.
+   */
+  void send(const uint8_t* buf, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      send(buf[i]);
+    }
+  }
+  //----------------------------------------------------------------------------
   /** Soft SPI transfer byte.
    * @param[in] txData Data byte to send.
    * @return Data byte received.
@@ -114,51 +139,62 @@ class SoftSPI {
 
  private:
   //----------------------------------------------------------------------------
+  // Mode is a template argument so these fold at compile time and each bit
+  // function reduces to the pin writes for that mode.
+  static const bool CPHA = (Mode & 1) != 0;
+  static const bool CPOL = (Mode & 2) != 0;
+  //----------------------------------------------------------------------------
+  // Move SCK to level.  SCK always idles at CPOL between bits so every call
+  // changes the level.  On AVR that is one write to the PIN register, which
+  // needs no interrupt lock even for ports above 0X3F.
   inline __attribute__((always_inline))
-  bool MODE_CPHA(uint8_t mode) {return (mode & 1) != 0;}
-  inline __attribute__((always_inline))
-  bool MODE_CPOL(uint8_t mode) {return (mode & 2) != 0;}
+  void sckWrite(bool level) {
+#ifdef __AVR__
+    (void)level;
+    fastDigitalToggle(SckPin);
+#else  // __AVR__
+    fastDigitalWrite(SckPin, level);
+#endif  // __AVR__
+  }
+  //----------------------------------------------------------------------------
   inline __attribute__((always_inline))
   void receiveBit(uint8_t bit, uint8_t* data) {
-    if (MODE_CPHA(Mode)) {
-      fastDigitalWrite(SckPin, !MODE_CPOL(Mode));
+    if (CPHA) {
+      sckWrite(!CPOL);
     }
     nop;
     nop;
-    fastDigitalWrite(SckPin,
-      MODE_CPHA(Mode) ? MODE_CPOL(Mode) : !MODE_CPOL(Mode));
+    sckWrite(CPHA ? CPOL : !CPOL);
     if (fastDigitalRead(MisoPin)) *data |= 1 << bit;
-    if (!MODE_CPHA(Mode)) {
-      fastDigitalWrite(SckPin, MODE_CPOL(Mode));
+    if (!CPHA) {
+      sckWrite(CPOL);
     }
   }
   //----------------------------------------------------------------------------
   inline __attribute__((always_inline))
   void sendBit(uint8_t bit, uint8_t data) {
-    if (MODE_CPHA(Mode)) {
-      fastDigitalWrite(SckPin, !MODE_CPOL(Mode));
+    if (CPHA) {
+      sckWrite(!CPOL);
     }
     fastDigitalWrite(MosiPin, data & (1 << bit));
-    fastDigitalWrite(SckPin,
-      MODE_CPHA(Mode) ? MODE_CPOL(Mode) : !MODE_CPOL(Mode));
+    sckWrite(CPHA ? CPOL : !CPOL);
     nop;
     nop;
-    if (!MODE_CPHA(Mode)) {
-      fastDigitalWrite(SckPin, MODE_CPOL(Mode));
+    if (!CPHA) {
+      sckWrite(CPOL);
     }
   }
   //----------------------------------------------------------------------------
   inline __attribute__((always_inline))
   void transferBit(uint8_t bit, uint8_t* rxData, uint8_t txData) {
-    if (MODE_CPHA(Mode)) {
-      fastDigitalWrite(SckPin, !MODE_CPOL(Mode));
+    if (CPHA) {
+      sckWrite(!CPOL);
     }
     fastDigitalWrite(MosiPin, txData & (1 << bit));
-    fastDigitalWrite(SckPin,
-      MODE_CPHA(Mode) ? MODE_CPOL(Mode) : !MODE_CPOL(Mode));
+    sckWrite(CPHA ? CPOL : !CPOL);
     if (fastDigitalRead(MisoPin)) *rxData |= 1 << bit;
-    if (!MODE_CPHA(Mode)) {
-      fastDigitalWrite(SckPin, MODE_CPOL(Mode));
+    if (!CPHA) {
+      sckWrite(CPOL);
     }
   }
   //----------------------------------------------------------------------------
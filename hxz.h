@@ -0,0 +1,38 @@
+/* HXZ compressed firmware image format
+ *
+ * A .hxz file holds the same flash image as an Intel hex file, but as raw
+ * binary bytes squeezed with a small-window LZSS codec.  The window is only
+ * 256 bytes so the decoder fits comfortably in AVR RAM, and the image is
+ * decoded straight into flash page blocks without ever buffering it whole.
+ *
+ * File layout (all multi-byte fields little endian):
+ *
+ *   offset  size  field
+ *   0       4     magic "HXZ1"
+ *   4       2     byte address of first image byte (multiple of the page size)
+ *   6       4     image length in bytes
+ *   10      2     16-bit sum of all image bytes (integrity check)
+ *   12      ...   LZSS stream
+ *
+ * LZSS stream: a flag byte describes the next 8 items, least significant bit
+ * first.  A set bit is a literal byte.  A clear bit is a 2 byte match:
+ * (distance - 1), (length - HXZ_MIN_MATCH).  Matches may overlap the bytes
+ * they produce, so long runs of 0xFF cost a single token.
+ *
+ * Use tools/hex2hxz.cpp to build .hxz files from Intel hex on a PC.
+ */
+
+#ifndef HXZ_H
+#define HXZ_H
+
+#define HXZ_MAGIC_0        'H'
+#define HXZ_MAGIC_1        'X'
+#define HXZ_MAGIC_2        'Z'
+#define HXZ_MAGIC_3        '1'
+
+#define HXZ_HEADER_SIZE    12
+#define HXZ_WINDOW_SIZE    256   //Must stay 256 so a byte index wraps for free
+#define HXZ_MIN_MATCH      3
+#define HXZ_MAX_MATCH      (HXZ_MIN_MATCH + 255)
+
+#endif
@@ -0,0 +1,61 @@
+/* Serial upload protocol
+ *
+ * Lets a PC stream an image straight into the target over the host Arduino's
+ * USB serial port, with no SD card swap.  The PC side is tools/stk_upload.cpp.
+ *
+ * The PC starts an upload by sending the ascii command '2', then sends frames:
+ *
+ *   UPLOAD_SOF, type, payload length, payload..., crc16 low, crc16 high
+ *
+ * The CRC is CRC-CCITT (poly 0x1021, initial value 0xFFFF) over the type,
+ * length and payload bytes.
+ *
+ *   UPLOAD_FRAME_BEGIN  image length (4 bytes LE), base byte address (2 bytes LE),
+ *                       flags, optional file name to save the image to on SD
+ *   UPLOAD_FRAME_PAGE   word address (2 bytes LE), up to 128 bytes of page data
+ *   UPLOAD_FRAME_END    no payload - leave programming mode
+ *   UPLOAD_FRAME_ABORT  no payload - give up
+ *
+ * Pages must be sent in order, starting at the base address and covering
+ * exactly the announced image length.  A page outside that range, or an END
+ * before the whole image has arrived, gets UPLOAD_REPLY_BAD_FRAME and the
+ * upload is abandoned.
+ *
+ * The Arduino answers every frame with UPLOAD_SOF, reply code, ~reply code.
+ * Anything else coming back is ordinary debug text and can be shown as is.
+ *
+ * Flow control: the PC sends one frame and waits for its reply.  A page frame
+ * is acknowledged once the page has been programmed and verified, so a host
+ * port with a small receive buffer never has to hold a frame while the target
+ * is busy.  A programming or verify failure is the reply to that page.
+ * UPLOAD_REPLY_RESEND asks for the last frame again.
+ */
+
+#ifndef SERIAL_UPLOAD_H
+#define SERIAL_UPLOAD_H
+
+#define UPLOAD_SOF                 0x7E
+
+//Frame types (PC -> Arduino)
+#define UPLOAD_FRAME_BEGIN         0x01
+#define UPLOAD_FRAME_PAGE          0x02
+#define UPLOAD_FRAME_END           0x03
+#define UPLOAD_FRAME_ABORT         0x04
+
+//Reply codes (Arduino -> PC)
+#define UPLOAD_REPLY_ACK           0x06  //Frame accepted, send the next one
+#define UPLOAD_REPLY_RESEND        0x15  //Frame damaged, send it again
+#define UPLOAD_REPLY_DONE          0x17  //Image programmed and verified
+#define UPLOAD_REPLY_TARGET_ERROR  0x18  //Target did not sync, program or verify
+#define UPLOAD_REPLY_SD_ERROR      0x19  //Write-through copy on SD failed
+#define UPLOAD_REPLY_BAD_FRAME     0x1A  //Frame not valid at this point
+
+//UPLOAD_FRAME_BEGIN flags
+#define UPLOAD_FLAG_SAVE_TO_SD     0x01  //Also write the image to SD as Intel hex
+
+#define UPLOAD_PAGE_BYTES          128   //Must match BYTES_PER_FLASH_BLOCK
+#define UPLOAD_MAX_PAYLOAD         (2 + UPLOAD_PAGE_BYTES)
+#define UPLOAD_MAX_FILE_NAME       32
+#define UPLOAD_FRAME_TIMEOUT_MS    5000  //Give up if the PC goes quiet this long
+
+#endif
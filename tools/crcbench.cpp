@@ -0,0 +1,184 @@
+/**
+*
+*
+
+SD CRC benchmark on a PC.  Times the CRC_CCITT() and CRC7() functions from
+SdFat/SdCard/SdCrc.cpp, checks them against a bit-at-a-time reference, and
+shows what the data CRC costs against the time the SPI bus needs to move the
+same block.
+
+The function is chosen at compile time by USE_SD_CRC, so build one binary per
+setting and compare:
+
+   for n in 1 2 3; do
+     g++ -O2 -std=gnu++11 -I tools/linux -I SdFat -DUSE_SD_CRC=$n \
+         -o crcbench$n tools/crcbench.cpp SdFat/SdCard/SdCrc.cpp \
+         tools/linux/host_arduino.cpp
+   done
+   ./crcbench3 [-c MHz] [-m MB] [-x factor]
+
+   -c   SPI clock in MHz used for the bus time estimate (default 25)
+   -m   megabytes of data to run through CRC_CCITT() (default 64)
+   -x   multiply CRC times by this factor before comparing with the bus, to
+        stand in for a target CPU that is slower than the PC (default 1)
+
+USE_SD_CRC 4 needs the Teensy 3.x CRC module and builds as 3 on a PC.
+
+*
+*/
+
+#if !defined(ARDUINO) && !defined(PLATFORM_ID)
+
+/*=============================================>>>>>
+= Dependencies =
+===============================================>>>>>*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "Arduino.h"
+#include "SdCard/SdCrc.h"
+
+#if !USE_SD_CRC
+#error build with -DUSE_SD_CRC=1, 2 or 3
+#endif  // USE_SD_CRC
+
+/*=============================================>>>>>
+= Definitions =
+===============================================>>>>>*/
+#define BLOCK_BYTES 512
+#define BLOCK_COUNT 64              //Blocks in the test buffer
+#define CHECK_COUNT 1000            //Random buffers checked against reference
+#define CMD_COUNT 1000000           //CRC7 calls timed
+
+static uint8_t blocks[BLOCK_COUNT][BLOCK_BYTES];
+
+/*=============================================>>>>>
+= Bit-at-a-time reference functions =
+===============================================>>>>>*/
+static uint16_t refCrcCcitt(const uint8_t* data, size_t n) {
+  uint16_t crc = 0;
+  for (size_t i = 0; i < n; i++) {
+    crc ^= data[i] << 8;
+    for (int j = 0; j < 8; j++) {
+      crc = crc & 0X8000 ? (crc << 1) ^ 0X1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static uint8_t refCrc7(const uint8_t* data, size_t n) {
+  uint8_t crc = 0;
+  for (size_t i = 0; i < n; i++) {
+    for (int j = 7; j >= 0; j--) {
+      uint8_t bit = ((data[i] >> j) ^ (crc >> 6)) & 1;
+      crc = (crc << 1) & 0X7F;
+      if (bit) {
+        crc ^= 0X09;
+      }
+    }
+  }
+  return (crc << 1) | 1;
+}
+
+/*=============================================>>>>>
+= Checks =
+===============================================>>>>>*/
+static bool checkFunctions() {
+  static const uint8_t check[] = "123456789";
+  static const uint8_t cmd0[] = {0X40, 0, 0, 0, 0};
+  static const uint8_t cmd8[] = {0X48, 0, 0, 1, 0XAA};
+  bool ok = true;
+  // Published check value for CRC-16/XMODEM and the fixed CRC bytes the
+  // SD spec gives for CMD0 and CMD8.
+  if (CRC_CCITT(check, 9) != 0X31C3) {
+    printf("CRC_CCITT(\"123456789\") %04X, expected 31C3\n",
+           CRC_CCITT(check, 9));
+    ok = false;
+  }
+  if (CRC7(cmd0, 5) != 0X95 || CRC7(cmd8, 5) != 0X87) {
+    printf("CRC7 CMD0 %02X CMD8 %02X, expected 95 87\n",
+           CRC7(cmd0, 5), CRC7(cmd8, 5));
+    ok = false;
+  }
+  for (int i = 0; i < CHECK_COUNT; i++) {
+    uint8_t buf[BLOCK_BYTES];
+    size_t n = i < BLOCK_BYTES ? i : rand() % (BLOCK_BYTES + 1);
+    for (size_t k = 0; k < n; k++) {
+      buf[k] = rand();
+    }
+    if (CRC_CCITT(buf, n) != refCrcCcitt(buf, n)) {
+      printf("CRC_CCITT differs from reference, length %u\n", (unsigned)n);
+      ok = false;
+      break;
+    }
+    if (n <= 6 && CRC7(buf, n) != refCrc7(buf, n)) {
+      printf("CRC7 differs from reference, length %u\n", (unsigned)n);
+      ok = false;
+      break;
+    }
+  }
+  return ok;
+}
+
+/*=============================================>>>>>
+= Main =
+===============================================>>>>>*/
+int main(int argc, char** argv) {
+  double mhz = 25;
+  double factor = 1;
+  unsigned long megabytes = 64;
+  int opt;
+  while ((opt = getopt(argc, argv, "c:m:x:")) != -1) {
+    switch (opt) {
+      case 'c': mhz = atof(optarg); break;
+      case 'm': megabytes = atol(optarg); break;
+      case 'x': factor = atof(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-c MHz] [-m MB] [-x factor]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (mhz <= 0 || megabytes == 0 || factor <= 0) {
+    fprintf(stderr, "usage: %s [-c MHz] [-m MB] [-x factor]\n", argv[0]);
+    return 2;
+  }
+  printf("USE_SD_CRC %u\n", USE_SD_CRC);
+  bool ok = checkFunctions();
+  printf("check %s\n", ok ? "ok" : "FAILED");
+
+  for (int b = 0; b < BLOCK_COUNT; b++) {
+    for (int i = 0; i < BLOCK_BYTES; i++) {
+      blocks[b][i] = rand();
+    }
+  }
+  unsigned long count = megabytes*1048576UL/BLOCK_BYTES;
+  volatile uint16_t sink = 0;
+  unsigned long start = micros();
+  for (unsigned long i = 0; i < count; i++) {
+    sink ^= CRC_CCITT(blocks[i % BLOCK_COUNT], BLOCK_BYTES);
+  }
+  double blockUs = (double)(micros() - start)/count;
+
+  start = micros();
+  for (unsigned long i = 0; i < CMD_COUNT; i++) {
+    sink ^= CRC7(blocks[i % BLOCK_COUNT], 5);
+  }
+  double cmdUs = (double)(micros() - start)/CMD_COUNT;
+  (void)sink;
+
+  printf("CRC_CCITT %8.3f us/block %9.1f MB/s\n", blockUs,
+         BLOCK_BYTES/blockUs);
+  printf("CRC7      %8.3f us/command\n", cmdUs);
+
+  // Data token, block and two CRC bytes at one bit per clock.
+  double busUs = 8*(1 + BLOCK_BYTES + 2)/mhz;
+  double targetUs = factor*blockUs;
+  printf("SPI %.1f MHz, CRC x%.1f: %.1f us/block, CRC off %.0f KB/s,"
+         " CRC on %.0f KB/s (%.0f%%)\n", mhz, factor, busUs,
+         1e6*BLOCK_BYTES/busUs/1024, 1e6*BLOCK_BYTES/(busUs + targetUs)/1024,
+         100*busUs/(busUs + targetUs));
+  return ok ? 0 : 1;
+}
+
+#endif
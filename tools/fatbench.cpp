@@ -0,0 +1,560 @@
+/**
+*
+*
+
+FatLib benchmark on a PC, run against a FAT16/FAT32 image file (for example
+one copied off an SD card with dd).
+
+The image is loaded into memory and FatLib is run on top of it through a
+BaseBlockDriver that counts every block the library asks for, so the numbers
+show exactly how much SD card traffic each access pattern costs.  Writes only
+change the in-memory copy; the image file is never modified.
+
+FatLib settings such as FAT_CACHE_BLOCKS and FAT_FILE_EXTENT_COUNT are compile
+time options, so build one binary per setting and compare:
+
+   for n in 1 4 16; do
+     g++ -O2 -std=gnu++11 -I tools/linux -I SdFat -DFAT_CACHE_BLOCKS=$n \
+         -o fatbench$n tools/fatbench.cpp tools/linux/host_arduino.cpp \
+         SdFat/FatLib/FatFile.cpp SdFat/FatLib/FatFileLFN.cpp \
+         SdFat/FatLib/FatFileSFN.cpp SdFat/FatLib/FatVolume.cpp \
+         SdFat/FatLib/FmtNumber.cpp
+   done
+   ./fatbench4 [-l us] card.img
+
+   -l   simulated SD command latency in microseconds, added to every block
+        device call so times reflect a real card (default 0)
+
+*
+*/
+
+#if !defined(ARDUINO) && !defined(PLATFORM_ID)
+
+/*=============================================>>>>>
+= Dependencies =
+===============================================>>>>>*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "Arduino.h"
+#include "FatLib/FatFileSystem.h"
+#include "RawStreamWriter.h"
+
+/*=============================================>>>>>
+= Definitions =
+===============================================>>>>>*/
+#define CHUNK_BYTES 100            //Typical small application read/write
+#define STREAM_BYTES 16384         //Large reads, eligible for multi-block I/O
+#define WRITE_TEST_BYTES 200000
+#define SEEK_TEST_COUNT 2000
+#define REOPEN_TEST_COUNT 300
+#define MAX_TEST_FILES 64
+#define RAW_TEST_BLOCKS 0X10100UL  //Crosses the 0XFFFF block write sequence limit
+
+/*=============================================>>>>>
+= Block driver over an in-memory image that counts device calls =
+===============================================>>>>>*/
+class ImageBlockDriver : public BaseBlockDriver {
+ public:
+  bool load(const char* path) {
+    FILE* imageFile = fopen(path, "rb");
+    if (!imageFile) {
+      perror(path);
+      return false;
+    }
+    fseek(imageFile, 0, SEEK_END);
+    long len = ftell(imageFile);
+    fseek(imageFile, 0, SEEK_SET);
+    m_blockCount = len / 512;
+    m_image = (uint8_t*)malloc(m_blockCount * 512);
+    if (!m_image || fread(m_image, 512, m_blockCount, imageFile) != m_blockCount) {
+      fprintf(stderr, "%s: could not load image\n", path);
+      fclose(imageFile);
+      return false;
+    }
+    fclose(imageFile);
+    return true;
+  }
+  void setLatency(unsigned long us) {
+    m_latencyUs = us;
+  }
+  void resetCounts() {
+    commands = 0;
+    blocksRead = 0;
+    blocksWritten = 0;
+  }
+  bool readBlock(uint32_t block, uint8_t* dst) {
+    return readBlocks(block, dst, 1);
+  }
+  bool writeBlock(uint32_t block, const uint8_t* src) {
+    return writeBlocks(block, src, 1);
+  }
+  bool readBlocks(uint32_t block, uint8_t* dst, size_t nb) {
+    if (block + nb > m_blockCount) {
+      return false;
+    }
+    command();
+    memcpy(dst, m_image + block * 512, nb * 512);
+    blocksRead += nb;
+    return true;
+  }
+  bool writeBlocks(uint32_t block, const uint8_t* src, size_t nb) {
+    if (block + nb > m_blockCount) {
+      return false;
+    }
+    command();
+    memcpy(m_image + block * 512, src, nb * 512);
+    blocksWritten += nb;
+    return true;
+  }
+  bool syncBlocks() {
+    return true;
+  }
+  //Multi-block write sequence with the SdioCard limits: at most 0XFFFF
+  //blocks, and the sequence ends by itself after count blocks
+  bool writeStart(uint32_t block, uint32_t count) {
+    if (count == 0 || count > 0XFFFF || block + count > m_blockCount) {
+      return false;
+    }
+    command();
+    m_seqBlock = block;
+    m_seqLeft = count;
+    return true;
+  }
+  bool writeData(const uint8_t* src) {
+    if (m_seqLeft == 0) {
+      return false;
+    }
+    memcpy(m_image + m_seqBlock * 512, src, 512);
+    m_seqBlock++;
+    m_seqLeft--;
+    blocksWritten++;
+    return true;
+  }
+  bool writeStop() {
+    command();
+    m_seqLeft = 0;
+    return true;
+  }
+  bool isBusy() {
+    return false;
+  }
+
+  uint32_t commands = 0;
+  uint32_t blocksRead = 0;
+  uint32_t blocksWritten = 0;
+
+ private:
+  void command() {
+    commands++;
+    if (m_latencyUs) {
+      unsigned long start = micros();
+      while (micros() - start < m_latencyUs) {}
+    }
+  }
+  uint8_t* m_image = NULL;
+  size_t m_blockCount = 0;
+  unsigned long m_latencyUs = 0;
+  uint32_t m_seqBlock = 0;
+  uint32_t m_seqLeft = 0;
+};
+
+/*=============================================>>>>>
+= Global variables =
+===============================================>>>>>*/
+static ImageBlockDriver blockDev;
+static FatFileSystem fatFs;
+static char fileNames[MAX_TEST_FILES][13];
+static int numFiles = 0;
+static char subDirName[13];
+
+static uint32_t fnv1a(uint32_t hash, const uint8_t* data, size_t len) {
+  while (len--) {
+    hash ^= *data++;
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+/*=============================================>>>>>
+= Function to list the root directory once so the tests have names to use =
+===============================================>>>>>*/
+static bool findTestFiles() {
+  FatFile root;
+  FatFile entry;
+  if (!root.openRoot(&fatFs)) {
+    return false;
+  }
+  while (entry.openNext(&root, O_READ)) {
+    char name[13];
+    entry.getSFN(name);
+    if (entry.isDir()) {
+      if (!subDirName[0]) {
+        strcpy(subDirName, name);
+      }
+    } else if (numFiles < MAX_TEST_FILES) {
+      strcpy(fileNames[numFiles++], name);
+    }
+    entry.close();
+  }
+  root.close();
+  return numFiles > 0;
+}
+
+/*=============================================>>>>>
+= Tests.  Each returns false on a FatLib error =
+===============================================>>>>>*/
+
+//Open every root file by name and read it in small chunks
+static bool testReadFiles(uint32_t* hash) {
+  uint8_t buf[CHUNK_BYTES];
+  for (int i = 0; i < numFiles; i++) {
+    FatFile file;
+    if (!file.open(fatFs.vwd(), fileNames[i], O_READ)) {
+      return false;
+    }
+    int n;
+    while ((n = file.read(buf, sizeof(buf))) > 0) {
+      *hash = fnv1a(*hash, buf, n);
+    }
+    if (n < 0) {
+      return false;
+    }
+    file.close();
+  }
+  return true;
+}
+
+//Read every root file in large chunks, as when streaming an image or log
+static bool testStreamFiles(uint32_t* hash) {
+  static uint8_t buf[STREAM_BYTES];
+  for (int i = 0; i < numFiles; i++) {
+    FatFile file;
+    if (!file.open(fatFs.vwd(), fileNames[i], O_READ)) {
+      return false;
+    }
+    int n;
+    while ((n = file.read(buf, sizeof(buf))) > 0) {
+      *hash = fnv1a(*hash, buf, n);
+    }
+    if (n < 0) {
+      return false;
+    }
+    file.close();
+  }
+  return true;
+}
+
+//Find the two largest root files, big[0] being the largest
+static bool findLargestFiles(int big[2]) {
+  uint32_t bigSize[2] = {0, 0};
+  big[0] = big[1] = -1;
+  for (int i = 0; i < numFiles; i++) {
+    FatFile file;
+    if (!file.open(fatFs.vwd(), fileNames[i], O_READ)) {
+      return false;
+    }
+    uint32_t size = file.fileSize();
+    file.close();
+    if (size > bigSize[0]) {
+      big[1] = big[0];
+      bigSize[1] = bigSize[0];
+      big[0] = i;
+      bigSize[0] = size;
+    } else if (size > bigSize[1]) {
+      big[1] = i;
+      bigSize[1] = size;
+    }
+  }
+  return true;
+}
+
+//Read the two largest files alternately, as when merging or comparing them
+static bool testInterleaved(uint32_t* hash) {
+  int big[2];
+  if (!findLargestFiles(big)) {
+    return false;
+  }
+  if (big[1] < 0) {
+    return true;
+  }
+  FatFile fileA;
+  FatFile fileB;
+  if (!fileA.open(fatFs.vwd(), fileNames[big[0]], O_READ) ||
+      !fileB.open(fatFs.vwd(), fileNames[big[1]], O_READ)) {
+    return false;
+  }
+  uint8_t buf[CHUNK_BYTES];
+  int nA = 1;
+  int nB = 1;
+  while (nA > 0 || nB > 0) {
+    if (nA > 0 && (nA = fileA.read(buf, sizeof(buf))) > 0) {
+      *hash = fnv1a(*hash, buf, nA);
+    }
+    if (nB > 0 && (nB = fileB.read(buf, sizeof(buf))) > 0) {
+      *hash = fnv1a(*hash, buf, nB);
+    }
+  }
+  return nA == 0 && nB == 0;
+}
+
+//Read small records at pseudo random positions in the largest file, so about
+//half the seeks go backward through its cluster chain
+static bool testRandomSeek(uint32_t* hash) {
+  int big[2];
+  if (!findLargestFiles(big)) {
+    return false;
+  }
+  FatFile file;
+  if (!file.open(fatFs.vwd(), fileNames[big[0]], O_READ)) {
+    return false;
+  }
+  uint32_t size = file.fileSize();
+  uint32_t seed = 1;
+  uint8_t buf[CHUNK_BYTES];
+  for (int i = 0; i < SEEK_TEST_COUNT; i++) {
+    seed = seed*1103515245UL + 12345;
+    if (!file.seekSet((seed >> 8) % size)) {
+      return false;
+    }
+    int n = file.read(buf, sizeof(buf));
+    if (n < 0) {
+      return false;
+    }
+    *hash = fnv1a(*hash, buf, n);
+  }
+  return true;
+}
+
+//Open every file in the first subdirectory by name.  Without a directory
+//index each open scans from the start of the directory
+static bool testSubdirOpen(uint32_t* hash) {
+  if (!subDirName[0]) {
+    return true;
+  }
+  FatFile dir;
+  FatFile entry;
+  if (!dir.open(fatFs.vwd(), subDirName, O_READ)) {
+    return false;
+  }
+  char names[256][13];
+  int count = 0;
+  while (count < 256 && entry.openNext(&dir, O_READ)) {
+    entry.getSFN(names[count++]);
+    entry.close();
+  }
+  for (int i = 0; i < count; i++) {
+    FatFile file;
+    if (!file.open(&dir, names[i], O_READ)) {
+      return false;
+    }
+    uint8_t buf[CHUNK_BYTES];
+    int n;
+    while ((n = file.read(buf, sizeof(buf))) > 0) {
+      *hash = fnv1a(*hash, buf, n);
+    }
+    file.close();
+  }
+  dir.close();
+  return true;
+}
+
+//Open a few root files by absolute path over and over, the way a sketch
+//reopens the same firmware file
+static bool testReopen(uint32_t* hash) {
+  const char* names[3] = {fileNames[numFiles - 1], fileNames[numFiles/2],
+                          fileNames[0]};
+  for (int i = 0; i < REOPEN_TEST_COUNT; i++) {
+    char path[16];
+    snprintf(path, sizeof(path), "/%s", names[i % 3]);
+    FatFile file;
+    if (!file.open(fatFs.vwd(), path, O_READ)) {
+      return false;
+    }
+    uint8_t buf[CHUNK_BYTES];
+    int n = file.read(buf, sizeof(buf));
+    if (n < 0) {
+      return false;
+    }
+    *hash = fnv1a(*hash, buf, n);
+    file.close();
+  }
+  return true;
+}
+
+//Log style write in small chunks, then remove the file again
+static bool testWrite(uint32_t* hash) {
+  FatFile file;
+  if (!file.open(fatFs.vwd(), "BENCH.LOG", O_RDWR | O_CREAT | O_TRUNC)) {
+    return false;
+  }
+  uint8_t buf[CHUNK_BYTES];
+  for (uint32_t done = 0; done < WRITE_TEST_BYTES; done += sizeof(buf)) {
+    for (size_t i = 0; i < sizeof(buf); i++) {
+      buf[i] = done + i;
+    }
+    if (file.write(buf, sizeof(buf)) != (int)sizeof(buf)) {
+      return false;
+    }
+  }
+  if (!file.seekSet(0)) {
+    return false;
+  }
+  int n;
+  while ((n = file.read(buf, sizeof(buf))) > 0) {
+    *hash = fnv1a(*hash, buf, n);
+  }
+  return file.remove();
+}
+
+//Query free space around a large write, as a logger checking for a full card
+static bool testFreeCount(uint32_t* hash) {
+  int32_t before = fatFs.freeClusterCount();
+  FatFile file;
+  if (before < 0 ||
+      !file.open(fatFs.vwd(), "BENCH.BIG", O_RDWR | O_CREAT | O_TRUNC)) {
+    return false;
+  }
+  static uint8_t buf[STREAM_BYTES];
+  memset(buf, 0X55, sizeof(buf));
+  for (uint32_t done = 0; done < WRITE_TEST_BYTES; done += sizeof(buf)) {
+    if (file.write(buf, sizeof(buf)) != (int)sizeof(buf)) {
+      return false;
+    }
+    if (fatFs.freeClusterCount() < 0) {
+      return false;
+    }
+  }
+  if (!file.sync()) {
+    return false;
+  }
+  uint32_t used = before - fatFs.freeClusterCount();
+  uint32_t clusters = (file.fileSize() + 512*fatFs.blocksPerCluster() - 1)/
+                      (512*fatFs.blocksPerCluster());
+  if (!file.remove() || fatFs.freeClusterCount() != before) {
+    return false;
+  }
+  *hash = fnv1a(*hash, reinterpret_cast<uint8_t*>(&used), sizeof(used));
+  return used == clusters;
+}
+
+//Raw logging through RawStreamWriter, long enough to need a second write
+//sequence, then read back through the file
+static bool testRawStream(uint32_t* hash) {
+  FatFile file;
+  RawStreamWriter<ImageBlockDriver> writer;
+  static uint8_t buf[STREAM_BYTES];
+  if (!file.createContiguous(fatFs.vwd(), "BENCH.RAW", RAW_TEST_BLOCKS*512) ||
+      !writer.begin(&blockDev, &file)) {
+    return false;
+  }
+  for (uint32_t b = 0; b < RAW_TEST_BLOCKS; b++) {
+    memset(buf, 0, 512);
+    memcpy(buf, &b, sizeof(b));
+    if (!writer.writeBlock(buf)) {
+      writer.close(false);
+      file.remove();
+      return false;
+    }
+  }
+  if (!writer.close() || file.fileSize() != RAW_TEST_BLOCKS*512 ||
+      !file.seekSet(0)) {
+    return false;
+  }
+  int n;
+  uint32_t b = 0;
+  while ((n = file.read(buf, sizeof(buf))) > 0) {
+    for (int i = 0; i < n; i += 512, b++) {
+      if (memcmp(buf + i, &b, sizeof(b))) {
+        return false;
+      }
+    }
+    *hash = fnv1a(*hash, buf, n);
+  }
+  return b == RAW_TEST_BLOCKS && file.remove();
+}
+
+struct BenchTest {
+  const char* name;
+  bool (*run)(uint32_t* hash);
+};
+
+static const BenchTest tests[] = {
+  {"read files", testReadFiles},
+  {"stream files", testStreamFiles},
+  {"interleaved read", testInterleaved},
+  {"random seek", testRandomSeek},
+  {"subdir open", testSubdirOpen},
+  {"path reopen", testReopen},
+  {"small writes", testWrite},
+  {"free count", testFreeCount},
+  {"raw stream", testRawStream},
+};
+
+int main(int argc, char** argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "l:")) != -1) {
+    switch (opt) {
+      case 'l': blockDev.setLatency(atol(optarg)); break;
+      default:
+        fprintf(stderr, "usage: %s [-l us] card.img\n", argv[0]);
+        return 2;
+    }
+  }
+  if (argc - optind != 1) {
+    fprintf(stderr, "usage: %s [-l us] card.img\n", argv[0]);
+    return 2;
+  }
+  if (!blockDev.load(argv[optind])) {
+    return 1;
+  }
+  if (!fatFs.begin(&blockDev)) {
+    fprintf(stderr, "%s: no FAT volume found\n", argv[optind]);
+    return 1;
+  }
+  if (!findTestFiles()) {
+    fprintf(stderr, "%s: no files in root directory\n", argv[optind]);
+    return 1;
+  }
+  printf("FAT%u, %u blocks per cluster, FAT_CACHE_BLOCKS %u, FAT_CACHE_WAYS %u%s,"
+         " FAT_FILE_EXTENT_COUNT %u, FAT_FILE_CHECKPOINT_COUNT %u,"
+         " FAT_FREE_BITMAP_BYTES %u, FAT_DIR_INDEX_ENTRIES %u,"
+         " FAT_PATH_CACHE_ENTRIES %u\n",
+         fatFs.fatType(), fatFs.blocksPerCluster(), FAT_CACHE_BLOCKS,
+         FAT_CACHE_WAYS, FAT_CACHE_USE_CLOCK ? ", CLOCK" : "",
+         FAT_FILE_EXTENT_COUNT, FAT_FILE_CHECKPOINT_COUNT,
+         FAT_FREE_BITMAP_BYTES, FAT_DIR_INDEX_ENTRIES,
+         FAT_PATH_CACHE_ENTRIES);
+  printf("%-18s %9s %9s %9s %9s %9s %8s %10s\n", "test", "commands", "blk read",
+         "blk write", "hits", "misses", "us", "hash");
+  int failures = 0;
+  for (size_t t = 0; t < sizeof(tests)/sizeof(tests[0]); t++) {
+    blockDev.resetCounts();
+#if FAT_CACHE_STATS
+    fatFs.cacheResetStats();
+#endif  // FAT_CACHE_STATS
+    uint32_t hash = 2166136261UL;
+    unsigned long start = micros();
+    bool ok = tests[t].run(&hash) && fatFs.vwd()->sync();
+    unsigned long elapsed = micros() - start;
+#if FAT_CACHE_STATS
+    printf("%-18s %9u %9u %9u %9u %9u %8lu   %08X%s\n", tests[t].name,
+           blockDev.commands, blockDev.blocksRead, blockDev.blocksWritten,
+           fatFs.cacheHitCount(), fatFs.cacheMissCount(), elapsed, hash,
+           ok ? "" : " FAILED");
+#else  // FAT_CACHE_STATS
+    printf("%-18s %9u %9u %9u %9s %9s %8lu   %08X%s\n", tests[t].name,
+           blockDev.commands, blockDev.blocksRead, blockDev.blocksWritten,
+           "-", "-", elapsed, hash, ok ? "" : " FAILED");
+#endif  // FAT_CACHE_STATS
+    if (!ok) {
+      failures++;
+    }
+  }
+  return failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,145 @@
+/**
+*
+*
+
+PC side encoder for the .hxz compressed firmware image format (see hxz.h).
+
+Reads an Intel hex file, lays it out as a flat binary image padded with 0xFF
+out to whole flash pages, and squeezes it with the small-window LZSS codec that
+HexFileClass decodes on the Arduino.
+
+Build and run on a PC (this file is not part of the sketch):
+
+   g++ -O2 -o hex2hxz tools/hex2hxz.cpp
+   ./hex2hxz firmware.hex firmware.hxz
+
+*
+*/
+
+#if !defined(ARDUINO) && !defined(PLATFORM_ID)
+
+/*=============================================>>>>>
+= Dependencies =
+===============================================>>>>>*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../hxz.h"
+#include "hexload.h"
+
+/*=============================================>>>>>
+= Global variables =
+===============================================>>>>>*/
+static uint8_t image[MAX_IMAGE_BYTES];
+
+/*=============================================>>>>>
+= LZSS compressor.  Greedy longest match within the last HXZ_WINDOW_SIZE bytes =
+===============================================>>>>>*/
+static size_t compress(const uint8_t* src, size_t srcLen, uint8_t* dst){
+   size_t inPos = 0;
+   size_t outPos = 0;
+   while(inPos < srcLen){
+      size_t flagPos = outPos++;
+      uint8_t flags = 0;
+      for(int item = 0; item < 8 && inPos < srcLen; item++){
+         size_t bestLen = 0;
+         size_t bestDist = 0;
+         size_t maxDist = inPos < HXZ_WINDOW_SIZE ? inPos : HXZ_WINDOW_SIZE;
+         size_t maxLen = srcLen - inPos < HXZ_MAX_MATCH ? srcLen - inPos : HXZ_MAX_MATCH;
+         for(size_t dist = 1; dist <= maxDist; dist++){
+            size_t len = 0;
+            //Matches may run into the bytes they produce
+            while(len < maxLen && src[inPos - dist + len] == src[inPos + len]){
+               len++;
+            }
+            if(len > bestLen){
+               bestLen = len;
+               bestDist = dist;
+               if(len == maxLen){
+                  break;
+               }
+            }
+         }
+         if(bestLen >= HXZ_MIN_MATCH){
+            dst[outPos++] = bestDist - 1;
+            dst[outPos++] = bestLen - HXZ_MIN_MATCH;
+            inPos += bestLen;
+         }
+         else{
+            flags |= 1 << item;
+            dst[outPos++] = src[inPos++];
+         }
+      }
+      dst[flagPos] = flags;
+   }
+   return outPos;
+}
+
+int main(int argc, char** argv){
+   if(argc != 3){
+      fprintf(stderr, "usage: %s firmware.hex firmware.hxz\n", argv[0]);
+      return 2;
+   }
+   uint32_t lowAddr;
+   uint32_t highAddr;
+   if(!loadHex(argv[1], image, &lowAddr, &highAddr)){
+      return 1;
+   }
+   //Start on a flash page boundary so decoded pages line up with the target's pages
+   uint32_t baseAddr = lowAddr - (lowAddr % BYTES_PER_FLASH_BLOCK);
+   uint32_t imageLen = highAddr - baseAddr;
+
+   uint16_t imageSum = 0;
+   for(uint32_t i = 0; i < imageLen; i++){
+      imageSum += image[baseAddr + i];
+   }
+
+   //Worst case is every byte a literal plus one flag byte per 8 bytes
+   uint8_t* packed = (uint8_t*)malloc(HXZ_HEADER_SIZE + imageLen + imageLen / 8 + 1);
+   if(!packed){
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+   packed[0] = HXZ_MAGIC_0;
+   packed[1] = HXZ_MAGIC_1;
+   packed[2] = HXZ_MAGIC_2;
+   packed[3] = HXZ_MAGIC_3;
+   packed[4] = baseAddr & 0xFF;
+   packed[5] = (baseAddr >> 8) & 0xFF;
+   packed[6] = imageLen & 0xFF;
+   packed[7] = (imageLen >> 8) & 0xFF;
+   packed[8] = (imageLen >> 16) & 0xFF;
+   packed[9] = (imageLen >> 24) & 0xFF;
+   packed[10] = imageSum & 0xFF;
+   packed[11] = (imageSum >> 8) & 0xFF;
+   size_t packedLen = HXZ_HEADER_SIZE + compress(image + baseAddr, imageLen, packed + HXZ_HEADER_SIZE);
+
+   FILE* outFile = fopen(argv[2], "wb");
+   if(!outFile){
+      perror(argv[2]);
+      free(packed);
+      return 1;
+   }
+   if(fwrite(packed, 1, packedLen, outFile) != packedLen || fclose(outFile) != 0){
+      perror(argv[2]);
+      free(packed);
+      return 1;
+   }
+   free(packed);
+
+   //Compare against the size of the ascii hex the Arduino would otherwise read
+   FILE* hexFile = fopen(argv[1], "rb");
+   long hexLen = 0;
+   if(hexFile){
+      fseek(hexFile, 0, SEEK_END);
+      hexLen = ftell(hexFile);
+      fclose(hexFile);
+   }
+   printf("image 0x%04X-0x%04X (%u bytes), hex %ld bytes, hxz %zu bytes (%.1f%% of hex)\n",
+          baseAddr, baseAddr + imageLen - 1, imageLen, hexLen, packedLen,
+          hexLen ? 100.0 * packedLen / hexLen : 0.0);
+   return 0;
+}
+
+#endif
@@ -0,0 +1,119 @@
+/**
+*
+*
+
+Intel hex loader shared by the PC side tools.  Loads a hex file into a flat
+64K image buffer padded with 0xFF, checking every record checksum on the way.
+
+*
+*/
+
+#ifndef HEXLOAD_H
+#define HEXLOAD_H
+
+/*=============================================>>>>>
+= Dependencies =
+===============================================>>>>>*/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*=============================================>>>>>
+= Definitions =
+===============================================>>>>>*/
+#define BYTES_PER_FLASH_BLOCK 128   //Must match STK_500_Programmer.h
+#define MAX_IMAGE_BYTES 65536       //16-bit hex addressing only
+
+/*=============================================>>>>>
+= Function to decode a pair of ascii hex digits.  Returns -1 if not hex =
+===============================================>>>>>*/
+static inline int hexByte(const char* str){
+   int value = 0;
+   for(int i = 0; i < 2; i++){
+      char c = str[i];
+      value <<= 4;
+      if(c >= '0' && c <= '9') value |= c - '0';
+      else if(c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+      else if(c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+      else return -1;
+   }
+   return value;
+}
+
+/*=============================================>>>>>
+= Function to load an Intel hex file into image (MAX_IMAGE_BYTES long).
+Fills in the lowest and one-past-highest byte addresses written =
+===============================================>>>>>*/
+static inline bool loadHex(const char* path, uint8_t* image, uint32_t* lowAddr, uint32_t* highAddr){
+   FILE* hexFile = fopen(path, "r");
+   if(!hexFile){
+      perror(path);
+      return false;
+   }
+   memset(image, 0xFF, MAX_IMAGE_BYTES);
+   *lowAddr = MAX_IMAGE_BYTES;
+   *highAddr = 0;
+
+   char line[600];
+   unsigned int lineNum = 0;
+   while(fgets(line, sizeof(line), hexFile)){
+      lineNum++;
+      if(line[0] != ':'){
+         continue;
+      }
+      int byteCount = hexByte(line + 1);
+      int addrHigh = hexByte(line + 3);
+      int addrLow = hexByte(line + 5);
+      int recordType = hexByte(line + 7);
+      if(byteCount < 0 || addrHigh < 0 || addrLow < 0 || recordType < 0){
+         fprintf(stderr, "%s:%u: invalid record\n", path, lineNum);
+         fclose(hexFile);
+         return false;
+      }
+      uint8_t sum = byteCount + addrHigh + addrLow + recordType;
+      uint32_t address = (addrHigh << 8) | addrLow;
+      for(int i = 0; i <= byteCount; i++){
+         int value = hexByte(line + 9 + i * 2);
+         if(value < 0){
+            fprintf(stderr, "%s:%u: invalid record data\n", path, lineNum);
+            fclose(hexFile);
+            return false;
+         }
+         sum += value;
+         if(i < byteCount && recordType == 0){
+            if(address + i >= MAX_IMAGE_BYTES){
+               fprintf(stderr, "%s:%u: address out of range\n", path, lineNum);
+               fclose(hexFile);
+               return false;
+            }
+            image[address + i] = value;
+         }
+      }
+      if(sum != 0){
+         fprintf(stderr, "%s:%u: checksum mismatch\n", path, lineNum);
+         fclose(hexFile);
+         return false;
+      }
+      if(recordType == 1){
+         break;
+      }
+      if(recordType != 0){
+         //Extended address records would need more than 16-bit addressing
+         fprintf(stderr, "%s:%u: record type %02X not supported\n", path, lineNum, recordType);
+         fclose(hexFile);
+         return false;
+      }
+      if(byteCount){
+         if(address < *lowAddr) *lowAddr = address;
+         if(address + byteCount > *highAddr) *highAddr = address + byteCount;
+      }
+   }
+   fclose(hexFile);
+   if(*highAddr == 0){
+      fprintf(stderr, "%s: no data records\n", path);
+      return false;
+   }
+   return true;
+}
+
+#endif
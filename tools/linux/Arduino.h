@@ -0,0 +1,151 @@
+/**
+*
+*
+
+Minimal stand-in for the Arduino core so the programmer core (HexFileClass,
+page assembly and the STK500 engine) builds on a Linux PC.  Only what the core
+actually uses is provided.  Serial goes to stdout.  Serial1 is a termios port
+that host code can attach to an open file descriptor.
+
+Put tools/linux on the include path to use it (see tools/stk_flash.cpp).
+
+*
+*/
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+/*=============================================>>>>>
+= Dependencies =
+===============================================>>>>>*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*=============================================>>>>>
+= Definitions =
+===============================================>>>>>*/
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HEX 16
+#define DEC 10
+#define INPUT 0
+#define OUTPUT 1
+#define LOW 0
+#define HIGH 1
+#define SS 10
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+
+/*=============================================>>>>>
+= Print/Stream subset used by the core =
+===============================================>>>>>*/
+class Print{
+
+public:
+   virtual size_t write(uint8_t outByte) = 0;
+   virtual size_t write(const uint8_t* buf, size_t len){
+      size_t count = 0;
+      while(len--){
+         count += write(*buf++);
+      }
+      return count;
+   }
+   size_t write(const char* str){
+      return write((const uint8_t*)str, strlen(str));
+   }
+   virtual void flush(){}
+
+   size_t print(const char* str){
+      return write(str);
+   }
+   size_t print(char c){
+      return write((uint8_t)c);
+   }
+   size_t print(unsigned long value, int base = DEC){
+      char buf[24];
+      snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%lu", value);
+      return print(buf);
+   }
+   size_t print(long value, int base = DEC){
+      if(base == HEX){
+         return print((unsigned long)value, HEX);
+      }
+      char buf[24];
+      snprintf(buf, sizeof(buf), "%ld", value);
+      return print(buf);
+   }
+   size_t print(unsigned int value, int base = DEC){
+      return print((unsigned long)value, base);
+   }
+   size_t print(int value, int base = DEC){
+      return print((long)value, base);
+   }
+   size_t print(uint8_t value, int base = DEC){
+      return print((unsigned long)value, base);
+   }
+   size_t println(){
+      return print("\r\n");
+   }
+   template<class T> size_t println(T value){
+      size_t count = print(value);
+      return count + println();
+   }
+   template<class T> size_t println(T value, int base){
+      size_t count = print(value, base);
+      return count + println();
+   }
+};
+
+class Stream : public Print{
+
+public:
+   virtual int available() = 0;
+   virtual int read() = 0;
+   virtual int peek() = 0;
+};
+
+/*=============================================>>>>>
+= Serial port stand-in.  With no file descriptor attached it writes to stdout
+and never has anything to read =
+===============================================>>>>>*/
+class HardwareSerial : public Stream{
+
+public:
+   //Use an already opened (and configured) port
+   void attach(int fd){
+      port_fd = fd;
+      peeked = -1;
+   }
+   int fd(){
+      return port_fd;
+   }
+   void begin(unsigned long baud){
+      (void)baud;
+   }
+   void end(){}
+
+   size_t write(uint8_t outByte);
+   size_t write(const uint8_t* buf, size_t len);
+   using Print::write;
+   int available();
+   int read();
+   int peek();
+   void flush();
+
+private:
+   int port_fd = -1;
+   int peeked = -1;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+#endif
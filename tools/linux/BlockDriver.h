@@ -0,0 +1,20 @@
+/**
+*
+*
+
+Host replacement for SdFat/BlockDriver.h.  On a PC there is no SD card
+driver, so FatLib talks to whatever BaseBlockDriver the tool supplies (for
+example a FAT image file, see tools/fatbench.cpp).
+
+Put tools/linux on the include path ahead of SdFat so this file is found
+first.
+
+*
+*/
+
+#ifndef BlockDriver_h
+#define BlockDriver_h
+#include "FatLib/BaseBlockDriver.h"
+/** typedef for BlockDriver */
+typedef BaseBlockDriver BlockDriver;
+#endif  // BlockDriver_h
@@ -0,0 +1,159 @@
+/**
+*
+*
+
+POSIX stand-ins for the few SdFat classes the programmer core uses, so that
+STK_500_Programmer.cpp builds on a Linux PC with image files read straight from
+the host file system.
+
+*
+*/
+
+#ifndef HOST_SDFAT_H
+#define HOST_SDFAT_H
+
+/*=============================================>>>>>
+= Dependencies =
+===============================================>>>>>*/
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "Arduino.h"
+
+/*=============================================>>>>>
+= Definitions =
+===============================================>>>>>*/
+#define O_READ O_RDONLY
+#define O_WRITE O_WRONLY
+
+//Directory entry fields the core looks at
+struct dir_t{
+   uint32_t fileSize;
+   uint16_t lastWriteDate;   //FAT encoded date
+   uint16_t lastWriteTime;   //FAT encoded time
+};
+
+/*=============================================>>>>>
+= File on the host file system with the SdFile calls used by the core =
+===============================================>>>>>*/
+class SdFile{
+
+public:
+   ~SdFile(){
+      close();
+   }
+
+   bool open(const char* path, int oflag = O_READ){
+      close();
+      file_fd = ::open(path, oflag, 0644);
+      if(file_fd < 0){
+         return false;
+      }
+      file_path = path;
+      return true;
+   }
+
+   bool isOpen() const{
+      return file_fd >= 0;
+   }
+
+   bool close(){
+      if(file_fd >= 0){
+         ::close(file_fd);
+         file_fd = -1;
+      }
+      return true;
+   }
+
+   int read(void* buf, size_t len){
+      return ::read(file_fd, buf, len);
+   }
+
+   int peek(){
+      uint8_t peekByte;
+      off_t pos = lseek(file_fd, 0, SEEK_CUR);
+      if(::read(file_fd, &peekByte, 1) != 1){
+         return -1;
+      }
+      lseek(file_fd, pos, SEEK_SET);
+      return peekByte;
+   }
+
+   bool seekSet(uint32_t pos){
+      return lseek(file_fd, pos, SEEK_SET) == (off_t)pos;
+   }
+
+   uint32_t fileSize(){
+      struct stat fileStat;
+      if(fstat(file_fd, &fileStat) != 0){
+         return 0;
+      }
+      return fileStat.st_size;
+   }
+
+   int write(const void* buf, size_t len){
+      return ::write(file_fd, buf, len);
+   }
+
+   bool remove(){
+      close();
+      return file_path && unlink(file_path) == 0;
+   }
+
+   //Size and modification time, with the time packed the way FAT stores it
+   bool dirEntry(dir_t* dir){
+      struct stat fileStat;
+      if(fstat(file_fd, &fileStat) != 0){
+         return false;
+      }
+      struct tm modTime;
+      localtime_r(&fileStat.st_mtime, &modTime);
+      dir->fileSize = fileStat.st_size;
+      dir->lastWriteDate = ((modTime.tm_year - 80) << 9) | ((modTime.tm_mon + 1) << 5) | modTime.tm_mday;
+      dir->lastWriteTime = (modTime.tm_hour << 11) | (modTime.tm_min << 5) | (modTime.tm_sec >> 1);
+      return true;
+   }
+
+private:
+   int file_fd = -1;
+   const char* file_path = NULL;
+};
+
+/*=============================================>>>>>
+= There is no card to initialize on a PC =
+===============================================>>>>>*/
+//The stand-in has the SPI clock tuning calls, they just do nothing
+#ifndef ENABLE_SPI_CLOCK_TUNING
+#define ENABLE_SPI_CLOCK_TUNING 1
+#endif
+#define SD_SCK_MHZ(maxMhz) (1000000UL*(maxMhz))
+
+class SdFat{
+
+public:
+   bool begin(uint8_t csPin){
+      (void)csPin;
+      return true;
+   }
+   bool begin(uint8_t csPin, uint32_t maxSckHz){
+      (void)csPin;
+      (void)maxSckHz;
+      return true;
+   }
+   //No SPI clock to tune either
+   SdFat* card(){
+      return this;
+   }
+   uint32_t spiClock(){
+      return 0;
+   }
+   uint8_t cardErrorCode(){
+      return 0;
+   }
+   uint32_t cardErrorData(){
+      return 0;
+   }
+};
+
+#endif
@@ -0,0 +1,128 @@
+/**
+*
+*
+
+Linux implementations of the Arduino core functions declared in
+tools/linux/Arduino.h.
+
+*
+*/
+
+#if !defined(ARDUINO) && !defined(PLATFORM_ID)
+
+/*=============================================>>>>>
+= Dependencies =
+===============================================>>>>>*/
+#include <errno.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "Arduino.h"
+
+/*=============================================>>>>>
+= Global variables =
+===============================================>>>>>*/
+HardwareSerial Serial;
+HardwareSerial Serial1;
+
+static unsigned long long monotonic_us(){
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (unsigned long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+//Time counts from the first call, like an Arduino counts from power up
+static unsigned long long start_us = monotonic_us();
+
+unsigned long millis(){
+   return (monotonic_us() - start_us) / 1000;
+}
+
+unsigned long micros(){
+   return monotonic_us() - start_us;
+}
+
+void delay(unsigned long ms){
+   usleep(ms * 1000);
+}
+
+void pinMode(uint8_t pin, uint8_t mode){
+   (void)pin;
+   (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value){
+   (void)pin;
+   (void)value;
+}
+
+/*=============================================>>>>>
+= HardwareSerial functions =
+===============================================>>>>>*/
+size_t HardwareSerial::write(uint8_t outByte){
+   return write(&outByte, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t* buf, size_t len){
+   if(port_fd < 0){
+      return fwrite(buf, 1, len, stdout);
+   }
+   size_t count = 0;
+   while(count < len){
+      ssize_t written = ::write(port_fd, buf + count, len - count);
+      if(written < 0){
+         if(errno == EINTR || errno == EAGAIN){
+            continue;
+         }
+         break;
+      }
+      count += written;
+   }
+   return count;
+}
+
+int HardwareSerial::available(){
+   if(peeked >= 0){
+      return 1;
+   }
+   if(port_fd < 0){
+      return 0;
+   }
+   struct pollfd pfd = {port_fd, POLLIN, 0};
+   return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN) ? 1 : 0;
+}
+
+int HardwareSerial::read(){
+   if(peeked >= 0){
+      int inByte = peeked;
+      peeked = -1;
+      return inByte;
+   }
+   if(!available()){
+      return -1;
+   }
+   uint8_t inByte;
+   if(::read(port_fd, &inByte, 1) != 1){
+      return -1;
+   }
+   return inByte;
+}
+
+int HardwareSerial::peek(){
+   if(peeked < 0){
+      peeked = read();
+   }
+   return peeked;
+}
+
+void HardwareSerial::flush(){
+   if(port_fd < 0){
+      fflush(stdout);
+   }
+   else{
+      tcdrain(port_fd);
+   }
+}
+
+#endif
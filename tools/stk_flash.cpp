@@ -0,0 +1,518 @@
+/**
+*
+*
+
+Linux command line flasher built from the same core as the sketch.
+
+Decodes a .hex or .hxz image once with HexFileClass (pre-flight checks
+included), then programs and verifies any number of Optiboot targets on
+USB-serial ports at the same time.  Each port gets its own non-blocking
+STK_Session and a single epoll loop services them all, so flashing ten boards
+takes about as long as flashing one.
+
+With -e N the tool also creates N emulated Optiboot targets on pseudo
+terminals and flashes those, which exercises the whole path (image decoding,
+sessions, port handling) without any hardware.  The emulators' flash is
+checked against the image at the end.
+
+Build and run on a Linux PC (this file is not part of the sketch):
+
+   g++ -O2 -std=gnu++11 -I tools/linux -o stk_flash tools/stk_flash.cpp \
+       tools/linux/host_arduino.cpp STK_500_Programmer.cpp STK_Engine.cpp
+   ./stk_flash [-b baud] [-r break|dtr|none] [-e N] firmware.hex [port...]
+
+   -b   serial baud rate (default 115200)
+   -r   how to reset the targets into Optiboot (default break):
+          break  hold TX low for a second, for the watchdog reset circuit
+          dtr    pulse DTR, like an Arduino Uno/Nano auto-reset
+          none   targets are already waiting in Optiboot
+   -e   also flash N emulated targets on pseudo terminals
+
+*
+*/
+
+#if !defined(ARDUINO) && !defined(PLATFORM_ID)
+
+/*=============================================>>>>>
+= Dependencies =
+===============================================>>>>>*/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+#include "Arduino.h"
+#include "../STK_500_Programmer.h"
+#include "../STK_Engine.h"
+#include "../stk500.h"
+
+/*=============================================>>>>>
+= Definitions =
+===============================================>>>>>*/
+#define EMULATOR_FLASH_BYTES 32768     //ATmega328P
+#define TICK_MS 10                     //How often sessions are polled for timeouts
+#define RESET_HOLD_MS 1000             //Same as STK_Programmer::resetTarget()
+#define RESET_SETTLE_MS 100
+
+enum reset_mode_t{
+   RESET_BREAK,
+   RESET_DTR,
+   RESET_NONE
+};
+
+/*=============================================>>>>>
+= Emulated Optiboot target on the master side of a pseudo terminal =
+===============================================>>>>>*/
+struct Emulator{
+   int fd = -1;
+   char slavePath[64];
+   byte flash[EMULATOR_FLASH_BYTES];
+   uint32_t address = 0;              //Byte address
+   byte cmd[STK_MAX_MSG_BYTES];
+   uint16_t cmdLen = 0;
+   bool left = false;                 //Saw STK_LEAVE_PROGMODE
+};
+
+/*=============================================>>>>>
+= One target port and the session driving it =
+===============================================>>>>>*/
+struct Port{
+   const char* name;
+   int fd = -1;
+   bool emulated = false;
+   bool done = false;
+   STK_Session session;
+   unsigned long timeEnd = 0;
+};
+
+/*=============================================>>>>>
+= Global variables =
+===============================================>>>>>*/
+static std::vector<flash_page_block_t> pages;
+
+static speed_t baudToSpeed(long baud){
+   switch(baud){
+      case 9600: return B9600;
+      case 19200: return B19200;
+      case 38400: return B38400;
+      case 57600: return B57600;
+      case 115200: return B115200;
+      case 230400: return B230400;
+      case 460800: return B460800;
+      case 500000: return B500000;
+      case 921600: return B921600;
+      case 1000000: return B1000000;
+      default: return 0;
+   }
+}
+
+/*=============================================>>>>>
+= Function to open a serial port in raw, non-blocking 8N1 mode =
+===============================================>>>>>*/
+static int openPort(const char* path, speed_t speed){
+   int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+   if(fd < 0){
+      perror(path);
+      return -1;
+   }
+   struct termios tio;
+   if(tcgetattr(fd, &tio) != 0){
+      perror(path);
+      close(fd);
+      return -1;
+   }
+   cfmakeraw(&tio);
+   tio.c_cflag |= CLOCAL | CREAD;
+   tio.c_cflag &= ~CRTSCTS;
+   tio.c_cc[VMIN] = 0;
+   tio.c_cc[VTIME] = 0;
+   cfsetispeed(&tio, speed);
+   cfsetospeed(&tio, speed);
+   if(tcsetattr(fd, TCSANOW, &tio) != 0){
+      perror(path);
+      close(fd);
+      return -1;
+   }
+   return fd;
+}
+
+/*=============================================>>>>>
+= Function to decode the image into flash pages once, for every session to share =
+===============================================>>>>>*/
+static bool loadImage(const char* path){
+   HexFileClass imageFile;
+   if(!imageFile.begin(path)){
+      fprintf(stderr, "%s: could not open image\n", path);
+      return false;
+   }
+   if(!imageFile.preflight_check()){
+      fprintf(stderr, "%s: image failed pre-flight check\n", path);
+      return false;
+   }
+   while(imageFile.moreBytesToConsume()){
+      flash_page_block_t page;
+      page.block_size_bytes = imageFile.load_hex_records_flash_data_block(page);
+      if(imageFile.failed()){
+         fprintf(stderr, "%s: image decode failed\n", path);
+         return false;
+      }
+      if(page.block_size_bytes){
+         pages.push_back(page);
+      }
+   }
+   if(pages.empty()){
+      fprintf(stderr, "%s: no data in image\n", path);
+      return false;
+   }
+   return true;
+}
+
+/*=============================================>>>>>
+= Emulator functions =
+===============================================>>>>>*/
+
+static bool emulatorOpen(Emulator &emu){
+   emu.fd = posix_openpt(O_RDWR | O_NOCTTY);
+   if(emu.fd < 0 || grantpt(emu.fd) != 0 || unlockpt(emu.fd) != 0){
+      perror("posix_openpt");
+      return false;
+   }
+   snprintf(emu.slavePath, sizeof(emu.slavePath), "%s", ptsname(emu.fd));
+   memset(emu.flash, 0xFF, sizeof(emu.flash));
+   fcntl(emu.fd, F_SETFL, fcntl(emu.fd, F_GETFL) | O_NONBLOCK);
+   return true;
+}
+
+static void emulatorReply(Emulator &emu, const byte* data, uint16_t len){
+   while(len){
+      ssize_t written = write(emu.fd, data, len);
+      if(written < 0){
+         if(errno == EINTR || errno == EAGAIN) continue;
+         return;
+      }
+      data += written;
+      len -= written;
+   }
+}
+
+/*=============================================>>>>>
+= Function to work out how long a command is from its first bytes.
+Returns 0 until enough has arrived to tell =
+===============================================>>>>>*/
+static uint16_t emulatorCommandLength(Emulator &emu){
+   switch(emu.cmd[0]){
+      case STK_LOAD_ADDRESS:
+         return 4;
+      case STK_READ_PAGE:
+         return 5;
+      case STK_PROG_PAGE:
+         if(emu.cmdLen < 3){
+            return 0;
+         }
+         return 4 + ((emu.cmd[1] << 8) | emu.cmd[2]) + 1;
+      default:
+         return 2;
+   }
+}
+
+static void emulatorCommand(Emulator &emu){
+   byte reply[2 + BYTES_PER_FLASH_BLOCK];
+   uint16_t replyLen = 0;
+   reply[replyLen++] = STK_INSYNC;
+   switch(emu.cmd[0]){
+      case STK_LOAD_ADDRESS:
+         //Optiboot takes word addresses
+         emu.address = ((emu.cmd[2] << 8) | emu.cmd[1]) * 2;
+         break;
+      case STK_PROG_PAGE:{
+         uint16_t len = (emu.cmd[1] << 8) | emu.cmd[2];
+         for(uint16_t i = 0; i < len && emu.address + i < EMULATOR_FLASH_BYTES; i++){
+            emu.flash[emu.address + i] = emu.cmd[4 + i];
+         }
+         break;
+      }
+      case STK_READ_PAGE:{
+         uint16_t len = (emu.cmd[1] << 8) | emu.cmd[2];
+         for(uint16_t i = 0; i < len && i < BYTES_PER_FLASH_BLOCK; i++){
+            reply[replyLen++] = (emu.address + i < EMULATOR_FLASH_BYTES) ? emu.flash[emu.address + i] : 0xFF;
+         }
+         break;
+      }
+      case STK_LEAVE_PROGMODE:
+         emu.left = true;
+         break;
+      default:
+         break;
+   }
+   reply[replyLen++] = STK_OK;
+   emulatorReply(emu, reply, replyLen);
+}
+
+static void emulatorReceive(Emulator &emu){
+   byte inBuf[256];
+   ssize_t count;
+   while((count = read(emu.fd, inBuf, sizeof(inBuf))) > 0){
+      for(ssize_t i = 0; i < count; i++){
+         if(emu.cmdLen < sizeof(emu.cmd)){
+            emu.cmd[emu.cmdLen++] = inBuf[i];
+         }
+         uint16_t cmdLen = emulatorCommandLength(emu);
+         if(cmdLen && emu.cmdLen >= cmdLen){
+            if(emu.cmd[cmdLen - 1] == CRC_EOP){
+               emulatorCommand(emu);
+            }
+            emu.cmdLen = 0;
+         }
+      }
+   }
+}
+
+static bool emulatorMatchesImage(Emulator &emu){
+   for(size_t i = 0; i < pages.size(); i++){
+      uint32_t address = (uint32_t)pages[i].addressStart * 2;
+      if(address + pages[i].block_size_bytes > EMULATOR_FLASH_BYTES ||
+         memcmp(emu.flash + address, pages[i].dataBytes, pages[i].block_size_bytes) != 0){
+         return false;
+      }
+   }
+   return emu.left;
+}
+
+/*= End of emulator functions =*/
+/*=============================================<<<<<*/
+
+/*=============================================>>>>>
+= Function to reset every real target at once, so a whole rack takes one reset time =
+===============================================>>>>>*/
+static void resetTargets(std::vector<Port> &ports, reset_mode_t mode){
+   if(mode == RESET_NONE){
+      return;
+   }
+   int dtr = TIOCM_DTR;
+   for(size_t i = 0; i < ports.size(); i++){
+      if(ports[i].emulated){
+         continue;
+      }
+      if(mode == RESET_BREAK){
+         ioctl(ports[i].fd, TIOCSBRK);
+      }
+      else{
+         ioctl(ports[i].fd, TIOCMBIC, &dtr);
+      }
+   }
+   usleep((mode == RESET_BREAK ? RESET_HOLD_MS : RESET_SETTLE_MS) * 1000);
+   for(size_t i = 0; i < ports.size(); i++){
+      if(ports[i].emulated){
+         continue;
+      }
+      if(mode == RESET_BREAK){
+         ioctl(ports[i].fd, TIOCCBRK);
+      }
+      else{
+         ioctl(ports[i].fd, TIOCMBIS, &dtr);
+      }
+      tcflush(ports[i].fd, TCIFLUSH);
+   }
+   usleep(RESET_SETTLE_MS * 1000);
+}
+
+/*=============================================>>>>>
+= Function to push out whatever a session has queued, as far as the port takes it =
+===============================================>>>>>*/
+static void portSend(Port &port){
+   while(port.session.txPending()){
+      ssize_t written = write(port.fd, port.session.txData(), port.session.txPending());
+      if(written <= 0){
+         return;
+      }
+      port.session.txConsumed(written);
+   }
+}
+
+static void updateEvents(int epfd, Port &port, size_t index, uint32_t &current){
+   uint32_t wanted = 0;
+   if(!port.done){
+      wanted = (uint32_t)EPOLLIN | (port.session.txPending() ? (uint32_t)EPOLLOUT : 0);
+   }
+   if(wanted == current){
+      return;
+   }
+   struct epoll_event ev;
+   ev.events = wanted;
+   ev.data.u64 = index;
+   epoll_ctl(epfd, EPOLL_CTL_MOD, port.fd, &ev);
+   current = wanted;
+}
+
+int main(int argc, char** argv){
+   long baud = 115200;
+   reset_mode_t resetMode = RESET_BREAK;
+   int numEmulators = 0;
+   int opt;
+   while((opt = getopt(argc, argv, "b:r:e:")) != -1){
+      switch(opt){
+         case 'b': baud = atol(optarg); break;
+         case 'r':
+            if(!strcmp(optarg, "break")) resetMode = RESET_BREAK;
+            else if(!strcmp(optarg, "dtr")) resetMode = RESET_DTR;
+            else if(!strcmp(optarg, "none")) resetMode = RESET_NONE;
+            else{
+               fprintf(stderr, "unknown reset mode %s\n", optarg);
+               return 2;
+            }
+            break;
+         case 'e': numEmulators = atoi(optarg); break;
+         default:
+            fprintf(stderr, "usage: %s [-b baud] [-r break|dtr|none] [-e N] firmware.hex [port...]\n", argv[0]);
+            return 2;
+      }
+   }
+   if(argc - optind < 1 || (argc - optind < 2 && numEmulators <= 0)){
+      fprintf(stderr, "usage: %s [-b baud] [-r break|dtr|none] [-e N] firmware.hex [port...]\n", argv[0]);
+      return 2;
+   }
+   speed_t speed = baudToSpeed(baud);
+   if(!speed){
+      fprintf(stderr, "unsupported baud rate %ld\n", baud);
+      return 2;
+   }
+   if(!loadImage(argv[optind])){
+      return 1;
+   }
+
+   std::vector<Emulator*> emulators;
+   std::vector<Port> ports;
+   for(int i = optind + 1; i < argc; i++){
+      Port port;
+      port.name = argv[i];
+      port.fd = openPort(argv[i], speed);
+      if(port.fd < 0){
+         return 1;
+      }
+      ports.push_back(port);
+   }
+   for(int i = 0; i < numEmulators; i++){
+      Emulator* emu = new Emulator;
+      if(!emulatorOpen(*emu)){
+         return 1;
+      }
+      emulators.push_back(emu);
+      Port port;
+      port.name = emu->slavePath;
+      port.emulated = true;
+      port.fd = openPort(emu->slavePath, speed);
+      if(port.fd < 0){
+         return 1;
+      }
+      ports.push_back(port);
+   }
+
+   resetTargets(ports, resetMode);
+
+   /*=============================================>>>>>
+   = Event loop.  Ports are indexed 0..n-1, emulators n..n+m-1 =
+   ===============================================>>>>>*/
+   int epfd = epoll_create1(0);
+   std::vector<uint32_t> portEvents(ports.size(), 0);
+   unsigned long timeStart = millis();
+   for(size_t i = 0; i < ports.size(); i++){
+      struct epoll_event ev;
+      ev.events = 0;
+      ev.data.u64 = i;
+      epoll_ctl(epfd, EPOLL_CTL_ADD, ports[i].fd, &ev);
+      ports[i].session.begin(pages.data(), pages.size(), timeStart);
+      updateEvents(epfd, ports[i], i, portEvents[i]);
+   }
+   for(size_t i = 0; i < emulators.size(); i++){
+      struct epoll_event ev;
+      ev.events = EPOLLIN;
+      ev.data.u64 = ports.size() + i;
+      epoll_ctl(epfd, EPOLL_CTL_ADD, emulators[i]->fd, &ev);
+   }
+
+   size_t remaining = ports.size();
+   while(remaining){
+      struct epoll_event events[32];
+      int numEvents = epoll_wait(epfd, events, 32, TICK_MS);
+      unsigned long now = millis();
+      for(int e = 0; e < numEvents; e++){
+         size_t index = events[e].data.u64;
+         if(index >= ports.size()){
+            emulatorReceive(*emulators[index - ports.size()]);
+            continue;
+         }
+         Port &port = ports[index];
+         if(events[e].events & EPOLLOUT){
+            portSend(port);
+         }
+         if(events[e].events & EPOLLIN){
+            byte inBuf[256];
+            ssize_t count;
+            while((count = read(port.fd, inBuf, sizeof(inBuf))) > 0){
+               for(ssize_t i = 0; i < count; i++){
+                  port.session.receive(inBuf[i], now);
+               }
+            }
+         }
+      }
+      for(size_t i = 0; i < ports.size(); i++){
+         Port &port = ports[i];
+         if(port.done){
+            continue;
+         }
+         port.session.poll(now);
+         //A reply may have queued the next message; send it straight away
+         portSend(port);
+         if(!port.session.busy()){
+            port.done = true;
+            port.timeEnd = now;
+            remaining--;
+         }
+         updateEvents(epfd, port, i, portEvents[i]);
+      }
+   }
+
+   /*=============================================>>>>>
+   = Summary =
+   ===============================================>>>>>*/
+   uint32_t imageBytes = 0;
+   for(size_t i = 0; i < pages.size(); i++){
+      imageBytes += pages[i].block_size_bytes;
+   }
+   int failures = 0;
+   size_t emuIndex = 0;
+   for(size_t i = 0; i < ports.size(); i++){
+      Port &port = ports[i];
+      bool ok = port.session.getState() == STK_SESSION_SUCCESS;
+      if(ok && port.emulated && !emulatorMatchesImage(*emulators[emuIndex])){
+         printf("%-14s FAILED: emulated flash does not match image\n", port.name);
+         failures++;
+      }
+      else if(ok){
+         printf("%-14s ok, %u bytes programmed and verified in %lu ms\n", port.name, imageBytes, port.timeEnd - timeStart);
+      }
+      else{
+         printf("%-14s FAILED: %s\n", port.name, port.session.errorMessage());
+         failures++;
+      }
+      if(port.emulated){
+         emuIndex++;
+      }
+      close(port.fd);
+   }
+   for(size_t i = 0; i < emulators.size(); i++){
+      close(emulators[i]->fd);
+      delete emulators[i];
+   }
+   close(epfd);
+   printf("%zu of %zu targets flashed in %lu ms\n", ports.size() - failures, ports.size(), millis() - timeStart);
+   return failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,315 @@
+/**
+*
+*
+
+PC side of the serial upload protocol (see serial_upload.h).
+
+Streams an Intel hex image over the host Arduino's USB serial port straight
+into the target, a page at a time, while the Arduino programs and verifies
+each page.  Optionally the Arduino also saves the image to its SD card so it
+can carry on flashing boards on its own afterwards.
+
+Build and run on a Linux PC (this file is not part of the sketch):
+
+   g++ -O2 -o stk_upload tools/stk_upload.cpp
+   ./stk_upload [-b baud] [-w ms] [-s FIRMWARE.HEX] /dev/ttyACM0 firmware.hex
+
+   -b   serial baud rate (default 115200, ignored by native USB boards)
+   -w   milliseconds to wait after opening the port, for boards that reset
+        when the port opens (default 2000)
+   -s   file name the Arduino should save the image to on its SD card
+
+*
+*/
+
+#if !defined(ARDUINO) && !defined(PLATFORM_ID)
+
+/*=============================================>>>>>
+= Dependencies =
+===============================================>>>>>*/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "../serial_upload.h"
+#include "hexload.h"
+
+/*=============================================>>>>>
+= Definitions =
+===============================================>>>>>*/
+#define REPLY_TIMEOUT_MS 10000   //Covers the target reset after UPLOAD_FRAME_BEGIN
+#define MAX_RESENDS 5
+
+/*=============================================>>>>>
+= Global variables =
+===============================================>>>>>*/
+static uint8_t image[MAX_IMAGE_BYTES];
+
+static long long nowMs(){
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static speed_t baudToSpeed(long baud){
+   switch(baud){
+      case 9600: return B9600;
+      case 19200: return B19200;
+      case 38400: return B38400;
+      case 57600: return B57600;
+      case 115200: return B115200;
+      case 230400: return B230400;
+      case 460800: return B460800;
+      case 500000: return B500000;
+      case 921600: return B921600;
+      case 1000000: return B1000000;
+      default: return 0;
+   }
+}
+
+/*=============================================>>>>>
+= Function to open a serial port in raw 8N1 mode =
+===============================================>>>>>*/
+static int openPort(const char* path, long baud){
+   speed_t speed = baudToSpeed(baud);
+   if(!speed){
+      fprintf(stderr, "unsupported baud rate %ld\n", baud);
+      return -1;
+   }
+   int fd = open(path, O_RDWR | O_NOCTTY);
+   if(fd < 0){
+      perror(path);
+      return -1;
+   }
+   struct termios tio;
+   if(tcgetattr(fd, &tio) != 0){
+      perror(path);
+      close(fd);
+      return -1;
+   }
+   cfmakeraw(&tio);
+   tio.c_cflag |= CLOCAL | CREAD;
+   tio.c_cflag &= ~CRTSCTS;
+   tio.c_cc[VMIN] = 0;
+   tio.c_cc[VTIME] = 0;
+   cfsetispeed(&tio, speed);
+   cfsetospeed(&tio, speed);
+   if(tcsetattr(fd, TCSANOW, &tio) != 0){
+      perror(path);
+      close(fd);
+      return -1;
+   }
+   return fd;
+}
+
+static bool writeAll(int fd, const uint8_t* data, size_t len){
+   while(len){
+      ssize_t written = write(fd, data, len);
+      if(written < 0){
+         if(errno == EINTR) continue;
+         perror("write");
+         return false;
+      }
+      data += written;
+      len -= written;
+   }
+   return true;
+}
+
+static uint16_t crc16(uint16_t crc, uint8_t data){
+   crc ^= (uint16_t)data << 8;
+   for(int bit = 0; bit < 8; bit++){
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+   }
+   return crc;
+}
+
+static bool sendFrame(int fd, uint8_t type, const uint8_t* payload, uint8_t len){
+   uint8_t frame[3 + 255 + 2];
+   frame[0] = UPLOAD_SOF;
+   frame[1] = type;
+   frame[2] = len;
+   memcpy(frame + 3, payload, len);
+   uint16_t crc = 0xFFFF;
+   for(int i = 1; i < 3 + len; i++){
+      crc = crc16(crc, frame[i]);
+   }
+   frame[3 + len] = crc & 0xFF;
+   frame[4 + len] = crc >> 8;
+   return writeAll(fd, frame, 5 + len);
+}
+
+/*=============================================>>>>>
+= Function to wait for a reply code.  Debug text from the Arduino is passed
+through to stderr.  Returns -1 on timeout =
+===============================================>>>>>*/
+static int waitReply(int fd, int timeoutMs){
+   //Bytes seen since the last SOF, so text that happens to contain SOF is still shown
+   uint8_t pending[3];
+   int pendingLen = 0;
+   long long deadline = nowMs() + timeoutMs;
+   while(1){
+      long long left = deadline - nowMs();
+      if(left <= 0){
+         return -1;
+      }
+      struct pollfd pfd = {fd, POLLIN, 0};
+      if(poll(&pfd, 1, (int)left) <= 0){
+         continue;
+      }
+      uint8_t inByte;
+      if(read(fd, &inByte, 1) != 1){
+         continue;
+      }
+      if(!pendingLen){
+         if(inByte == UPLOAD_SOF){
+            pending[pendingLen++] = inByte;
+         }
+         else{
+            fputc(inByte, stderr);
+         }
+         continue;
+      }
+      pending[pendingLen++] = inByte;
+      if(pendingLen == 3){
+         if((uint8_t)~pending[1] == pending[2]){
+            return pending[1];
+         }
+         fwrite(pending, 1, 3, stderr);
+         pendingLen = 0;
+      }
+   }
+}
+
+/*=============================================>>>>>
+= Function to send a frame and collect its reply, resending damaged frames =
+===============================================>>>>>*/
+static int exchange(int fd, uint8_t type, const uint8_t* payload, uint8_t len){
+   for(int attempt = 0; attempt <= MAX_RESENDS; attempt++){
+      if(!sendFrame(fd, type, payload, len)){
+         return -1;
+      }
+      int reply = waitReply(fd, REPLY_TIMEOUT_MS);
+      if(reply != UPLOAD_REPLY_RESEND){
+         return reply;
+      }
+   }
+   return UPLOAD_REPLY_RESEND;
+}
+
+static const char* replyName(int reply){
+   switch(reply){
+      case -1: return "no reply";
+      case UPLOAD_REPLY_ACK: return "ack";
+      case UPLOAD_REPLY_RESEND: return "too many resends";
+      case UPLOAD_REPLY_DONE: return "done";
+      case UPLOAD_REPLY_TARGET_ERROR: return "target error";
+      case UPLOAD_REPLY_SD_ERROR: return "SD card error";
+      case UPLOAD_REPLY_BAD_FRAME: return "bad frame";
+      default: return "unknown reply";
+   }
+}
+
+int main(int argc, char** argv){
+   long baud = 115200;
+   int waitMs = 2000;
+   const char* saveName = NULL;
+   int opt;
+   while((opt = getopt(argc, argv, "b:w:s:")) != -1){
+      switch(opt){
+         case 'b': baud = atol(optarg); break;
+         case 'w': waitMs = atoi(optarg); break;
+         case 's': saveName = optarg; break;
+         default:
+            fprintf(stderr, "usage: %s [-b baud] [-w ms] [-s FIRMWARE.HEX] port firmware.hex\n", argv[0]);
+            return 2;
+      }
+   }
+   if(argc - optind != 2){
+      fprintf(stderr, "usage: %s [-b baud] [-w ms] [-s FIRMWARE.HEX] port firmware.hex\n", argv[0]);
+      return 2;
+   }
+   const char* portPath = argv[optind];
+   const char* hexPath = argv[optind + 1];
+   if(saveName && strlen(saveName) > UPLOAD_MAX_FILE_NAME){
+      fprintf(stderr, "save file name longer than %d characters\n", UPLOAD_MAX_FILE_NAME);
+      return 2;
+   }
+
+   uint32_t lowAddr;
+   uint32_t highAddr;
+   if(!loadHex(hexPath, image, &lowAddr, &highAddr)){
+      return 1;
+   }
+   uint32_t baseAddr = lowAddr - (lowAddr % UPLOAD_PAGE_BYTES);
+   uint32_t imageLen = highAddr - baseAddr;
+
+   int fd = openPort(portPath, baud);
+   if(fd < 0){
+      return 1;
+   }
+   usleep(waitMs * 1000);
+   tcflush(fd, TCIOFLUSH);
+
+   long long timeStart = nowMs();
+   //Put the sketch into upload mode
+   if(!writeAll(fd, (const uint8_t*)"2", 1)){
+      close(fd);
+      return 1;
+   }
+   uint8_t payload[UPLOAD_MAX_PAYLOAD > 7 + UPLOAD_MAX_FILE_NAME ? UPLOAD_MAX_PAYLOAD : 7 + UPLOAD_MAX_FILE_NAME];
+   payload[0] = imageLen & 0xFF;
+   payload[1] = (imageLen >> 8) & 0xFF;
+   payload[2] = (imageLen >> 16) & 0xFF;
+   payload[3] = (imageLen >> 24) & 0xFF;
+   payload[4] = baseAddr & 0xFF;
+   payload[5] = (baseAddr >> 8) & 0xFF;
+   payload[6] = saveName ? UPLOAD_FLAG_SAVE_TO_SD : 0;
+   uint8_t beginLen = 7;
+   if(saveName){
+      memcpy(payload + 7, saveName, strlen(saveName));
+      beginLen += strlen(saveName);
+   }
+   int reply = exchange(fd, UPLOAD_FRAME_BEGIN, payload, beginLen);
+   if(reply != UPLOAD_REPLY_ACK){
+      fprintf(stderr, "\nupload start failed: %s\n", replyName(reply));
+      close(fd);
+      return 1;
+   }
+
+   uint32_t numPages = (imageLen + UPLOAD_PAGE_BYTES - 1) / UPLOAD_PAGE_BYTES;
+   for(uint32_t page = 0; page < numPages; page++){
+      uint32_t pageAddr = baseAddr + page * UPLOAD_PAGE_BYTES;
+      uint32_t pageLen = imageLen - page * UPLOAD_PAGE_BYTES;
+      if(pageLen > UPLOAD_PAGE_BYTES){
+         pageLen = UPLOAD_PAGE_BYTES;
+      }
+      //Optiboot takes word addresses
+      payload[0] = (pageAddr / 2) & 0xFF;
+      payload[1] = ((pageAddr / 2) >> 8) & 0xFF;
+      memcpy(payload + 2, image + pageAddr, pageLen);
+      reply = exchange(fd, UPLOAD_FRAME_PAGE, payload, 2 + pageLen);
+      if(reply != UPLOAD_REPLY_ACK){
+         fprintf(stderr, "\npage at 0x%04X failed: %s\n", pageAddr, replyName(reply));
+         close(fd);
+         return 1;
+      }
+      fprintf(stderr, "\rpage %u/%u", page + 1, numPages);
+   }
+   reply = exchange(fd, UPLOAD_FRAME_END, payload, 0);
+   close(fd);
+   if(reply != UPLOAD_REPLY_DONE){
+      fprintf(stderr, "\nupload failed: %s\n", replyName(reply));
+      return 1;
+   }
+   fprintf(stderr, "\n%u bytes programmed and verified in %lld ms\n", imageLen, nowMs() - timeStart);
+   return 0;
+}
+
+#endif